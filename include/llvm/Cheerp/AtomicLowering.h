@@ -0,0 +1,60 @@
+//===-- Cheerp/AtomicLowering.h - Cheerp optimization pass ---------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_ATOMIC_LOWERING_H
+#define _CHEERP_ATOMIC_LOWERING_H
+
+#include "llvm/Pass.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+
+namespace llvm
+{
+
+/**
+ * Lower atomic instructions to non-atomic form in functions which cannot
+ * use wasm atomics: genericjs functions, and every function when the
+ * linear memory is not shared. In wasm functions using shared memory the
+ * atomic instructions are kept, and only put in the form expected by the
+ * writer:
+ * - read-modify-write operations without a wasm opcode become a cmpxchg loop
+ * - cmpxchg is only used by an extractvalue of the loaded value, directly
+ *   following it. The success flag is computed with an explicit comparison.
+ */
+class AtomicLowering: public FunctionPass
+{
+private:
+	const bool wasmAtomics;
+	static bool hasWasmOpcode(const AtomicRMWInst* RMWI);
+	static Value* emitRMWOperation(IRBuilder<>& Builder, AtomicRMWInst::BinOp Op, Value* Loaded, Value* Val);
+	static void lowerAtomicRMW(AtomicRMWInst* RMWI);
+	static void lowerAtomicCmpXchg(AtomicCmpXchgInst* CXI);
+	static void lowerWasmAtomicIntrinsic(IntrinsicInst* II);
+	static void expandAtomicRMWToCmpXchg(AtomicRMWInst* RMWI);
+	static void canonicalizeCmpXchg(AtomicCmpXchgInst* CXI);
+public:
+	static char ID;
+	explicit AtomicLowering(bool wasmAtomics = false) : FunctionPass(ID), wasmAtomics(wasmAtomics) { }
+	bool runOnFunction(Function &F) override;
+	StringRef getPassName() const override;
+
+	virtual void getAnalysisUsage(AnalysisUsage&) const override;
+};
+
+//===----------------------------------------------------------------------===//
+//
+// AtomicLowering
+//
+FunctionPass *createAtomicLoweringPass(bool wasmAtomics);
+
+}
+
+#endif
@@ -40,6 +40,7 @@ extern llvm::cl::opt<std::string> GlobalPrefix;
 extern llvm::cl::opt<unsigned> CheerpHeapSize;
 extern llvm::cl::opt<unsigned> CheerpStackSize;
 extern llvm::cl::opt<bool> CheerpNoICF;
+extern llvm::cl::opt<bool> CheerpICFNearMiss;
 extern llvm::cl::opt<bool> BoundsCheck;
 extern llvm::cl::opt<bool> CfgLegacy;
 extern llvm::cl::opt<bool> AvoidWasmTraps;
@@ -48,9 +49,18 @@ extern llvm::cl::opt<bool> FixWrongFuncCasts;
 extern llvm::cl::opt<std::string> StrictLinking;
 extern llvm::cl::opt<bool> WasmSharedMemory;
 extern llvm::cl::opt<bool> WasmNoGrowMemory;
+extern llvm::cl::opt<bool> WasmNoPeephole;
 extern llvm::cl::opt<bool> WasmExportedTable;
 extern llvm::cl::opt<bool> WasmAnyref;
 extern llvm::cl::opt<bool> WasmReturnCalls;
+extern llvm::cl::opt<bool> WasmBulkMemory;
+extern llvm::cl::opt<bool> WasmSIMD;
+extern llvm::cl::opt<bool> WasmNontrappingFPToInt;
+extern llvm::cl::opt<bool> WasmSignExt;
+extern llvm::cl::opt<bool> WasmStreaming;
+extern llvm::cl::opt<std::string> WasmModuleCache;
+extern llvm::cl::opt<bool> WasmMultiValue;
 extern llvm::cl::opt<bool> UseBigInts;
+extern llvm::cl::opt<unsigned> CheerpCodegenThreads;
 
 #endif //_CHEERP_COMMAND_LINE_H
@@ -175,7 +175,12 @@ public:
 	void eraseFunction(llvm::Function* F);
 
 private:
-	typedef llvm::SmallSet<const llvm::GlobalValue*, 8> VisitedSet;
+	// A constant whose operands are being visited
+	struct ConstantVisitFrame
+	{
+		const llvm::Constant* C;
+		uint32_t nextOperand;
+	};
 	
 	llvm::StringRef getPassName() const override;
 
@@ -183,29 +188,29 @@ private:
 
 	/**
 	 * Propagate the search across globalvalues (i.e. Functions, GlobalVariables and GlobalAliases)
+	 * and constant expressions, using an explicit stack.
 	 * 
-	 * visited contains the nodes which are being currently visited.
-	 * the subexpr argument is required whenever we are calling this from a visitConstant. 
-	 * It is used only in the circular dependency case, to fill up the fixup map
+	 * When a global variable which is being visited is reached again, the uses followed from
+	 * its initializer are added to the fixup map
 	 */
-	void visitGlobal( const llvm::GlobalValue *, 
-			  VisitedSet & visited, 
-			  const SubExprVec & subexpr );
+	void visitConstant( const llvm::Constant * C );
 	
-	/** 
-	 * Propagate the search across constant expressions.
+	/**
+	 * Collect the constants and the instructions inside a function which are relevant for the analysis.
 	 * 
-	 * visited is just forwarded to visitGlobal
-	 * subexpr is filled with the list of uses followed to get to the current constant being processed
+	 * It does not modify the state of the pass, so functions can be scanned concurrently
 	 */
-	void visitConstant( const llvm::Constant *, 
-			    VisitedSet & visited, 
-			    SubExprVec & subexpr );
-	
+	void scanFunction( const llvm::Function * F, std::vector<const llvm::Value*>& items ) const;
+
+	/**
+	 * Visit in order the items collected by scanFunction
+	 */
+	void visitFunctionItems( const llvm::Function * F, const std::vector<const llvm::Value*>& items );
+
 	/**
 	 * Visit every instruction inside a function.
 	 */
-	void visitFunction( const llvm::Function * F, VisitedSet & visited );
+	void visitFunction( const llvm::Function * F );
 	
 
 	/**
@@ -14,14 +14,18 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Cheerp/LinearMemoryHelper.h"
+#include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/SmallSet.h"
 
+#include <memory>
 #include <unordered_map>
 
 namespace cheerp
 {
 
+class GlobalDepsAnalyzer;
+
 struct pair_hash {
 	template <class T1, class T2>
 	std::size_t operator () (const std::pair<T1,T2> &p) const {
@@ -60,14 +64,42 @@ private:
 	bool equivalentGep(const llvm::GetElementPtrInst* A, const llvm::GetElementPtrInst* B);
 	bool ignoreInstruction(const llvm::Instruction* I);
 	bool hasSameIntegerBitWidth(const llvm::Type* A, const llvm::Type* B);
+	bool equivalentPointerKind(const llvm::Value* A, const llvm::Value* B);
 	bool isStaticIndirectFunction(const llvm::Value* A);
+	void collectCallees(const llvm::Function* leader, bool ownCallees, std::vector<const llvm::Function*>& callees);
 
 	void mergeTwoFunctions(llvm::Function* F, llvm::Function* G);
 
+	// A constant operand of the leader which is different in a similar function
+	struct ConstantDiff
+	{
+		llvm::Instruction* inst;
+		unsigned operand;
+		llvm::Constant* value;
+	};
+	typedef std::vector<ConstantDiff> ConstantDiffs;
+	// Functions are only merged if they differ in at most this many constants
+	static const uint32_t MaxNearMissParams = 4;
+	// Estimated bytes for a function besides its body
+	static const uint32_t NearMissFunctionOverhead = 4;
+	bool isParameterizable(const llvm::Instruction* I, unsigned operand);
+	bool nearMissFunction(llvm::Function* A, llvm::Function* B, ConstantDiffs& diffs);
+	static uint32_t estimateConstantSize(const llvm::Constant* C);
+	static uint32_t estimateFunctionSize(const llvm::Function& F);
+	bool mergeNearMissFunctions(llvm::Module& module, GlobalDepsAnalyzer& GDA);
+	bool mergeNearMissGroup(llvm::Function* leader, const std::vector<std::pair<llvm::Instruction*, unsigned>>& params,
+			const std::vector<std::pair<llvm::Function*, ConstantDiffs>>& members, GlobalDepsAnalyzer& GDA);
+
 	const llvm::DataLayout *DL;
+	// Only available when there are generic JS functions to compare
+	std::unique_ptr<PointerAnalyzer> PA;
+	// True while comparing two generic JS functions
+	bool genericJS;
 
 	llvm::SmallSet<const llvm::PHINode*, 16> visitedPhis;
-	std::unordered_map<std::pair<const llvm::Function*, const llvm::Function*>, bool, pair_hash> functionEquivalence;
+	// For every call in the first function being compared, the function called
+	// by the matching call in the second one
+	std::unordered_map<const llvm::Instruction*, const llvm::Function*> calleeMatches;
 };
 
 inline llvm::Pass* createIdenticalCodeFoldingPass()
@@ -0,0 +1,57 @@
+//===-- Cheerp/InstrProfLowering.h - Cheerp optimization pass ---------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_INSTR_PROF_LOWERING_H
+#define _CHEERP_INSTR_PROF_LOWERING_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Pass.h"
+
+namespace llvm
+{
+
+/**
+ * Lower the profile counters inserted by the PGO instrumentation passes.
+ * The generic lowering needs the compiler-rt profile runtime, so it leaves
+ * the intrinsics alone for the Cheerp triple and they are lowered here.
+ * Every instrumented function gets an array of 32-bit counters, in linear
+ * memory if any of its users is an asmjs function and as a typed array
+ * otherwise. The counters are listed in the cheerp.instrprof named metadata
+ * as {counters, name, hash}, the writer uses it to generate the dump hook.
+ * Counters from the IR level instrumentation are also flagged by the
+ * cheerp.instrprof.ir named metadata.
+ * Value profiling is not supported and its intrinsics are removed.
+ */
+class InstrProfLowering: public ModulePass
+{
+private:
+	StringMap<GlobalVariable*> counters;
+	GlobalVariable* getCounters(Module& M, InstrProfIncrementInst* Inc);
+	void lowerIncrement(InstrProfIncrementInst* Inc);
+public:
+	static char ID;
+	explicit InstrProfLowering() : ModulePass(ID) { }
+	bool runOnModule(Module &M) override;
+	StringRef getPassName() const override;
+
+	virtual void getAnalysisUsage(AnalysisUsage&) const override;
+};
+
+//===----------------------------------------------------------------------===//
+//
+// InstrProfLowering
+//
+ModulePass *createInstrProfLoweringPass();
+
+}
+
+#endif
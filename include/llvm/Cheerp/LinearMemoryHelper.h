@@ -12,6 +12,7 @@
 #ifndef _CHEERP_LINEAR_MEMORY_HELPER_H
 #define _CHEERP_LINEAR_MEMORY_HELPER_H
 
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/Pass.h"
@@ -62,7 +63,7 @@ public:
 		{
 			const llvm::Type* retTy = fTy->getReturnType();
 			size_t hash = 31;
-			hash = hash*31 + std::hash<size_t>()(typeKindOf<isStrict>(retTy));
+			hash = hash*31 + hashTypeKind<isStrict>(retTy);
 			for (const auto& pTy: fTy->params())
 			{
 				hash = hash*31 + std::hash<size_t>()(typeKindOf<isStrict>(pTy));
@@ -79,9 +80,7 @@ public:
 			if (isStrict && lhs->isVarArg() != rhs->isVarArg())
 				return false;
 
-			size_t r1 = typeKindOf<isStrict>(lhs->getReturnType());
-			size_t r2 = typeKindOf<isStrict>(rhs->getReturnType());
-			if (r1 != r2)
+			if (!isSameTypeKind<isStrict>(lhs->getReturnType(), rhs->getReturnType()))
 				return false;
 			if (lhs->getNumParams() != rhs->getNumParams())
 				return false;
@@ -89,8 +88,8 @@ public:
 			auto rit = rhs->param_begin();
 			for (;lit != lhs->param_end(); lit++,rit++)
 			{
-				r1 = typeKindOf<isStrict>(*lit);
-				r2 = typeKindOf<isStrict>(*rit);
+				size_t r1 = typeKindOf<isStrict>(*lit);
+				size_t r2 = typeKindOf<isStrict>(*rit);
 				if (r1 != r2)
 					return false;
 			}
@@ -208,6 +207,11 @@ public:
 		return functionIds;
 	}
 
+	// The first id which is not assigned to any imported or defined function
+	uint32_t getMaxFunctionId() const {
+		return maxFunctionId;
+	}
+
 	uint32_t getStackStart() const {
 		return stackStart;
 	}
@@ -231,6 +235,11 @@ public:
 		return asmjsGlobals;
 	}
 
+	/**
+	 * Get the globals which own their storage, in address order. Globalized
+	 * globals and read-only globals sharing the bytes of another one are
+	 * excluded, so the initializers of this list are the whole data.
+	 */
 	const std::vector<const llvm::GlobalVariable*> & addressableGlobals() const {
 		return asmjsAddressableGlobals;
 	}
@@ -244,6 +253,13 @@ public:
 	struct ByteListener
 	{
 		virtual void addByte(uint8_t b) = 0;
+		// Listeners which can write a whole span at once should override this
+		virtual void addBytes(llvm::ArrayRef<uint8_t> bytes)
+		{
+			for(uint8_t b: bytes)
+				addByte(b);
+		}
+		void addZeros(uint32_t count);
 		virtual ~ByteListener()
 		{
 		}
@@ -322,7 +338,40 @@ private:
 			return TypeKind::Void;
 		llvm_unreachable("unrecognized type kind");
 	}
+	// Multi-value results are returned as literal structs (see MultiValueReturns)
+	template<bool isStrict = false>
+	static size_t hashTypeKind(const llvm::Type* type)
+	{
+		const llvm::StructType* st = llvm::dyn_cast<llvm::StructType>(type);
+		if (!st)
+			return std::hash<size_t>()(typeKindOf<isStrict>(type));
+		size_t hash = st->getNumElements();
+		for (const llvm::Type* e: st->elements())
+			hash = hash*31 + std::hash<size_t>()(typeKindOf<isStrict>(e));
+		return hash;
+	}
+	template<bool isStrict = false>
+	static bool isSameTypeKind(const llvm::Type* lhs, const llvm::Type* rhs)
+	{
+		const llvm::StructType* lst = llvm::dyn_cast<llvm::StructType>(lhs);
+		const llvm::StructType* rst = llvm::dyn_cast<llvm::StructType>(rhs);
+		if (!lst || !rst)
+			return !lst && !rst && typeKindOf<isStrict>(lhs) == typeKindOf<isStrict>(rhs);
+		if (lst->getNumElements() != rst->getNumElements())
+			return false;
+		for (uint32_t i = 0; i < lst->getNumElements(); i++)
+		{
+			if (typeKindOf<isStrict>(lst->getElementType(i)) != typeKindOf<isStrict>(rst->getElementType(i)))
+				return false;
+		}
+		return true;
+	}
 
+	// Read-only globals placed inside the storage of another one, with their offset
+	typedef llvm::DenseMap<const llvm::GlobalVariable*, std::pair<const llvm::GlobalVariable*, uint32_t>> SharedGlobalsMap;
+	static bool isRelocationFree(const llvm::Constant* c);
+	uint32_t getGlobalAlignment(const llvm::GlobalVariable* G) const;
+	void shareReadOnlyGlobals(SharedGlobalsMap& sharedGlobals) const;
 	void addGlobals();
 	void addFunctions();
 	void addStack();
@@ -0,0 +1,70 @@
+//===-- Cheerp/MultiValueReturns.h - Cheerp optimization pass ---------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_MULTI_VALUE_RETURNS_H
+#define _CHEERP_MULTI_VALUE_RETURNS_H
+
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Pass.h"
+
+namespace llvm
+{
+
+/**
+ * Return small aggregates as multiple wasm results instead of using an sret
+ * pointer. Wasm functions only called directly from other wasm functions, and
+ * whose sret slot is only accessed field by field, are rewritten to return a
+ * literal struct of the scalar fields. Both the fields in the callee and the
+ * result slots in the callers are promoted to registers when possible, so no
+ * linear memory is involved.
+ * The writer expects the results to be extracted by extractvalue instructions
+ * directly following the call, in index order.
+ */
+class MultiValueReturns: public ModulePass
+{
+private:
+	// A scalar field of the aggregate, with the GEP indices to reach it
+	struct Leaf
+	{
+		Type* type;
+		SmallVector<Value*, 4> path;
+	};
+	typedef SmallVector<Leaf, 4> LeafVector;
+	typedef SmallVector<std::pair<Instruction*, uint32_t>, 8> AccessVector;
+	static bool isScalarType(Type* t);
+	static uint32_t countLeaves(Type* t);
+	static bool flattenType(Type* t, SmallVectorImpl<Value*>& path, LeafVector& leaves);
+	static bool collectLeafAccesses(Value* ptr, Type* t, uint32_t firstLeaf, AccessVector& accesses, SmallVectorImpl<Instruction*>& toErase);
+	static bool promoteLeaves(Function& F, Value* base, const LeafVector& leaves, SmallVectorImpl<AllocaInst*>& allocas);
+	bool isCandidate(const Function& F, const SmallPtrSetImpl<const Function*>& exported, LeafVector& leaves) const;
+	void rewriteFunction(Function* F, const LeafVector& leaves, SetVector<AllocaInst*>& callerSlots);
+public:
+	static char ID;
+	// At most this many scalars are returned as separate values
+	static const uint32_t MaxResults = 4;
+	explicit MultiValueReturns() : ModulePass(ID) { }
+	bool runOnModule(Module &M) override;
+	StringRef getPassName() const override;
+
+	virtual void getAnalysisUsage(AnalysisUsage&) const override;
+};
+
+//===----------------------------------------------------------------------===//
+//
+// MultiValueReturns
+//
+ModulePass *createMultiValueReturnsPass();
+
+}
+
+#endif
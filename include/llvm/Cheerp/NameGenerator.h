@@ -67,8 +67,11 @@ public:
 		ASSIGN_HEAPS,
 		DUMMY,
 		MEMORY,
+		INIT_MEMORY,
+		STACK_TOP,
 		HANDLE_VAARG,
 		FETCHBUFFER,
+		FETCHWASM,
 		HEAP8,
 		HEAP16,
 		HEAP32,
@@ -22,6 +22,8 @@
 #include "llvm/Cheerp/DeterministicUnorderedSet.h"
 #include "llvm/Cheerp/DeterministicUnorderedMap.h"
 #include "llvm/Cheerp/TypeAndIndex.h"
+#include <mutex>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 
@@ -266,6 +268,10 @@ public:
 	{
 		PACache = other.PACache;
 		status = other.status;
+		frozen = other.frozen;
+		frozenValues = other.frozenValues;
+		frozenConstraints = other.frozenConstraints;
+		frozenMembers = other.frozenMembers;
 	}
 
 	void prefetchFunc( const llvm::Function & ) const;
@@ -300,6 +306,12 @@ public:
 	void fullResolve();
 	// Compute all the offsets for REGULAR pointer which may be assumed constant
 	void computeConstantOffsets(const llvm::Module& M );
+	// Copy the final results in compact tables, which are queried without
+	// taking the lock. Must be called after computeConstantOffsets.
+	void freeze();
+	// Allow queries from multiple threads. The constant offsets are resolved in advance, the kinds are
+	// still computed lazily, so the caches are protected by a lock.
+	void setConcurrentAccess(bool enabled);
 
 #ifndef NDEBUG
 	// Dump a pointer value info
@@ -375,6 +387,51 @@ public:
 	static POINTER_KIND getPointerKindForMemberImpl(const TypeAndIndex& baseAndIndex, PointerAnalyzerCache& cache);
 private:
 	const PointerConstantOffsetWrapper& getFinalPointerConstantOffsetWrapper(const llvm::Value*) const;
+	// Replace the cached offsets which depend on constraints with their final value
+	void resolveConstantOffsets();
+	static const llvm::ConstantInt* resolveConstantOffset(const PointerConstantOffsetWrapper& o, PointerAnalyzerCache& cache, llvm::LLVMContext& C);
+
+	// The results for a value, after freeze()
+	struct FrozenPointer
+	{
+		const llvm::ConstantInt* offset;
+		POINTER_KIND kind;
+		bool hasKind;
+	};
+	// The results for a constraint, after freeze(). Sorted by key.
+	struct FrozenConstraint
+	{
+		const void* ptr;
+		uint32_t i;
+		uint8_t constraintKind;
+		POINTER_KIND kind;
+		const llvm::ConstantInt* offset;
+		bool hasKind;
+		bool operator<(const FrozenConstraint& rhs) const
+		{
+			return std::tie(constraintKind, ptr, i) < std::tie(rhs.constraintKind, rhs.ptr, rhs.i);
+		}
+	};
+	const FrozenConstraint* findFrozenConstraint(const IndirectPointerKindConstraint& c) const;
+	bool frozen{false};
+	llvm::DenseMap<const llvm::Value*, FrozenPointer> frozenValues;
+	std::vector<FrozenConstraint> frozenConstraints;
+	std::vector<std::pair<TypeAndIndex, POINTER_KIND>> frozenMembers;
+
+	// Takes the cache lock only when concurrent access has been enabled
+	class CacheGuard
+	{
+	public:
+		CacheGuard(const PointerAnalyzer& PA):lock(PA.cacheMutex, std::defer_lock)
+		{
+			if(PA.concurrentAccess)
+				lock.lock();
+		}
+	private:
+		std::unique_lock<std::recursive_mutex> lock;
+	};
+	bool concurrentAccess{false};
+	mutable std::recursive_mutex cacheMutex;
 };
 
 #ifndef NDEBUG
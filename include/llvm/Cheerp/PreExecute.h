@@ -81,12 +81,12 @@ public:
     DeterministicUnorderedMap<llvm::GlobalVariable *, llvm::Constant *, RestrictionsLifted::NoErasure>  modifiedGlobals;
     std::map<char *, AllocData> typedAllocations;
 
-    explicit PreExecute() : llvm::ModulePass(ID) {
+    explicit PreExecute() : llvm::ModulePass(ID), currentEE(nullptr), currentModule(nullptr) {
     }
 
     llvm::StringRef getPassName() const override;
     bool runOnModule(llvm::Module& m) override;
-    bool runOnConstructor(const llvm::Target* target, const std::string& triple, llvm::Module& m, llvm::Function* c);
+    bool runOnConstructor(llvm::Module& m, llvm::Function* c);
 
     void recordStore(void* Addr);
     void recordTypedAllocation(llvm::Type *type, size_t size, char *buf, bool hasCookie, bool asmjs) {
@@ -103,6 +103,9 @@ public:
         typedAllocations.erase(it);
     }
 private:
+    void createEngine(const llvm::Target* target, const std::string& triple, llvm::Module& m);
+    void destroyEngine(llvm::Module& m);
+
     llvm::Constant* findPointerFromGlobal(const llvm::DataLayout* DL,
             llvm::Type* memType, llvm::GlobalValue* GV, char* GlobalStartAddr,
             char* StoredAddr, llvm::Type* Int32Ty);
@@ -1222,7 +1222,7 @@ public:
 
 	static char ID;
 	
-	explicit Registerize(bool froundAvailable = false, bool wasm = false) : ModulePass(ID), froundAvailable(froundAvailable), wasm(wasm)
+	explicit Registerize(bool froundAvailable = false, bool wasm = false) : ModulePass(ID), froundAvailable(froundAvailable), wasm(wasm), isConcurrentWorker(false)
 #ifndef NDEBUG
 			, RegistersAssigned(false)
 #endif
@@ -1238,7 +1238,9 @@ public:
 	uint32_t getRegisterId(const llvm::Instruction* I, const EdgeContext& edgeContext) const;
 	uint32_t getSelfRefTmpReg(const llvm::Instruction* I, const llvm::BasicBlock* fromBB, const llvm::BasicBlock* toBB) const;
 
-	void assignRegisters(llvm::Module& M, cheerp::PointerAnalyzer& PA);
+	// With numThreads != 1 functions are assigned in parallel, 0 uses all the available hardware threads.
+	// The PointerAnalyzer must be fully resolved and allow concurrent access in that case.
+	void assignRegisters(llvm::Module& M, cheerp::PointerAnalyzer& PA, unsigned numThreads = 1);
 	void computeLiveRangeForAllocas(const llvm::Function& F);
 	void invalidateLiveRangeForAllocas(const llvm::Function& F);
 
@@ -1249,7 +1251,7 @@ public:
 	}
 
 	// Registers should have a consistent JS type
-	enum REGISTER_KIND { OBJECT=0, INTEGER, INTEGER64, DOUBLE, FLOAT };
+	enum REGISTER_KIND { OBJECT=0, INTEGER, INTEGER64, DOUBLE, FLOAT, VECTOR };
 
 	struct RegisterInfo
 	{
@@ -1399,6 +1401,10 @@ private:
 		{
 			return edgeRegistersMap.count(buildInstOnEdge(edgeContext, originalId));
 		}
+		void merge(const EdgeRegistersMap& other)
+		{
+			edgeRegistersMap.insert(other.edgeRegistersMap.begin(), other.edgeRegistersMap.end());
+		}
 		void dump() const
 		{
 			for (auto& X : edgeRegistersMap)
@@ -1426,9 +1432,20 @@ private:
 	cheerp::DeterministicUnorderedMap<InstOnEdge, uint32_t, RestrictionsLifted::NoErasure | RestrictionsLifted::NoDeterminism, InstOnEdge::Hash> selfRefRegistersMap;
 	const bool froundAvailable;
 	const bool wasm;
+	// True for the private copies used by parallel register assignment
+	bool isConcurrentWorker;
 #ifndef NDEBUG
 	bool RegistersAssigned;
 #endif
+	// The final data structures for a single function, computed by a concurrent worker
+	struct FunctionRegisters
+	{
+		llvm::DenseMap<const llvm::Instruction*, uint32_t> registersMap;
+		EdgeRegistersMap edgeRegistersMap;
+		cheerp::DeterministicUnorderedMap<InstOnEdge, uint32_t, RestrictionsLifted::NoErasure | RestrictionsLifted::NoDeterminism, InstOnEdge::Hash> selfRefRegistersMap;
+		std::vector<RegisterInfo> registers;
+	};
+	void assignRegistersConcurrently(llvm::Module& M, cheerp::PointerAnalyzer& PA, unsigned numThreads);
 	// Temporary data structure used to compute the live range of an instruction
 	struct InstructionLiveRange
 	{
@@ -17,14 +17,34 @@
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include <map>
+#include <memory>
+#include <vector>
 
 namespace cheerp
 {
 
 class SourceMapGenerator
 {
+public:
+	// Mapping events recorded while rendering code into a separate buffer.
+	// The offsets are relative to the start of the buffer for the first line.
+	struct RecordedMapping
+	{
+		enum KIND { FUNCTION_NAME = 0, DEBUG_LOC, END_OF_LINE };
+		KIND kind;
+		uint32_t lineOffset;
+		const llvm::DISubprogram* method;
+		const llvm::DebugLoc* debugLoc;
+	};
+	struct Recording
+	{
+		std::vector<RecordedMapping> mappings;
+		// The line offset at the end of the buffer
+		uint32_t lineOffset{0};
+	};
 private:
-	llvm::ToolOutputFile sourceMap;
+	// NULL for recorders, which do not write a file
+	std::unique_ptr<llvm::ToolOutputFile> sourceMap;
 	const std::string& sourceMapName;
 	const std::string& sourceMapPrefix;
 	std::map<llvm::StringRef, uint32_t> fileMap;
@@ -38,10 +58,28 @@ private:
 	const llvm::DebugLoc* currentDebugLoc;
 	bool standAlone;
 	bool lineBegin;
+	Recording recording;
 	void writeBase64VLQInt(int32_t i);
+	void recordMapping(RecordedMapping::KIND kind, const llvm::DISubprogram* method, const llvm::DebugLoc* debugLoc)
+	{
+		recording.mappings.push_back({kind, lineOffset, method, debugLoc});
+	}
+	SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, bool standAlone);
 public:
 	// sourceMapName and sourceMapPrefix life spans should be longer than the one of the SourceMapGenerator
 	SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, bool standAlone, std::error_code& ErrorCode);
+	// Create a generator that does not write anything, but records the
+	// mappings so that they can be replayed on this generator later on
+	std::unique_ptr<SourceMapGenerator> createRecorder() const;
+	bool isRecorder() const
+	{
+		return !sourceMap;
+	}
+	// Return the mappings recorded so far and start a new recording
+	Recording takeRecording();
+	// Add the mappings of a buffer which has just been appended to the output,
+	// the offsets of its first line are rebased on the current line offset
+	void replay(const Recording& r);
 	void setFunctionName(const llvm::DISubprogram *method);
 	void setDebugLoc(const llvm::DebugLoc* debugLoc);
 	const llvm::DebugLoc* getDebugLoc() const
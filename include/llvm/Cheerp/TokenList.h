@@ -16,6 +16,7 @@
 #include "llvm/ADT/ilist_node.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/Support/Allocator.h"
 
 #define DEBUG_TOKENLIST 1
 //#define TOKEN_OPT_DUMP
@@ -29,6 +30,17 @@
 	#include "llvm/Support/raw_ostream.h"
 #endif
 
+namespace cheerp {
+class Token;
+}
+
+// Tokens are allocated in the arena of their TokenList, and never deleted
+// one by one
+namespace llvm {
+template<>
+struct ilist_alloc_traits<cheerp::Token>: ilist_noalloc_traits<cheerp::Token> {};
+}
+
 namespace cheerp {
 
 class TokenList;
@@ -61,6 +73,7 @@ public:
 		I64 = 0x7E,
 		F32 = 0x7D,
 		F64 = 0x7C,
+		V128 = 0x7B,
 	};
 private:
 	TokenKind Kind;
@@ -129,87 +142,6 @@ public:
 	llvm::iplist<Token>::const_reverse_iterator getRevIter() const {
 		return (--getIterator()).getReverse();
 	}
-	static Token* createBasicBlock(const llvm::BasicBlock* BB) {
-		return new Token(TK_BasicBlock, BB, nullptr);
-	}
-	static Token* createLoop() {
-		return new Token(TK_Loop, nullptr, nullptr);
-	}
-	static Token* createLoopEnd(Token* Begin) {
-		assert(Begin && Begin->Kind == TK_Loop);
-		Token* End = new Token(TK_End, nullptr, Begin);
-		Begin->Match = End;
-		return End;
-	}
-	static Token* createBlock() {
-		return new Token(TK_Block, nullptr, nullptr);
-	}
-	static Token* createBlockEnd(Token* Begin) {
-		assert(Begin && Begin->Kind == TK_Block);
-		Token* End = new Token(TK_End, nullptr, Begin);
-		Begin->Match = End;
-		return End;
-	}
-	static Token* createIf(const llvm::BasicBlock* CondBlock) {
-		return new Token(TK_If, CondBlock, nullptr);
-	}
-	static Token* createIfNot(const llvm::BasicBlock* CondBlock) {
-		return new Token(TK_IfNot, CondBlock, nullptr);
-	}
-	static Token* createElse(Token* If) {
-		assert(!If || If->Kind == TK_If);
-		Token* Else = new Token(TK_Else, nullptr, nullptr);
-		if (If)
-			If->Match = Else;
-		return Else;
-	}
-	static Token* createSwitch(const llvm::BasicBlock* CondBlock) {
-		return new Token(TK_Switch, CondBlock, nullptr);
-	}
-	static Token* createSwitchEnd(Token* Switch, Token* LastCase) {
-		assert(Switch && Switch->Kind == TK_Switch);
-		assert(LastCase && LastCase->Kind == TK_Case);
-		Token* End = new Token(TK_End, nullptr, Switch);
-		LastCase->Match = End;
-		return End;
-	}
-	static Token* createCase(const llvm::BasicBlock* CondBlock, int Id, Token* Prev) {
-		assert(Prev);
-		assert(Prev->getKind() == TK_Switch || Prev->getKind() == TK_Case);
-		Token* Ret =  new Token(TK_Case, CondBlock, nullptr);
-		Prev->Match = Ret;
-		Ret->Id = Id;
-		return Ret;
-	}
-	static Token* createIfEnd(Token* If, Token* Else) {
-		assert(!If || If->Kind == TK_If);
-		assert(!Else || Else->Kind == TK_Else);
-		assert(If || Else);
-		Token* End = new Token(TK_End, nullptr, If);
-		if (Else)
-			Else->Match = End;
-		else
-			If->Match = End;
-		return End;
-	}
-	static Token* createBranch(Token* Dest) {
-		return new Token(TK_Branch, nullptr, Dest);
-	}
-	static Token* createPrologue(const llvm::BasicBlock* From, int ToId) {
-		assert(From);
-		Token* Ret =  new Token(TK_Prologue, From, nullptr);
-		Ret->Id = ToId;
-		return Ret;
-	}
-	static Token* createBrIf(const llvm::BasicBlock* CondBlock, Token* Dest) {
-		return new Token(TK_BrIf, CondBlock, Dest);
-	}
-	static Token* createBrIfNot(const llvm::BasicBlock* CondBlock, Token* Dest) {
-		return new Token(TK_BrIfNot, CondBlock, Dest);
-	}
-	static Token* createCondition(const llvm::BasicBlock* CondBlock) {
-		return new Token(TK_Condition, CondBlock, nullptr);
-	}
 #ifdef DEBUG_TOKENLIST
 	void dump() const
 	{
@@ -272,8 +204,103 @@ private:
 
 class TokenList {
 	typedef llvm::iplist<Token> TokenListType;
+	// All the tokens of a function are allocated here, so that the ones
+	// created together are contiguous. Erased tokens are reclaimed only when
+	// the whole list is destroyed. It must outlive the list, which unlinks
+	// the remaining tokens when it is destroyed
+	llvm::BumpPtrAllocator Allocator;
 	llvm::iplist<Token> List;
+	Token* allocate(Token::TokenKind K, const llvm::BasicBlock* BB, Token* Match) {
+		return new (Allocator.Allocate<Token>()) Token(K, BB, Match);
+	}
 public:
+	TokenList() = default;
+	TokenList(const TokenList&) = delete;
+	TokenList& operator=(const TokenList&) = delete;
+
+	/// Create tokens owned by this list, they still need to be inserted
+	Token* createBasicBlock(const llvm::BasicBlock* BB) {
+		return allocate(Token::TK_BasicBlock, BB, nullptr);
+	}
+	Token* createLoop() {
+		return allocate(Token::TK_Loop, nullptr, nullptr);
+	}
+	Token* createLoopEnd(Token* Begin) {
+		assert(Begin && Begin->Kind == Token::TK_Loop);
+		Token* End = allocate(Token::TK_End, nullptr, Begin);
+		Begin->Match = End;
+		return End;
+	}
+	Token* createBlock() {
+		return allocate(Token::TK_Block, nullptr, nullptr);
+	}
+	Token* createBlockEnd(Token* Begin) {
+		assert(Begin && Begin->Kind == Token::TK_Block);
+		Token* End = allocate(Token::TK_End, nullptr, Begin);
+		Begin->Match = End;
+		return End;
+	}
+	Token* createIf(const llvm::BasicBlock* CondBlock) {
+		return allocate(Token::TK_If, CondBlock, nullptr);
+	}
+	Token* createIfNot(const llvm::BasicBlock* CondBlock) {
+		return allocate(Token::TK_IfNot, CondBlock, nullptr);
+	}
+	Token* createElse(Token* If) {
+		assert(!If || If->Kind == Token::TK_If);
+		Token* Else = allocate(Token::TK_Else, nullptr, nullptr);
+		if (If)
+			If->Match = Else;
+		return Else;
+	}
+	Token* createSwitch(const llvm::BasicBlock* CondBlock) {
+		return allocate(Token::TK_Switch, CondBlock, nullptr);
+	}
+	Token* createSwitchEnd(Token* Switch, Token* LastCase) {
+		assert(Switch && Switch->Kind == Token::TK_Switch);
+		assert(LastCase && LastCase->Kind == Token::TK_Case);
+		Token* End = allocate(Token::TK_End, nullptr, Switch);
+		LastCase->Match = End;
+		return End;
+	}
+	Token* createCase(const llvm::BasicBlock* CondBlock, int Id, Token* Prev) {
+		assert(Prev);
+		assert(Prev->getKind() == Token::TK_Switch || Prev->getKind() == Token::TK_Case);
+		Token* Ret =  allocate(Token::TK_Case, CondBlock, nullptr);
+		Prev->Match = Ret;
+		Ret->Id = Id;
+		return Ret;
+	}
+	Token* createIfEnd(Token* If, Token* Else) {
+		assert(!If || If->Kind == Token::TK_If);
+		assert(!Else || Else->Kind == Token::TK_Else);
+		assert(If || Else);
+		Token* End = allocate(Token::TK_End, nullptr, If);
+		if (Else)
+			Else->Match = End;
+		else
+			If->Match = End;
+		return End;
+	}
+	Token* createBranch(Token* Dest) {
+		return allocate(Token::TK_Branch, nullptr, Dest);
+	}
+	Token* createPrologue(const llvm::BasicBlock* From, int ToId) {
+		assert(From);
+		Token* Ret =  allocate(Token::TK_Prologue, From, nullptr);
+		Ret->Id = ToId;
+		return Ret;
+	}
+	Token* createBrIf(const llvm::BasicBlock* CondBlock, Token* Dest) {
+		return allocate(Token::TK_BrIf, CondBlock, Dest);
+	}
+	Token* createBrIfNot(const llvm::BasicBlock* CondBlock, Token* Dest) {
+		return allocate(Token::TK_BrIfNot, CondBlock, Dest);
+	}
+	Token* createCondition(const llvm::BasicBlock* CondBlock) {
+		return allocate(Token::TK_Condition, CondBlock, nullptr);
+	}
+
 	/// Token iterators...
 	typedef TokenListType::iterator iterator;
 	typedef TokenListType::const_iterator const_iterator;
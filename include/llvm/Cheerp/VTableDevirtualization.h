@@ -0,0 +1,63 @@
+//===-- Cheerp/VTableDevirtualization.h - Cheerp optimization pass ---------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_VTABLE_DEVIRTUALIZATION_H
+#define _CHEERP_VTABLE_DEVIRTUALIZATION_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/Pass.h"
+
+namespace llvm
+{
+
+/**
+ * Whole program devirtualization of virtual calls, run during the Cheerp LTO
+ * phase. Cheerp vtables are typed constant structures, and a virtual call
+ * loads the function from a vtable slot with a constant GEP from the vtable
+ * pointer. The vtable type and the slot identify the possible targets: the
+ * functions stored in that slot in every vtable (_ZTV) and construction
+ * vtable (_ZTC) object of that type. If there is only one, the call becomes
+ * direct and can be inlined.
+ * Vtable types which are also used by other globals, by allocas, by heap
+ * allocations or by vtables which are not constant or not defined are left
+ * alone, as are the types a vtable object is cast to.
+ */
+class VTableDevirtualization: public ModulePass
+{
+private:
+	// Every constant object with a vtable type, by type
+	DenseMap<Type*, SmallVector<Constant*, 4>> vtableObjects;
+	// Types whose objects may live outside of the known vtables
+	SmallPtrSet<Type*, 8> unknownTypes;
+	void collectCastOfVTable(Type* srcTy, Type* dstTy);
+	void collectVTables(Module& M);
+	Function* findSingleTarget(CallBase& CB) const;
+	bool devirtualize(CallBase& CB, Function* target);
+public:
+	static char ID;
+	explicit VTableDevirtualization() : ModulePass(ID) { }
+	bool runOnModule(Module &M) override;
+	StringRef getPassName() const override;
+
+	virtual void getAnalysisUsage(AnalysisUsage&) const override;
+};
+
+//===----------------------------------------------------------------------===//
+//
+// VTableDevirtualization
+//
+ModulePass *createVTableDevirtualizationPass();
+
+}
+
+#endif
@@ -134,6 +134,15 @@ enum class WasmOpcode {
 	F64_CONVERT_S_I64 = 0xb9,
 	F64_CONVERT_U_I64 = 0xba,
 	F64_PROMOTE_F32 = 0xbb,
+	I32_REINTERPRET_F32 = 0xbc,
+	I64_REINTERPRET_F64 = 0xbd,
+	F32_REINTERPRET_I32 = 0xbe,
+	F64_REINTERPRET_I64 = 0xbf,
+	I32_EXTEND8_S = 0xc0,
+	I32_EXTEND16_S = 0xc1,
+	I64_EXTEND8_S = 0xc2,
+	I64_EXTEND16_S = 0xc3,
+	I64_EXTEND32_S = 0xc4,
 };
 
 enum class WasmS32Opcode {
@@ -179,4 +188,202 @@ enum class WasmU32U32Opcode {
 	I32_STORE16 = 0x3b,
 };
 
+// Opcodes behind the 0xfc prefix, the opcode itself is encoded as U32
+enum class WasmFCOpcode {
+	I32_TRUNC_SAT_F32_S = 0x00,
+	I32_TRUNC_SAT_F32_U = 0x01,
+	I32_TRUNC_SAT_F64_S = 0x02,
+	I32_TRUNC_SAT_F64_U = 0x03,
+	I64_TRUNC_SAT_F32_S = 0x04,
+	I64_TRUNC_SAT_F32_U = 0x05,
+	I64_TRUNC_SAT_F64_S = 0x06,
+	I64_TRUNC_SAT_F64_U = 0x07,
+};
+
+enum class WasmFCU32Opcode {
+	DATA_DROP = 0x09,
+	MEMORY_FILL = 0x0b,
+};
+
+enum class WasmFCU32U32Opcode {
+	MEMORY_INIT = 0x08,
+	MEMORY_COPY = 0x0a,
+};
+
+// Opcodes behind the 0xfd prefix, the opcode itself is encoded as U32
+enum class WasmSIMDOpcode {
+	I8X16_SPLAT = 0x0f,
+	I16X8_SPLAT = 0x10,
+	I32X4_SPLAT = 0x11,
+	I64X2_SPLAT = 0x12,
+	F32X4_SPLAT = 0x13,
+	F64X2_SPLAT = 0x14,
+	I8X16_EQ = 0x23,
+	I8X16_NE = 0x24,
+	I8X16_LT_S = 0x25,
+	I8X16_LT_U = 0x26,
+	I8X16_GT_S = 0x27,
+	I8X16_GT_U = 0x28,
+	I8X16_LE_S = 0x29,
+	I8X16_LE_U = 0x2a,
+	I8X16_GE_S = 0x2b,
+	I8X16_GE_U = 0x2c,
+	I16X8_EQ = 0x2d,
+	I16X8_NE = 0x2e,
+	I16X8_LT_S = 0x2f,
+	I16X8_LT_U = 0x30,
+	I16X8_GT_S = 0x31,
+	I16X8_GT_U = 0x32,
+	I16X8_LE_S = 0x33,
+	I16X8_LE_U = 0x34,
+	I16X8_GE_S = 0x35,
+	I16X8_GE_U = 0x36,
+	I32X4_EQ = 0x37,
+	I32X4_NE = 0x38,
+	I32X4_LT_S = 0x39,
+	I32X4_LT_U = 0x3a,
+	I32X4_GT_S = 0x3b,
+	I32X4_GT_U = 0x3c,
+	I32X4_LE_S = 0x3d,
+	I32X4_LE_U = 0x3e,
+	I32X4_GE_S = 0x3f,
+	I32X4_GE_U = 0x40,
+	F32X4_EQ = 0x41,
+	F32X4_NE = 0x42,
+	F32X4_LT = 0x43,
+	F32X4_GT = 0x44,
+	F32X4_LE = 0x45,
+	F32X4_GE = 0x46,
+	F64X2_EQ = 0x47,
+	F64X2_NE = 0x48,
+	F64X2_LT = 0x49,
+	F64X2_GT = 0x4a,
+	F64X2_LE = 0x4b,
+	F64X2_GE = 0x4c,
+	V128_NOT = 0x4d,
+	V128_AND = 0x4e,
+	V128_OR = 0x50,
+	V128_XOR = 0x51,
+	V128_BITSELECT = 0x52,
+	I8X16_SHL = 0x6b,
+	I8X16_SHR_S = 0x6c,
+	I8X16_SHR_U = 0x6d,
+	I8X16_ADD = 0x6e,
+	I8X16_SUB = 0x71,
+	I16X8_SHL = 0x8b,
+	I16X8_SHR_S = 0x8c,
+	I16X8_SHR_U = 0x8d,
+	I16X8_ADD = 0x8e,
+	I16X8_SUB = 0x91,
+	I16X8_MUL = 0x95,
+	I32X4_SHL = 0xab,
+	I32X4_SHR_S = 0xac,
+	I32X4_SHR_U = 0xad,
+	I32X4_ADD = 0xae,
+	I32X4_SUB = 0xb1,
+	I32X4_MUL = 0xb5,
+	I64X2_SHL = 0xcb,
+	I64X2_SHR_S = 0xcc,
+	I64X2_SHR_U = 0xcd,
+	I64X2_ADD = 0xce,
+	I64X2_SUB = 0xd1,
+	I64X2_MUL = 0xd5,
+	I64X2_EQ = 0xd6,
+	I64X2_NE = 0xd7,
+	I64X2_LT_S = 0xd8,
+	I64X2_GT_S = 0xd9,
+	I64X2_LE_S = 0xda,
+	I64X2_GE_S = 0xdb,
+	F32X4_NEG = 0xe1,
+	F32X4_ADD = 0xe4,
+	F32X4_SUB = 0xe5,
+	F32X4_MUL = 0xe6,
+	F32X4_DIV = 0xe7,
+	F64X2_NEG = 0xed,
+	F64X2_ADD = 0xf0,
+	F64X2_SUB = 0xf1,
+	F64X2_MUL = 0xf2,
+	F64X2_DIV = 0xf3,
+	I32X4_TRUNC_SAT_F32X4_S = 0xf8,
+	I32X4_TRUNC_SAT_F32X4_U = 0xf9,
+	F32X4_CONVERT_I32X4_S = 0xfa,
+	F32X4_CONVERT_I32X4_U = 0xfb,
+};
+
+// SIMD opcodes followed by a lane index byte
+enum class WasmSIMDLaneOpcode {
+	I8X16_EXTRACT_LANE_U = 0x16,
+	I8X16_REPLACE_LANE = 0x17,
+	I16X8_EXTRACT_LANE_U = 0x19,
+	I16X8_REPLACE_LANE = 0x1a,
+	I32X4_EXTRACT_LANE = 0x1b,
+	I32X4_REPLACE_LANE = 0x1c,
+	I64X2_EXTRACT_LANE = 0x1d,
+	I64X2_REPLACE_LANE = 0x1e,
+	F32X4_EXTRACT_LANE = 0x1f,
+	F32X4_REPLACE_LANE = 0x20,
+	F64X2_EXTRACT_LANE = 0x21,
+	F64X2_REPLACE_LANE = 0x22,
+};
+
+// SIMD opcodes followed by a 16 bytes immediate
+enum class WasmSIMDBytesOpcode {
+	V128_CONST = 0x0c,
+	I8X16_SHUFFLE = 0x0d,
+};
+
+// SIMD opcodes followed by a memarg
+enum class WasmSIMDU32U32Opcode {
+	V128_LOAD = 0x00,
+	V128_STORE = 0x0b,
+};
+
+// Opcodes behind the 0xfe prefix, the opcode itself is encoded as U32
+enum class WasmThreadsOpcode {
+	ATOMIC_FENCE = 0x03,
+};
+
+// Atomic opcodes followed by a memarg, the alignment must be the natural one
+enum class WasmThreadsU32U32Opcode {
+	MEMORY_ATOMIC_NOTIFY = 0x00,
+	MEMORY_ATOMIC_WAIT32 = 0x01,
+	MEMORY_ATOMIC_WAIT64 = 0x02,
+	I32_ATOMIC_LOAD = 0x10,
+	I64_ATOMIC_LOAD = 0x11,
+	I32_ATOMIC_LOAD8_U = 0x12,
+	I32_ATOMIC_LOAD16_U = 0x13,
+	I32_ATOMIC_STORE = 0x17,
+	I64_ATOMIC_STORE = 0x18,
+	I32_ATOMIC_STORE8 = 0x19,
+	I32_ATOMIC_STORE16 = 0x1a,
+	I32_ATOMIC_RMW_ADD = 0x1e,
+	I64_ATOMIC_RMW_ADD = 0x1f,
+	I32_ATOMIC_RMW8_ADD_U = 0x20,
+	I32_ATOMIC_RMW16_ADD_U = 0x21,
+	I32_ATOMIC_RMW_SUB = 0x25,
+	I64_ATOMIC_RMW_SUB = 0x26,
+	I32_ATOMIC_RMW8_SUB_U = 0x27,
+	I32_ATOMIC_RMW16_SUB_U = 0x28,
+	I32_ATOMIC_RMW_AND = 0x2c,
+	I64_ATOMIC_RMW_AND = 0x2d,
+	I32_ATOMIC_RMW8_AND_U = 0x2e,
+	I32_ATOMIC_RMW16_AND_U = 0x2f,
+	I32_ATOMIC_RMW_OR = 0x33,
+	I64_ATOMIC_RMW_OR = 0x34,
+	I32_ATOMIC_RMW8_OR_U = 0x35,
+	I32_ATOMIC_RMW16_OR_U = 0x36,
+	I32_ATOMIC_RMW_XOR = 0x3a,
+	I64_ATOMIC_RMW_XOR = 0x3b,
+	I32_ATOMIC_RMW8_XOR_U = 0x3c,
+	I32_ATOMIC_RMW16_XOR_U = 0x3d,
+	I32_ATOMIC_RMW_XCHG = 0x41,
+	I64_ATOMIC_RMW_XCHG = 0x42,
+	I32_ATOMIC_RMW8_XCHG_U = 0x43,
+	I32_ATOMIC_RMW16_XCHG_U = 0x44,
+	I32_ATOMIC_RMW_CMPXCHG = 0x48,
+	I64_ATOMIC_RMW_CMPXCHG = 0x49,
+	I32_ATOMIC_RMW8_CMPXCHG_U = 0x4a,
+	I32_ATOMIC_RMW16_CMPXCHG_U = 0x4b,
+};
+
 #endif // _CHEERP_WASM_OPCODES_H
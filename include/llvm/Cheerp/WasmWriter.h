@@ -14,6 +14,7 @@
 
 #include <sstream>
 
+#include "llvm/Cheerp/CommandLine.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/LinearMemoryHelper.h"
 #include "llvm/Cheerp/NameGenerator.h"
@@ -293,6 +294,19 @@ private:
 	// Whether to export the function table from the module
 	bool exportedTable;
 
+	// Address and size of the passive data segments, initialized by the
+	// synthetic initMemory function when using bulk memory and shared memory
+	std::vector<std::pair<uint32_t, uint32_t>> passiveSegments;
+
+	// Number of threads used to compile the method bodies, 0 means all the
+	// available hardware threads and 1 disables parallel compilation
+	unsigned codegenThreads;
+
+	// True for the per-thread copies of the writer used by parallel
+	// compilation. They own the per-method state, and since the pass manager
+	// is not thread safe they compute function analyses on their own.
+	bool isConcurrentWorker;
+
 	mutable std::vector<uint32_t> nopLocations;
 
 	void filterNop(llvm::SmallVectorImpl<char>& buffer) const;
@@ -358,8 +372,36 @@ private:
 	void compileStartSection();
 	void compileElementSection();
 	void compileCodeSection();
-	void compileDataSection();
+	// Compile all the method bodies on a thread pool. The bodies are stored
+	// in module order, so the output is identical to the serial path.
+	void compileMethodsConcurrently(std::vector<std::string>& methods, uint32_t count);
+	uint32_t encodeDataSegments(WasmBuffer& data);
+	void compileDataCountSection(uint32_t count);
+	void compileDataSection(llvm::StringRef segments, uint32_t count);
 	void compileNameSection();
+	// With bulk memory and shared memory the data segments are passive, and
+	// they are copied in memory by a synthetic function placed after all the
+	// others. It is the start function, or it is exported as initMemory when
+	// the wasm loader is used.
+	bool usePassiveSegments() const
+	{
+		return WasmBulkMemory && sharedMemory;
+	}
+	// The id after the imports and the methods actually emitted
+	uint32_t getInitMemoryFunctionId() const;
+	// The type of the memory initialization is void(), it is added at the end
+	// of the type section when no other function uses it
+	bool needsInitMemoryType() const;
+	uint32_t getInitMemoryTypeIndex() const;
+	// When the loader initializes the memory it can also be shared with
+	// workers: the memory is created by the loader and imported, while the
+	// stack top and the table are exported to start the workers.
+	bool useWorkers() const
+	{
+		return usePassiveSegments() && useWasmLoader;
+	}
+	void encodeMemoryLimits(WasmBuffer& code) const;
+	void compileInitMemoryMethod(WasmBuffer& code);
 
 	static const char* getTypeString(const llvm::Type* t);
 	void compileMethodLocals(WasmBuffer& code, const std::vector<int>& locals);
@@ -376,6 +418,10 @@ private:
 	// Returns true if it has handled local assignent internally
 	bool compileInstruction(WasmBuffer& code, const llvm::Instruction& I);
 	bool compileInlineInstruction(WasmBuffer& code, const llvm::Instruction& I);
+	// Instructions producing or consuming 128-bit vectors, encoded with SIMD opcodes
+	void compileVectorInstruction(WasmBuffer& code, const llvm::Instruction& I);
+	void compileVectorConstant(WasmBuffer& code, const llvm::Constant* c);
+	void compileSplatScalar(WasmBuffer& code, const llvm::Value* v);
 	void compileGEP(WasmBuffer& code, const llvm::User* gepInst, bool standalone = false);
 	void compileLoad(WasmBuffer& code, const llvm::LoadInst& I, bool signExtend);
 	void compileGetLocal(WasmBuffer& code, const llvm::Instruction* v);
@@ -412,6 +458,7 @@ private:
 		{
 		}
 		void addByte(uint8_t b) override;
+		void addBytes(llvm::ArrayRef<uint8_t> bytes) override;
 	};
 
 	struct WasmGepWriter: public LinearMemoryHelper::LinearGepListener
@@ -455,7 +502,8 @@ public:
 			bool prettyCode,
 			bool useCfgLegacy,
 			bool sharedMemory,
-			bool exportedTable):
+			bool exportedTable,
+			unsigned codegenThreads):
 		module(m),
 		pass(p),
 		targetData(&m),
@@ -475,6 +523,8 @@ public:
 		sharedMemory(sharedMemory),
 		noGrowMemory(!linearHelper.canGrowMemory()),
 		exportedTable(exportedTable),
+		codegenThreads(codegenThreads),
+		isConcurrentWorker(false),
 		PA(PA),
 		inlineableCache(PA),
 		stream(s)
@@ -490,21 +540,37 @@ public:
 	void compileSignedInteger(WasmBuffer& code, const llvm::Value* v, bool forComparison);
 	void compileUnsignedInteger(WasmBuffer& code, const llvm::Value* v);
 	void compileTypedZero(WasmBuffer& code, llvm::Type* t);
+	// Push every element of a multi-value result, in order
+	void compileAggregateElements(WasmBuffer& code, const llvm::Value* v);
 	static void encodeInst(WasmOpcode opcode, WasmBuffer& code);
 	static void encodeInst(WasmS32Opcode opcode, int32_t immediate, WasmBuffer& code);
 	static void encodeInst(WasmS64Opcode opcode, int64_t immediate, WasmBuffer& code);
 	static void encodeInst(WasmU32Opcode opcode, uint32_t immediate, WasmBuffer& code);
 	static void encodeInst(WasmU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code);
+	static void encodeInst(WasmFCOpcode opcode, WasmBuffer& code);
+	static void encodeInst(WasmFCU32Opcode opcode, uint32_t immediate, WasmBuffer& code);
+	static void encodeInst(WasmFCU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code);
+	static void encodeInst(WasmSIMDOpcode opcode, WasmBuffer& code);
+	static void encodeInst(WasmSIMDLaneOpcode opcode, uint8_t lane, WasmBuffer& code);
+	static void encodeInst(WasmSIMDBytesOpcode opcode, const uint8_t bytes[16], WasmBuffer& code);
+	static void encodeInst(WasmSIMDU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code);
+	static void encodeInst(WasmThreadsOpcode opcode, WasmBuffer& code);
+	static void encodeInst(WasmThreadsU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code);
+	static void encodeAtomicInst(WasmThreadsU32U32Opcode i32Opcode, const llvm::Type* ty, uint32_t offset, WasmBuffer& code);
 	void encodeBinOp(const llvm::Instruction& I, WasmBuffer& code);
 	void encodePredicate(const llvm::Type* ty, const llvm::CmpInst::Predicate predicate, WasmBuffer& code);
 	void compileICmp(const llvm::ICmpInst& ci, const llvm::CmpInst::Predicate p, WasmBuffer& code);
 	void compileICmp(const llvm::Value* op0, const llvm::Value* op1, const llvm::CmpInst::Predicate p, WasmBuffer& code);
 	void compileFCmp(const llvm::Value* lhs, const llvm::Value* rhs, const llvm::CmpInst::Predicate p, WasmBuffer& code);
 	void encodeLoad(const llvm::Type* ty, uint32_t offset, WasmBuffer& code, bool signExtend);
+	static void encodeSignExtend(uint32_t bitWidth, WasmBuffer& code);
+	static void encodeTruncSat(const llvm::Type* srcTy, const llvm::Type* dstTy, bool isSigned, WasmBuffer& code);
 	void encodeWasmIntrinsic(WasmBuffer& code, const llvm::Function* F);
 	void encodeBranchTable(WasmBuffer& code, std::vector<uint32_t> table, int32_t defaultBlock);
 	void encodeDataSectionChunk(WasmBuffer& data, uint32_t address, llvm::StringRef buf);
 	uint32_t encodeDataSectionChunks(WasmBuffer& data, uint32_t address, llvm::StringRef buf);
+	// Bytes needed to encode one more data segment, including its initialization
+	uint32_t getDataSegmentCost(uint32_t address, uint32_t size) const;
 	void compileFloatToText(WasmBuffer& code, const llvm::APFloat& f, uint32_t precision);
 	GLOBAL_CONSTANT_ENCODING shouldEncodeConstantAsGlobal(const llvm::Constant* C, uint32_t useCount, uint32_t getGlobalCost);
 	bool requiresExplicitAssigment(const llvm::Instruction* phi, const llvm::Value* incoming);
@@ -118,6 +118,22 @@ public:
 			sourceMapGenerator->addLineOffset(end-beginVal);
 	}
 
+	// The indentation state, used to render code on a separate proxy and splice it back
+	struct State
+	{
+		bool newLine;
+		int indentLevel;
+	};
+	State getState() const
+	{
+		return {newLine, indentLevel};
+	}
+	void setState(const State& state)
+	{
+		newLine = state.newLine;
+		indentLevel = state.indentLevel;
+	}
+
 private:
 
 	// Return true if we are closing a curly bracket, need to unindent by 1.
@@ -288,6 +304,12 @@ private:
 	bool areJsExportedExportsDeclared{false};
 	// Flag to signal whether the root object has been deemed necessary
 	bool isRootNeeded{false};
+	// Number of threads used to compile methods, 0 means all the available
+	// hardware threads and 1 disables parallel compilation
+	unsigned codegenThreads;
+	// True for the per-thread copies of the writer used by parallel
+	// compilation, they can't use the pass manager to get function analyses
+	bool isConcurrentWorker{false};
 
 	/**
 	 * \addtogroup MemFunction methods to handle memcpy, memmove, mallocs and free (and alike)
@@ -486,6 +508,12 @@ private:
 	 * a file, usable from the browser and node
 	 */
 	void compileFetchBuffer();
+	/**
+	 * This method compiles an helper function for getting a compiled
+	 * WebAssembly.Module, using streaming compilation and the IndexedDB cache
+	 * when enabled
+	 */
+	void compileFetchWasm();
 	/**
 	 * This method supports both ConstantArray and ConstantDataSequential
 	 */
@@ -567,6 +595,7 @@ private:
 		{
 		}
 		void addByte(uint8_t b) override;
+		void addBytes(llvm::ArrayRef<uint8_t> bytes) override;
 	};
 	struct BinaryBytesWriter: public LinearMemoryHelper::ByteListener
 	{
@@ -575,6 +604,8 @@ private:
 		{
 		}
 		void addByte(uint8_t b) override {stream <<(char)b;};
+		// The stream is never readable nor source mapped, write straight to the raw stream
+		void addBytes(llvm::ArrayRef<uint8_t> bytes) override {stream.getRawStream().write(reinterpret_cast<const char*>(bytes.data()), bytes.size());};
 	};
 
 	struct AsmJSGepWriter: public LinearMemoryHelper::LinearGepListener
@@ -614,7 +645,8 @@ public:
 			bool useCfgLegacy,
 			bool compileGlobalsAddrAsmJS,
 			const std::string& wasmFile,
-			bool forceTypedArrays):
+			bool forceTypedArrays,
+			unsigned codegenThreads):
 		module(m),
 		pass(p),
 		targetData(&m),
@@ -647,6 +679,7 @@ public:
 		forceTypedArrays(forceTypedArrays),
 		symbolicGlobalsAsmJS(compileGlobalsAddrAsmJS),
 		readableOutput(readableOutput),
+		codegenThreads(codegenThreads),
 		blockDepth(0),
 		lastDepth0Block(nullptr),
 		stream(s, sourceMapGenerator, readableOutput)
@@ -655,6 +688,8 @@ public:
 	void makeJS();
 	void compileBB(const llvm::BasicBlock& BB);
 	void compileConstant(const llvm::Constant* c, PARENT_PRIORITY parentPrio = HIGHEST);
+	void compileFloatingPointConstant(const llvm::APFloat& value, llvm::Type* t, PARENT_PRIORITY parentPrio, bool asmjs);
+	void compileIntegerConstant(const llvm::APInt& value, PARENT_PRIORITY parentPrio);
 	void compileOperand(const llvm::Value* v, PARENT_PRIORITY parentPrio = HIGHEST, bool allowBooleanObjects = false);
 	void compilePHIOfBlockFromOtherBlock(const llvm::BasicBlock* to, const llvm::BasicBlock* from);
 	void compileOperandForIntegerPredicate(const llvm::Value* v, llvm::CmpInst::Predicate p, PARENT_PRIORITY parentPrio);
@@ -750,6 +785,12 @@ private:
 	void compileAsmJSTopLevel();
 	void compileGenericJS();
 	void compileWasmLoader();
+	// With shared memory initialized by the loader, the same script can run in
+	// workers sharing the wasm memory
+	bool useWasmWorkers() const;
+	// The loader compiles the module itself (streaming or from the cache), instead of instantiating the downloaded buffer
+	bool useWasmModuleLoader() const;
+	void compileWasmWorkerStart();
 	void compileAsmJSLoader();
 	void compileCommonJSModule();
 	void compileLoaderOrModuleEnd();
@@ -757,9 +798,24 @@ private:
 	void compileDefineExports();
 	void compileCommonJSExports();
 	void compileConstructors();
+	// Define __cheerp_profile_dump, which returns the counters of the
+	// instrumented functions in the text format of llvm-profdata
+	void compileProfileDump();
 	void compileDummies();
 	void compileNamespaces();
 	void compileRootIfNeeded();
+
+	/**
+	 * Compile the given methods in order. When parallel compilation is enabled
+	 * the methods are rendered into separate buffers by worker threads and then
+	 * spliced into the output, rebasing the source map offsets.
+	 */
+	void compileMethods(const std::vector<const llvm::Function*>& functions);
+	/**
+	 * Construct a worker for parallel compilation, it shares the module-wide
+	 * state of parent but renders into its own stream and source map recorder
+	 */
+	CheerpWriter(const CheerpWriter& parent, llvm::raw_ostream& s, SourceMapGenerator* sourceMapRecorder);
 };
 
 }
@@ -439,9 +439,13 @@ void initializeFixIrreducibleControlFlowPass(PassRegistry&);
 void initializeCheerpLowerSwitchPass(PassRegistry&);
 void initializeFixFunctionCastsPass(PassRegistry&);
 void initializeByValLoweringPass(PassRegistry&);
+void initializeAtomicLoweringPass(PassRegistry&);
+void initializeMultiValueReturnsPass(PassRegistry&);
 void initializeI64LoweringPassPass(PassRegistry&);
 void initializeConstantExprLoweringPass(PassRegistry&);
 void initializeStoreMergingPass(PassRegistry&);
+void initializeInstrProfLoweringPass(PassRegistry&);
+void initializeVTableDevirtualizationPass(PassRegistry&);
 
 } // end namespace llvm
 
@@ -0,0 +1,310 @@
+//===-- AtomicLowering.cpp - Cheerp optimization pass --------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpAtomicLowering"
+#include "llvm/Cheerp/AtomicLowering.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/raw_ostream.h"
+
+STATISTIC(NumAtomicsLowered, "Number of atomic instructions lowered to non-atomic form");
+STATISTIC(NumRMWExpanded, "Number of atomicrmw expanded to a cmpxchg loop");
+
+namespace llvm {
+
+bool AtomicLowering::hasWasmOpcode(const AtomicRMWInst* RMWI)
+{
+	if (RMWI->getType()->isFloatingPointTy())
+		return false;
+	switch (RMWI->getOperation())
+	{
+		case AtomicRMWInst::Xchg:
+		case AtomicRMWInst::Add:
+		case AtomicRMWInst::Sub:
+		case AtomicRMWInst::And:
+		case AtomicRMWInst::Or:
+		case AtomicRMWInst::Xor:
+			return true;
+		default:
+			return false;
+	}
+}
+
+Value* AtomicLowering::emitRMWOperation(IRBuilder<>& Builder, AtomicRMWInst::BinOp Op, Value* Loaded, Value* Val)
+{
+	switch (Op)
+	{
+		case AtomicRMWInst::Xchg:
+			return Val;
+		case AtomicRMWInst::Add:
+			return Builder.CreateAdd(Loaded, Val);
+		case AtomicRMWInst::Sub:
+			return Builder.CreateSub(Loaded, Val);
+		case AtomicRMWInst::And:
+			return Builder.CreateAnd(Loaded, Val);
+		case AtomicRMWInst::Nand:
+			return Builder.CreateNot(Builder.CreateAnd(Loaded, Val));
+		case AtomicRMWInst::Or:
+			return Builder.CreateOr(Loaded, Val);
+		case AtomicRMWInst::Xor:
+			return Builder.CreateXor(Loaded, Val);
+		case AtomicRMWInst::Max:
+			return Builder.CreateSelect(Builder.CreateICmpSLT(Loaded, Val), Val, Loaded);
+		case AtomicRMWInst::Min:
+			return Builder.CreateSelect(Builder.CreateICmpSLT(Loaded, Val), Loaded, Val);
+		case AtomicRMWInst::UMax:
+			return Builder.CreateSelect(Builder.CreateICmpULT(Loaded, Val), Val, Loaded);
+		case AtomicRMWInst::UMin:
+			return Builder.CreateSelect(Builder.CreateICmpULT(Loaded, Val), Loaded, Val);
+		case AtomicRMWInst::FAdd:
+			return Builder.CreateFAdd(Loaded, Val);
+		case AtomicRMWInst::FSub:
+			return Builder.CreateFSub(Loaded, Val);
+		default:
+			llvm_unreachable("Unexpected RMW operation");
+	}
+}
+
+void AtomicLowering::lowerAtomicRMW(AtomicRMWInst* RMWI)
+{
+	IRBuilder<> Builder(RMWI);
+	Value* Ptr = RMWI->getPointerOperand();
+	Value* Val = RMWI->getValOperand();
+
+	LoadInst* Orig = Builder.CreateLoad(Val->getType(), Ptr);
+	Value* Res = emitRMWOperation(Builder, RMWI->getOperation(), Orig, Val);
+	Builder.CreateStore(Res, Ptr);
+	RMWI->replaceAllUsesWith(Orig);
+	RMWI->eraseFromParent();
+}
+
+void AtomicLowering::lowerAtomicCmpXchg(AtomicCmpXchgInst* CXI)
+{
+	IRBuilder<> Builder(CXI);
+	Value* Ptr = CXI->getPointerOperand();
+	Value* Cmp = CXI->getCompareOperand();
+	Value* Val = CXI->getNewValOperand();
+
+	LoadInst* Orig = Builder.CreateLoad(Val->getType(), Ptr);
+	Value* Equal = Builder.CreateICmpEQ(Orig, Cmp);
+	Value* Res = Builder.CreateSelect(Equal, Val, Orig);
+	Builder.CreateStore(Res, Ptr);
+
+	// The writers do not deal with aggregates in registers, forward the
+	// values directly to the extractvalue users when possible
+	SmallVector<User*, 4> users(CXI->user_begin(), CXI->user_end());
+	Value* Pair = nullptr;
+	for (User* U: users)
+	{
+		ExtractValueInst* EVI = dyn_cast<ExtractValueInst>(U);
+		if (EVI && EVI->getNumIndices() == 1)
+		{
+			EVI->replaceAllUsesWith(EVI->getIndices()[0] == 0 ? Orig : Equal);
+			EVI->eraseFromParent();
+			continue;
+		}
+		if (!Pair)
+		{
+			Pair = Builder.CreateInsertValue(UndefValue::get(CXI->getType()), Orig, 0);
+			Pair = Builder.CreateInsertValue(Pair, Equal, 1);
+		}
+		U->replaceUsesOfWith(CXI, Pair);
+	}
+	CXI->eraseFromParent();
+}
+
+void AtomicLowering::lowerWasmAtomicIntrinsic(IntrinsicInst* II)
+{
+	IRBuilder<> Builder(II);
+	Value* Res = nullptr;
+	if (II->getIntrinsicID() == Intrinsic::wasm_atomic_notify)
+	{
+		// Nobody can be waiting
+		Res = Builder.getInt32(0);
+	}
+	else
+	{
+		// Nobody can change the value while waiting: "not-equal" or "timed-out"
+		Value* Ptr = II->getArgOperand(0);
+		Value* Expected = II->getArgOperand(1);
+		Value* Orig = Builder.CreateLoad(Expected->getType(), Ptr);
+		Res = Builder.CreateSelect(Builder.CreateICmpNE(Orig, Expected), Builder.getInt32(1), Builder.getInt32(2));
+	}
+	II->replaceAllUsesWith(Res);
+	II->eraseFromParent();
+}
+
+void AtomicLowering::expandAtomicRMWToCmpXchg(AtomicRMWInst* RMWI)
+{
+	if (RMWI->getType()->isFloatingPointTy())
+		llvm::report_fatal_error("Floating point atomicrmw is not supported in wasm");
+	Value* Ptr = RMWI->getPointerOperand();
+	Value* Val = RMWI->getValOperand();
+	AtomicOrdering Ordering = RMWI->getOrdering();
+
+	BasicBlock* BB = RMWI->getParent();
+	Function* F = BB->getParent();
+	BasicBlock* ExitBB = BB->splitBasicBlock(RMWI->getIterator(), "atomicrmw.end");
+	BasicBlock* LoopBB = BasicBlock::Create(F->getContext(), "atomicrmw.loop", F, ExitBB);
+	BB->getTerminator()->setSuccessor(0, LoopBB);
+
+	// The initial value does not need to be atomic, the cmpxchg validates it
+	IRBuilder<> Builder(BB->getTerminator());
+	LoadInst* InitLoaded = Builder.CreateLoad(Val->getType(), Ptr);
+
+	Builder.SetInsertPoint(LoopBB);
+	PHINode* Loaded = Builder.CreatePHI(Val->getType(), 2);
+	Loaded->addIncoming(InitLoaded, BB);
+	Value* NewVal = emitRMWOperation(Builder, RMWI->getOperation(), Loaded, Val);
+	AtomicCmpXchgInst* CXI = Builder.CreateAtomicCmpXchg(Ptr, Loaded, NewVal, Ordering,
+			AtomicCmpXchgInst::getStrongestFailureOrdering(Ordering));
+	Value* NewLoaded = Builder.CreateExtractValue(CXI, 0);
+	Value* Success = Builder.CreateICmpEQ(NewLoaded, Loaded);
+	Loaded->addIncoming(NewLoaded, LoopBB);
+	Builder.CreateCondBr(Success, ExitBB, LoopBB);
+
+	RMWI->replaceAllUsesWith(NewLoaded);
+	RMWI->eraseFromParent();
+}
+
+void AtomicLowering::canonicalizeCmpXchg(AtomicCmpXchgInst* CXI)
+{
+	// A cmpxchg without users is rendered on its own
+	if (CXI->use_empty())
+		return;
+	SmallVector<ExtractValueInst*, 4> users;
+	ExtractValueInst* Loaded = nullptr;
+	for (User* U: CXI->users())
+	{
+		ExtractValueInst* EVI = dyn_cast<ExtractValueInst>(U);
+		if (!EVI || EVI->getNumIndices() != 1)
+			llvm::report_fatal_error("Unsupported use of cmpxchg in wasm");
+		if (EVI->getIndices()[0] == 0 && !Loaded)
+			Loaded = EVI;
+		else
+			users.push_back(EVI);
+	}
+	if (!Loaded)
+		Loaded = cast<ExtractValueInst>(ExtractValueInst::Create(CXI, 0, "", CXI->getNextNode()));
+	else
+		Loaded->moveAfter(CXI);
+
+	Value* Success = nullptr;
+	for (ExtractValueInst* EVI: users)
+	{
+		if (EVI->getIndices()[0] == 0)
+		{
+			EVI->replaceAllUsesWith(Loaded);
+		}
+		else
+		{
+			if (!Success)
+				Success = new ICmpInst(Loaded->getNextNode(), CmpInst::ICMP_EQ, Loaded, CXI->getCompareOperand());
+			EVI->replaceAllUsesWith(Success);
+		}
+		EVI->eraseFromParent();
+	}
+}
+
+bool AtomicLowering::runOnFunction(Function& F)
+{
+	// Atomics are only kept in wasm functions, the memory of genericjs
+	// functions is never shared
+	const bool keepAtomics = wasmAtomics && F.getSection() == StringRef("asmjs");
+	SmallVector<Instruction*, 8> atomics;
+	for (Instruction& I: instructions(F))
+	{
+		if (isa<FenceInst>(I) || isa<AtomicRMWInst>(I) || isa<AtomicCmpXchgInst>(I))
+			atomics.push_back(&I);
+		else if (isa<LoadInst>(I) && cast<LoadInst>(I).isAtomic())
+			atomics.push_back(&I);
+		else if (isa<StoreInst>(I) && cast<StoreInst>(I).isAtomic())
+			atomics.push_back(&I);
+		else if (const IntrinsicInst* II = dyn_cast<IntrinsicInst>(&I))
+		{
+			switch (II->getIntrinsicID())
+			{
+				case Intrinsic::wasm_atomic_notify:
+				case Intrinsic::wasm_atomic_wait_i32:
+				case Intrinsic::wasm_atomic_wait_i64:
+					atomics.push_back(&I);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	bool Changed = false;
+	for (Instruction* I: atomics)
+	{
+		if (AtomicRMWInst* RMWI = dyn_cast<AtomicRMWInst>(I))
+		{
+			if (!keepAtomics)
+				lowerAtomicRMW(RMWI);
+			else if (!hasWasmOpcode(RMWI))
+			{
+				expandAtomicRMWToCmpXchg(RMWI);
+				NumRMWExpanded++;
+				Changed = true;
+				continue;
+			}
+			else
+				continue;
+		}
+		else if (AtomicCmpXchgInst* CXI = dyn_cast<AtomicCmpXchgInst>(I))
+		{
+			if (keepAtomics)
+			{
+				canonicalizeCmpXchg(CXI);
+				Changed = true;
+				continue;
+			}
+			lowerAtomicCmpXchg(CXI);
+		}
+		else if (keepAtomics)
+			continue;
+		else if (isa<FenceInst>(I))
+			I->eraseFromParent();
+		else if (LoadInst* LI = dyn_cast<LoadInst>(I))
+			LI->setAtomic(AtomicOrdering::NotAtomic);
+		else if (StoreInst* SI = dyn_cast<StoreInst>(I))
+			SI->setAtomic(AtomicOrdering::NotAtomic);
+		else
+			lowerWasmAtomicIntrinsic(cast<IntrinsicInst>(I));
+		NumAtomicsLowered++;
+		Changed = true;
+	}
+	return Changed;
+}
+
+StringRef AtomicLowering::getPassName() const
+{
+	return "AtomicLowering";
+}
+
+char AtomicLowering::ID = 0;
+
+void AtomicLowering::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	llvm::Pass::getAnalysisUsage(AU);
+}
+
+FunctionPass *createAtomicLoweringPass(bool wasmAtomics) { return new AtomicLowering(wasmAtomics); }
+
+}
+
+using namespace llvm;
+INITIALIZE_PASS_BEGIN(AtomicLowering, "AtomicLowering",
+        "Lower atomic instructions which cannot use wasm atomics", false, false)
+INITIALIZE_PASS_END(AtomicLowering, "AtomicLowering",
+        "Lower atomic instructions which cannot use wasm atomics", false, false)
@@ -52,7 +52,9 @@ llvm::cl::opt<unsigned> CheerpHeapSize("cheerp-linear-heap-size", llvm::cl::init
 
 llvm::cl::opt<unsigned> CheerpStackSize("cheerp-linear-stack-size", llvm::cl::init(1), llvm::cl::desc("Desired stack size for the cheerp wasm/asmjs module (in MB)") );
 
-llvm::cl::opt<bool> CheerpNoICF("cheerp-no-icf", llvm::cl::init(0), llvm::cl::desc("Disable identical code folding for wasm/asmjs") );
+llvm::cl::opt<bool> CheerpNoICF("cheerp-no-icf", llvm::cl::init(0), llvm::cl::desc("Disable identical code folding") );
+
+llvm::cl::opt<bool> CheerpICFNearMiss("cheerp-icf-near-miss", llvm::cl::init(0), llvm::cl::desc("Merge wasm/asmjs functions which only differ in a few constants, passing them as extra parameters") );
 
 llvm::cl::opt<bool> BoundsCheck("cheerp-bounds-check", llvm::cl::desc("Generate debug code for bounds-checking arrays") );
 
@@ -70,10 +72,28 @@ llvm::cl::opt<bool> WasmSharedMemory("cheerp-wasm-shared-memory", llvm::cl::desc
 
 llvm::cl::opt<bool> WasmNoGrowMemory("cheerp-wasm-no-grow-memory", llvm::cl::desc("Disable memory growth and allocate all the wasm module memory upfront"));
 
+llvm::cl::opt<bool> WasmNoPeephole("cheerp-wasm-no-peephole", llvm::cl::desc("Disable the peephole optimizations on the generated wasm functions"));
+
 llvm::cl::opt<bool> WasmExportedTable("cheerp-wasm-exported-table", llvm::cl::desc("Export the function table from the wasm module as 'tbl'"));
 
 llvm::cl::opt<bool> WasmAnyref("cheerp-wasm-externref", llvm::cl::desc("Enable support for the externref value type in wasm"));
 
 llvm::cl::opt<bool> WasmReturnCalls("cheerp-wasm-return-calls", llvm::cl::desc("Enable return-call and return-call-indirect opcodes"));
 
+llvm::cl::opt<bool> WasmBulkMemory("cheerp-wasm-bulk-memory", llvm::cl::desc("Enable memory.copy/memory.fill opcodes, and passive data segments when using shared memory"));
+
+llvm::cl::opt<bool> WasmSIMD("cheerp-wasm-simd", llvm::cl::desc("Compile 128-bit vector types to WebAssembly SIMD instructions"));
+
+llvm::cl::opt<bool> WasmNontrappingFPToInt("cheerp-wasm-nontrapping-fptoint", llvm::cl::desc("Enable the saturating float-to-int opcodes, used instead of explicit range checks with -cheerp-avoid-wasm-traps"));
+
+llvm::cl::opt<bool> WasmSignExt("cheerp-wasm-sign-ext", llvm::cl::desc("Enable the sign-extension opcodes"));
+
+llvm::cl::opt<bool> WasmStreaming("cheerp-wasm-streaming", llvm::cl::desc("Compile the wasm module while it is downloaded, when supported by the browser"));
+
+llvm::cl::opt<std::string> WasmModuleCache("cheerp-wasm-module-cache", llvm::cl::Optional, llvm::cl::desc("Cache the compiled wasm module in IndexedDB, change the key to invalidate the cache"), llvm::cl::value_desc("key"));
+
+llvm::cl::opt<bool> WasmMultiValue("cheerp-wasm-multi-value", llvm::cl::desc("Return small aggregates as multiple values instead of using memory"));
+
 llvm::cl::opt<bool> UseBigInts("cheerp-use-bigints", llvm::cl::desc("Use the BigInt type in JS to represent i64 values"));
+
+llvm::cl::opt<unsigned> CheerpCodegenThreads("cheerp-codegen-threads", llvm::cl::init(1), llvm::cl::desc("Number of threads used to scan reachable functions, assign registers and compile function bodies, 0 uses all the available hardware threads. Default: 1"));
@@ -23,12 +23,20 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/ValueSymbolTable.h"
 #include "llvm/Support/FormattedStream.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Transforms/Utils/Local.h"
 #include "llvm/Transforms/Utils/SimplifyLibCalls.h"
 
 using namespace llvm;
 
 STATISTIC(NumRemovedGlobals, "Number of unused globals which have been removed");
+STATISTIC(NumDevirtualizedCalls, "Number of indirect calls with a single possible target made direct");
+STATISTIC(NumDirectCallChains, "Number of indirect calls lowered to a chain of direct calls");
+
+// Maximum number of possible targets for an indirect call to be lowered to
+// a chain of comparisons and direct calls
+static const uint32_t MAX_DIRECT_CALL_CHAIN = 4;
 
 namespace cheerp {
 
@@ -112,6 +120,55 @@ static void callGlobalConstructorsOnStart(llvm::Module& M, GlobalDepsAnalyzer& G
 	return;
 }
 
+/**
+ * Replace an indirect call with a chain of comparisons of the called pointer,
+ * each guarding a direct call. Calling any other function is undefined, so
+ * the last target is called without checking the pointer
+ */
+static void lowerToDirectCallChain(CallInst* ci, const std::vector<Function*>& targets,
+		std::vector<std::pair<CallInst*, Function*>>& directCalls)
+{
+	Value* calledValue = ci->getCalledValue();
+	BasicBlock* BB = ci->getParent();
+	Function* F = BB->getParent();
+	LLVMContext& Ctx = F->getContext();
+	BasicBlock* tail = BB->splitBasicBlock(ci, BB->getName() + ".devirt");
+	BB->getTerminator()->eraseFromParent();
+
+	PHINode* result = nullptr;
+	if (!ci->getType()->isVoidTy())
+		result = PHINode::Create(ci->getType(), targets.size(), "", &tail->front());
+
+	BasicBlock* check = BB;
+	for (uint32_t i = 0; i < targets.size(); i++)
+	{
+		BasicBlock* callBlock = BasicBlock::Create(Ctx, BB->getName() + ".devirt.call", F, tail);
+		IRBuilder<> builder(check);
+		if (i + 1 < targets.size())
+		{
+			BasicBlock* next = BasicBlock::Create(Ctx, BB->getName() + ".devirt.check", F, tail);
+			builder.CreateCondBr(builder.CreateICmpEQ(calledValue, targets[i]), callBlock, next);
+			check = next;
+		}
+		else
+			builder.CreateBr(callBlock);
+
+		CallInst* directCall = cast<CallInst>(ci->clone());
+		directCall->setCalledFunction(targets[i]);
+		callBlock->getInstList().push_back(directCall);
+		BranchInst::Create(tail, callBlock);
+		if (result)
+			result->addIncoming(directCall, callBlock);
+		directCalls.push_back({directCall, targets[i]});
+	}
+	if (result)
+	{
+		result->takeName(ci);
+		ci->replaceAllUsesWith(result);
+	}
+	ci->eraseFromParent();
+}
+
 void GlobalDepsAnalyzer::simplifyCalls(llvm::Module & module) const
 {
 	std::vector<llvm::CallInst*> deleteList;
@@ -164,10 +221,7 @@ void GlobalDepsAnalyzer::extendLifetime(Function* F)
 	assert(F);
 
 	externals.push_back(F);
-	VisitedSet visited;
-	SubExprVec vec;
-	visitGlobal( F, visited, vec );
-	assert( visited.empty() );
+	visitConstant(F);
 }
 
 bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
@@ -177,7 +231,6 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 	auto *TLIP = getAnalysisIfAvailable<TargetLibraryInfoWrapperPass>();
 	TLI = TLIP ? &TLIP->getTLI() : nullptr;
 	assert(TLI);
-	VisitedSet visited;
 
 	simplifyCalls(module);
 
@@ -458,12 +511,10 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 			const Constant * p = cast<Constant>(it);
 
 			requiredConstructors.insert(p);
-			SubExprVec vec;
-			visitGlobal( getConstructorFunction(p), visited, vec );
+			visitConstant( getConstructorFunction(p) );
 			const llvm::Constant* data = getConstructorData(p);
 			if (data)
-				visitConstant(data, visited, vec);
-			assert( visited.empty() );
+				visitConstant(data);
 		}
 		
 		constructorsNeeded.reserve( requiredConstructors.size() );
@@ -491,9 +542,7 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 		StringRef n = v->getName();
 		if(!usesFloatPrintf && isPrintfFamily(n))
 			usesFloatPrintf = true;
-		SubExprVec vec;
-		visitGlobal(v, visited, vec);
-		assert(visited.empty());
+		visitConstant(v);
 	}
 	// Erase printf_float body if it is not used
 	if(!usesFloatPrintf)
@@ -550,11 +599,10 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 	if (hasAsmJS && Sret)
 		Sret->setSection(StringRef("asmjs"));
 
-	auto markAsReachableIfPresent = [this, &visited](Function* F)
+	auto markAsReachableIfPresent = [this](Function* F)
 	{
 		if (F) {
-			visitFunction(F, visited);
-			assert(visited.empty());
+			visitFunction(F);
 			reachableGlobals.insert(F);
 		}
 	};
@@ -681,6 +729,8 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 	//Check agains the previous set what CallInstruction are actually impossible (and remove them)
 	std::vector<llvm::CallInst*> unreachList;
 	std::vector<std::pair<llvm::CallInst*, llvm::Function*> > devirtualizedCalls;
+	// Indirect calls with a few possible targets, all of the same type
+	std::vector<std::pair<llvm::CallInst*, std::vector<llvm::Function*>>> directCallChains;
 
 
 
@@ -724,6 +774,20 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 						replaceCallOfBitCastWithBitCastOfCall(*ci);
 
 						devirtualizedCalls.push_back({ci, toBeCalledFunc});
+						NumDevirtualizedCalls++;
+					}
+					// The map groups the types with the same wasm signature, so the targets may
+					// still have different LLVM types. The direct calls are clones of the indirect
+					// one, which is only valid if every target has exactly the called type
+					else if(it->second.funcs.size() <= MAX_DIRECT_CALL_CHAIN && !ci->isMustTailCall() &&
+						std::all_of(it->second.funcs.begin(), it->second.funcs.end(),
+							[ci](const FunctionData& d) { return d.F->getFunctionType() == ci->getFunctionType(); }))
+					{
+						// For this signature there are only a few indirectly used functions, we can call them directly
+						std::vector<llvm::Function*> targets;
+						for (const FunctionData& d: it->second.funcs)
+							targets.push_back(d.F);
+						directCallChains.emplace_back(ci, std::move(targets));
 					}
 					else
 					{
@@ -749,6 +813,13 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 		}
 	}
 
+	// The chains split the blocks, so they are lowered after the scan
+	for (auto& chain : directCallChains)
+	{
+		lowerToDirectCallChain(chain.first, chain.second, devirtualizedCalls);
+		NumDirectCallChains++;
+	}
+
 	//Avoid too much inlining of devirtualized calls
 	for (auto pair : devirtualizedCalls)
 	{
@@ -945,8 +1016,7 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 		placeholderFunc->setSection("asmjs");
 
 		//Visit the function, so it's in the relevant GlobalDepsAnalyzer data structures
-		VisitedSet visited;
-		visitFunction(placeholderFunc, visited);
+		visitFunction(placeholderFunc);
 
 		//Visit the indirect uses of the old functions, and change them to use the new (almost empty) function
 		replaceSomeUsesWith(indirectUses, placeholderFunc);
@@ -965,39 +1035,76 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 	return true;
 }
 
-void GlobalDepsAnalyzer::visitGlobal( const GlobalValue * C, VisitedSet & visited, const SubExprVec & subexpr )
+void GlobalDepsAnalyzer::visitConstant( const Constant * root )
 {
-	// Delay visiting all printf-like globals, we need to dectect if printf_float is actually used
-	if ( delayPrintf && C->hasName() && C->getName().endswith("printf") )
+	// The constants being visited, with the next operand to follow. An
+	// explicit stack is used since chains of global initializers may be
+	// arbitrarily deep.
+	std::vector<ConstantVisitFrame> stack;
+	// The globals which are currently on the stack
+	llvm::SmallPtrSet<const GlobalValue*, 8> visiting;
+
+	// The uses followed from the innermost global variable initializer to get to the current constant
+	auto getSubExpr = [&stack]() -> SubExprVec
 	{
-		printfLikeQueue.insert(C);
-		return;
-	}
+		SubExprVec subexpr;
+		uint32_t i = stack.size();
+		while ( i > 0 && !isa<GlobalValue>(stack[i-1].C) )
+			i--;
+		if ( i > 0 && isa<GlobalVariable>(stack[i-1].C) )
+			subexpr.push_back( &cast<GlobalVariable>(stack[i-1].C)->getOperandUse(0) );
+		for ( ; i < stack.size(); i++ )
+		{
+			const Constant* C = stack[i].C;
+			if ( isa<ConstantArray>(C) || isa<ConstantStruct>(C) )
+				subexpr.push_back( &C->getOperandUse(stack[i].nextOperand - 1) );
+		}
+		return subexpr;
+	};
 
-	// Cycle detector
-	if ( !visited.insert(C).second )
+	auto enter = [&]( const Constant * C )
 	{
-		assert( reachableGlobals.count(C) );
-		if ( const GlobalVariable * GV = dyn_cast< GlobalVariable >(C) )
+		if ( isa<ConstantExpr>(C) || isa<ConstantArray>(C) || isa<ConstantStruct>(C) )
 		{
-			assert( !subexpr.empty() );
+			stack.push_back( ConstantVisitFrame{C, 0} );
+			return;
+		}
+		const GlobalValue* GV = dyn_cast<GlobalValue>(C);
+		if ( !GV )
+			return;
 
-			varsFixups.emplace( GV, subexpr );
+		// Delay visiting all printf-like globals, we need to dectect if printf_float is actually used
+		if ( delayPrintf && GV->hasName() && GV->getName().endswith("printf") )
+		{
+			printfLikeQueue.insert(GV);
+			return;
 		}
-		return;
-	}
 
-	if ( reachableGlobals.insert(C).second )
-	{
+		// Cycle detector
+		if ( visiting.count(GV) )
+		{
+			assert( reachableGlobals.count(GV) );
+			if ( const GlobalVariable * V = dyn_cast< GlobalVariable >(GV) )
+			{
+				SubExprVec subexpr = getSubExpr();
+				assert( !subexpr.empty() );
+
+				varsFixups.emplace( V, subexpr );
+			}
+			return;
+		}
+
+		if ( !reachableGlobals.insert(GV).second )
+			return;
 
-		if(const GlobalAlias * GA = dyn_cast<GlobalAlias>(C) )
+		if ( isa<GlobalAlias>(GV) )
 		{
-			SubExprVec vec;
-			visitGlobal(cast<GlobalValue>(GA->getAliasee()), visited, vec );
+			visiting.insert(GV);
+			stack.push_back( ConstantVisitFrame{GV, 0} );
 		}
-		else if (const Function * F = dyn_cast<Function>(C) )
+		else if ( const Function * F = dyn_cast<Function>(GV) )
 		{
-			if ( C->getName() == StringRef("free") )
+			if ( F->getName() == StringRef("free") )
 			{
 				// Don't visit free right now. We do it only if
 				// actyally needed at the end
@@ -1005,75 +1112,50 @@ void GlobalDepsAnalyzer::visitGlobal( const GlobalValue * C, VisitedSet & visite
 			}
 			else
 			{
-				if (C->getName() == StringRef("malloc"))
+				if ( F->getName() == StringRef("malloc") )
 					hasAsmJSMalloc = true;
 
-				if (C->getSection() == StringRef("asmjs"))
+				if ( F->getSection() == StringRef("asmjs") )
 				{
 					hasAsmJS = true;
 				}
 				enqueueFunction(F);
 			}
 		}
-		else if (const GlobalVariable * GV = dyn_cast<GlobalVariable>(C) )
+		else if ( const GlobalVariable * V = dyn_cast<GlobalVariable>(GV) )
 		{
-			if (C->getSection() == StringRef("asmjs"))
+			if ( V->getSection() == StringRef("asmjs") )
 			{
 				hasAsmJS = true;
 			}
-			if (GV->hasInitializer() )
-			{
-				// Add the "GlobalVariable - initializer" use to the subexpr,
-				// in order to being able to get the global variable from the fixup map
-				SubExprVec Newsubexpr (1, &GV->getOperandUse(0));
-				visitConstant( GV->getInitializer(), visited, Newsubexpr);
-				Type* globalType = GV->getInitializer()->getType();
-				if(GV->getSection() != StringRef("asmjs"))
-					visitType(globalType, /*forceTypedArray*/ false);
-			}
-			varsOrder.push_back(GV);
+			// The initializer, if any, is the only operand
+			visiting.insert(GV);
+			stack.push_back( ConstantVisitFrame{GV, 0} );
 		}
-	}
-
-	visited.erase(C);
-}
+	};
 
-void GlobalDepsAnalyzer::visitConstant( const Constant * C, VisitedSet & visited, SubExprVec & subexpr )
-{
-	if ( const GlobalValue * GV = dyn_cast<GlobalValue>(C) )
-		visitGlobal(GV, visited, subexpr);
-	else if(const ConstantExpr * CE = dyn_cast<const ConstantExpr>(C))
+	enter(root);
+	while ( !stack.empty() )
 	{
-		for(const Value* V: CE->operands())
+		ConstantVisitFrame& frame = stack.back();
+		if ( frame.nextOperand < frame.C->getNumOperands() )
 		{
-			const Constant* C=cast<Constant>(V);
-			visitConstant(C, visited, subexpr);
+			const Constant* op = cast<Constant>( frame.C->getOperand(frame.nextOperand++) );
+			enter(op);
+			continue;
 		}
-	}
-	else if(const ConstantArray* d = dyn_cast<const ConstantArray>(C) )
-	{
-		assert(d->getType()->getNumElements() == d->getNumOperands());
-		
-		for (ConstantArray::const_op_iterator it = d->op_begin();it != d->op_end(); ++it)
+		const Constant* C = frame.C;
+		stack.pop_back();
+		if ( const GlobalVariable * GV = dyn_cast<GlobalVariable>(C) )
 		{
-			assert( isa<Constant>(it) );
-			subexpr.push_back( it );
-			visitConstant( cast<Constant>(it), visited, subexpr);
-			subexpr.pop_back();
-		}
-	}
-	else if(const ConstantStruct* d = dyn_cast<const ConstantStruct>(C) )
-	{
-		assert(d->getType()->getNumElements() == d->getNumOperands());
-		
-		for (ConstantArray::const_op_iterator it = d->op_begin();it != d->op_end(); ++it)
-		{
-			assert( isa<Constant>(it) );
-			subexpr.push_back( it );
-			visitConstant(cast<Constant>(it), visited, subexpr);
-			subexpr.pop_back();
+			if ( GV->hasInitializer() && GV->getSection() != StringRef("asmjs") )
+				visitType( GV->getInitializer()->getType(), /*forceTypedArray*/ false );
+			varsOrder.push_back(GV);
 		}
+		if ( const GlobalValue * GV = dyn_cast<GlobalValue>(C) )
+			visiting.erase(GV);
 	}
+	assert( visiting.empty() );
 }
 
 void GlobalDepsAnalyzer::visitDynSizedAlloca( llvm::Type* pointedType )
@@ -1086,137 +1168,168 @@ void GlobalDepsAnalyzer::visitDynSizedAlloca( llvm::Type* pointedType )
 		arraysNeeded.insert( pointedType );
 }
 
-void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
+void GlobalDepsAnalyzer::scanFunction(const Function* F, std::vector<const Value*>& items) const
 {
-	VisitedSet NewvisitPath;
+	bool isAsmJS = F->getSection() == StringRef("asmjs");
+	llvm::SmallPtrSet<const Constant*, 16> seenConstants;
+	for ( const BasicBlock & bb : *F )
+		for (const Instruction & I : bb)
+		{
+			for (const Value * v : I.operands() )
+			{
+				// Simple constants never lead to other globals
+				if ( isa<Constant>(v) && !isa<ConstantData>(v) && seenConstants.insert(cast<Constant>(v)).second )
+					items.push_back(v);
+			}
 
+			if ( isa<AllocaInst>(I) )
+			{
+				if(!isAsmJS)
+					items.push_back(&I);
+			}
+			else if ( isa<CallInst>(I) || isa<InvokeInst>(I) )
+				items.push_back(&I);
+			else if (!isAsmJS && I.getOpcode() == Instruction::VAArg)
+				items.push_back(&I);
+		}
+}
+
+void GlobalDepsAnalyzer::visitFunction(const Function* F)
+{
+	std::vector<const Value*> items;
+	scanFunction(F, items);
+	visitFunctionItems(F, items);
+}
+
+void GlobalDepsAnalyzer::visitFunctionItems(const Function* F, const std::vector<const Value*>& items)
+{
 	const Module* module = F->getParent();
 	bool isAsmJS = F->getSection() == StringRef("asmjs");
 	if (isAsmJS)
 		functionsInsideModule.insert(F);
 	else
 		functionsOutsideModule.insert(F);
-	for ( const BasicBlock & bb : *F )
-		for (const Instruction & I : bb)
+	for (const Value* item : items)
+	{
+		if (const Constant * c = dyn_cast<Constant>(item) )
 		{
-			for (const Value * v : I.operands() )
+			visitConstant(c);
+			continue;
+		}
+		const Instruction& I = *cast<Instruction>(item);
+
+		if ( const AllocaInst* AI = dyn_cast<AllocaInst>(&I) )
+		{
+			Type* allocaType = AI->getAllocatedType();
+			if(!isAsmJS)
+				visitType(allocaType, forceTypedArrays);
+		}
+		else if ( ImmutableCallSite(&I).isCall() || ImmutableCallSite(&I).isInvoke() )
+		{
+			DynamicAllocInfo ai (ImmutableCallSite(&I), DL, forceTypedArrays);
+			if ( !isAsmJS && ai.isValidAlloc() )
 			{
-				if (const Constant * c = dyn_cast<Constant>(v) )
+				assert(!TypeSupport::isAsmJSPointer(ai.getCastedType()));
+				if ( ai.useCreatePointerArrayFunc() )
+					hasPointerArrays = true;
+				else if ( ai.useCreateArrayFunc() )
 				{
-					SubExprVec Newsubexpr;
-					visitConstant(c, NewvisitPath, Newsubexpr);
-					assert( NewvisitPath.empty() );
+					if ( ai.getAllocType() == DynamicAllocInfo::cheerp_reallocate )
+						arrayResizesNeeded.insert( ai.getCastedType()->getElementType() );
+					else
+						arraysNeeded.insert( ai.getCastedType()->getElementType() );
 				}
+				if ( StructType* ST = dyn_cast<StructType>(ai.getCastedType()->getElementType()) )
+					visitStruct(ST);
 			}
-
-			if ( const AllocaInst* AI = dyn_cast<AllocaInst>(&I) )
+		}
+		if (!isAsmJS && I.getOpcode() == Instruction::VAArg)
+			hasVAArgs = true;
+		// Handle calls from asmjs module to outside and vice-versa
+		// and fill the info for the function tables
+		if (isa<CallInst>(I))
+		{
+			const CallInst& ci = cast<CallInst>(I);
+			const Function * calledFunc = ci.getCalledFunction();
+			// calledFunc can be null, but if the calledValue is a bitcast,
+			// this can still be a direct call
+			if (calledFunc == nullptr && isBitCast(ci.getCalledValue()))
 			{
-				Type* allocaType = AI->getAllocatedType();
-				if(!isAsmJS)
-					visitType(allocaType, forceTypedArrays);
+				const llvm::User* bc = cast<llvm::User>(ci.getCalledValue());
+				calledFunc = dyn_cast<Function>(bc->getOperand(0));
 			}
-			else if ( ImmutableCallSite(&I).isCall() || ImmutableCallSite(&I).isInvoke() )
+			// TODO: Handle import/export of indirect calls if possible
+			if (!calledFunc)
+				continue;
+			// Direct call
+			if (!calledFunc->isIntrinsic())
 			{
-				DynamicAllocInfo ai (ImmutableCallSite(&I), DL, forceTypedArrays);
-				if ( !isAsmJS && ai.isValidAlloc() )
-				{
-					assert(!TypeSupport::isAsmJSPointer(ai.getCastedType()));
-					if ( ai.useCreatePointerArrayFunc() )
-						hasPointerArrays = true;
-					else if ( ai.useCreateArrayFunc() )
-					{
-						if ( ai.getAllocType() == DynamicAllocInfo::cheerp_reallocate )
-							arrayResizesNeeded.insert( ai.getCastedType()->getElementType() );
-						else
-							arraysNeeded.insert( ai.getCastedType()->getElementType() );
-					}
-					if ( StructType* ST = dyn_cast<StructType>(ai.getCastedType()->getElementType()) )
-						visitStruct(ST);
-				}
+				bool calleeIsAsmJS = calledFunc->getSection() == StringRef("asmjs");
+				// asm.js function called from outside
+				if (calleeIsAsmJS && !isAsmJS && !calledFunc->empty())
+					asmJSExportedFuncions.insert(calledFunc);
+				// normal function called from asm.js
+				else if (!calleeIsAsmJS && isAsmJS)
+					asmJSImportedFuncions.insert(calledFunc);
 			}
-			if (!isAsmJS && I.getOpcode() == Instruction::VAArg)
-				hasVAArgs = true;
-			// Handle calls from asmjs module to outside and vice-versa
-			// and fill the info for the function tables
-			if (isa<CallInst>(I))
+			// if this is an allocation intrinsic and we are in asmjs,
+			// visit the corresponding libc function. The same applies if the allocated type is asmjs.
+			else if (calledFunc->getIntrinsicID() == Intrinsic::cheerp_allocate ||
+			    calledFunc->getIntrinsicID() == Intrinsic::cheerp_allocate_array)
 			{
-				const CallInst& ci = cast<CallInst>(I);
-				const Function * calledFunc = ci.getCalledFunction();
-				// calledFunc can be null, but if the calledValue is a bitcast,
-				// this can still be a direct call
-				if (calledFunc == nullptr && isBitCast(ci.getCalledValue()))
+				if (isAsmJS || TypeSupport::isAsmJSPointer(calledFunc->getReturnType()))
 				{
-					const llvm::User* bc = cast<llvm::User>(ci.getCalledValue());
-					calledFunc = dyn_cast<Function>(bc->getOperand(0));
-				}
-				// TODO: Handle import/export of indirect calls if possible
-				if (!calledFunc)
-					continue;
-				// Direct call
-				if (!calledFunc->isIntrinsic())
-				{
-					bool calleeIsAsmJS = calledFunc->getSection() == StringRef("asmjs");
-					// asm.js function called from outside
-					if (calleeIsAsmJS && !isAsmJS && !calledFunc->empty())
-						asmJSExportedFuncions.insert(calledFunc);
-					// normal function called from asm.js
-					else if (!calleeIsAsmJS && isAsmJS)
-						asmJSImportedFuncions.insert(calledFunc);
-				}
-				// if this is an allocation intrinsic and we are in asmjs,
-				// visit the corresponding libc function. The same applies if the allocated type is asmjs.
-				else if (calledFunc->getIntrinsicID() == Intrinsic::cheerp_allocate ||
-				    calledFunc->getIntrinsicID() == Intrinsic::cheerp_allocate_array)
-				{
-					if (isAsmJS || TypeSupport::isAsmJSPointer(calledFunc->getReturnType()))
+					Function* fmalloc = module->getFunction("malloc");
+					if (fmalloc)
 					{
-						Function* fmalloc = module->getFunction("malloc");
-						if (fmalloc)
-						{
-							SubExprVec vec;
-							visitGlobal(fmalloc, visited, vec );
-							if(!isAsmJS)
-								asmJSExportedFuncions.insert(fmalloc);
-							externals.push_back(fmalloc);
-							hasAsmJSMalloc = true;
-						}
+						visitConstant(fmalloc);
+						if(!isAsmJS)
+							asmJSExportedFuncions.insert(fmalloc);
+						externals.push_back(fmalloc);
+						hasAsmJSMalloc = true;
 					}
 				}
-				else if (calledFunc->getIntrinsicID() == Intrinsic::cheerp_reallocate)
+			}
+			else if (calledFunc->getIntrinsicID() == Intrinsic::cheerp_reallocate)
+			{
+				if (isAsmJS || TypeSupport::isAsmJSPointer(calledFunc->getReturnType()))
 				{
-					if (isAsmJS || TypeSupport::isAsmJSPointer(calledFunc->getReturnType()))
+					Function* frealloc = module->getFunction("realloc");
+					if (frealloc)
 					{
-						Function* frealloc = module->getFunction("realloc");
-						if (frealloc)
-						{
-							SubExprVec vec;
-							visitGlobal(frealloc, visited, vec );
-							if(!isAsmJS)
-								asmJSExportedFuncions.insert(frealloc);
-							externals.push_back(frealloc);
-							hasAsmJSMalloc = true;
-						}
+						visitConstant(frealloc);
+						if(!isAsmJS)
+							asmJSExportedFuncions.insert(frealloc);
+						externals.push_back(frealloc);
+						hasAsmJSMalloc = true;
 					}
 				}
-				else if (calledFunc->getIntrinsicID() == Intrinsic::cheerp_deallocate)
+			}
+			else if (calledFunc->getIntrinsicID() == Intrinsic::cheerp_deallocate)
+			{
+				Type* ty = ci.getOperand(0)->getType();
+				bool basicType = !ty->isAggregateType();
+				bool asmjsPtr = TypeSupport::isAsmJSPointer(ty);
+				if (isAsmJS || basicType || asmjsPtr)
 				{
-					Type* ty = ci.getOperand(0)->getType();
-					bool basicType = !ty->isAggregateType();
-					bool asmjsPtr = TypeSupport::isAsmJSPointer(ty);
-					if (isAsmJS || basicType || asmjsPtr)
-					{
-						// Delay adding free, it will be done only if asm.js malloc is actually there
-						mayNeedAsmJSFree = true;
-					}
+					// Delay adding free, it will be done only if asm.js malloc is actually there
+					mayNeedAsmJSFree = true;
 				}
-				else if (calledFunc->getIntrinsicID() == Intrinsic::memset)
-					extendLifetime(module->getFunction("memset"));
-				else if (calledFunc->getIntrinsicID() == Intrinsic::memcpy)
-					extendLifetime(module->getFunction("memcpy"));
-				else if (calledFunc->getIntrinsicID() == Intrinsic::memmove)
-					extendLifetime(module->getFunction("memmove"));
 			}
+			// With bulk memory the wasm writer lowers these to memory.copy/memory.fill
+			else if (isAsmJS && LinearOutput == Wasm && WasmBulkMemory &&
+				(calledFunc->getIntrinsicID() == Intrinsic::memset ||
+				calledFunc->getIntrinsicID() == Intrinsic::memcpy ||
+				calledFunc->getIntrinsicID() == Intrinsic::memmove))
+				continue;
+			else if (calledFunc->getIntrinsicID() == Intrinsic::memset)
+				extendLifetime(module->getFunction("memset"));
+			else if (calledFunc->getIntrinsicID() == Intrinsic::memcpy)
+				extendLifetime(module->getFunction("memcpy"));
+			else if (calledFunc->getIntrinsicID() == Intrinsic::memmove)
+				extendLifetime(module->getFunction("memmove"));
 		}
+	}
 	
 	// Gather informations about all the classes which may be downcast targets
 	if (F->getIntrinsicID() == Intrinsic::cheerp_downcast)
@@ -1471,13 +1584,42 @@ void GlobalDepsAnalyzer::enqueueFunction(const llvm::Function* F) {
 
 //Process Functions in the execution queue
 void GlobalDepsAnalyzer::processEnqueuedFunctions() {
+	unsigned numThreads = CheerpCodegenThreads;
+	if (numThreads == 0)
+		numThreads = llvm::heavyweight_hardware_concurrency();
 	while (!functionsQueue.empty())
 	{
-		const Function* F = functionsQueue.back();
-		functionsQueue.pop_back();
-		VisitedSet visited;
-		visitFunction(F, visited);
-		assert( visited.empty() );
+		// Functions reached by the current wave are visited in the next one
+		std::vector<const Function*> wave;
+		std::swap(wave, functionsQueue);
+		std::reverse(wave.begin(), wave.end());
+		const uint32_t count = wave.size();
+		std::vector<std::vector<const Value*>> items(count);
+		const uint32_t threads = std::min<uint32_t>(numThreads, count);
+		if (threads <= 1)
+		{
+			for (uint32_t i = 0; i < count; i++)
+				scanFunction(wave[i], items[i]);
+		}
+		else
+		{
+			// Scanning does not touch the shared state, so bodies are scanned concurrently
+			std::atomic<uint32_t> nextFunction(0);
+			ThreadPool pool(threads);
+			for (uint32_t t = 0; t < threads; t++)
+			{
+				pool.async([this, count, &wave, &items, &nextFunction]()
+				{
+					uint32_t i;
+					while ((i = nextFunction++) < count)
+						scanFunction(wave[i], items[i]);
+				});
+			}
+			pool.wait();
+		}
+		// Visit the results in queue order, so that they do not depend on scheduling
+		for (uint32_t i = 0; i < count; i++)
+			visitFunctionItems(wave[i], items[i]);
 	}
 }
 
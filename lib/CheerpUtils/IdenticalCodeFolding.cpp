@@ -12,17 +12,27 @@
 #define DEBUG_TYPE "IdenticalCodeFolding"
 #include "llvm/InitializePasses.h"
 #include "llvm/Cheerp/IdenticalCodeFolding.h"
+#include "llvm/Cheerp/CommandLine.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/LEB128.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 
+#include <map>
 #include <unordered_map>
+#include <unordered_set>
 
 //#define DEBUG_VERBOSE 1
 
+STATISTIC(NumFoldedFunctions, "Number of functions folded into an identical one");
+STATISTIC(NumFoldedInstructions, "Number of instructions removed by folding functions");
+STATISTIC(NumNearMissMerged, "Number of functions merged into a body with constant parameters");
+
 using namespace llvm;
 
 namespace cheerp {
@@ -36,7 +46,7 @@ StringRef IdenticalCodeFolding::getPassName() const
 	return "IdenticalCodeFolding";
 }
 
-IdenticalCodeFolding::IdenticalCodeFolding() : ModulePass(ID)
+IdenticalCodeFolding::IdenticalCodeFolding() : ModulePass(ID), genericJS(false)
 {
 }
 
@@ -55,6 +65,7 @@ uint64_t IdenticalCodeFolding::hashFunction(llvm::Function& F)
 {
 	HashAccumulator64 hash;
 
+	hash.add(F.getSection() == StringRef("asmjs"));
 	hash.add(F.isVarArg());
 	hash.add(F.arg_size());
 
@@ -107,23 +118,28 @@ bool IdenticalCodeFolding::equivalentFunction(const llvm::Function* A, const llv
 	llvm::errs() << "function B: " << B->getName() << '\n';
 #endif
 
-	// Do not fold wasm/asmjs with generic JS functions.
-	if (A->getSection() != StringRef("asmjs") || B->getSection() != StringRef("asmjs"))
+	if (!A || !B || A->isVarArg() != B->isVarArg() || A->arg_size() != B->arg_size())
 		return false;
 
-	// Mark the function pair as equivalent to deal with recursion. The
-	// right equivalence value is set when |equivalentFunction()| returns.
-	functionEquivalence[{A, B}] = true;
-
-	if (!A || !B || A->isVarArg() != B->isVarArg() || A->arg_size() != B->arg_size())
+	// Do not fold wasm/asmjs with generic JS functions.
+	bool asmjsA = A->getSection() == StringRef("asmjs");
+	bool asmjsB = B->getSection() == StringRef("asmjs");
+	if (asmjsA != asmjsB)
 		return false;
+	genericJS = !asmjsA;
 
 	// Do not fold functions that have inequivalent function parameter types.
 	for (auto a = A->arg_begin(), b = B->arg_begin(); a != A->arg_end(); ++a, ++b) {
-		if (!equivalentType(a->getType(), b->getType()))
+		if (!equivalentType(a->getType(), b->getType()) || !equivalentPointerKind(&*a, &*b))
 			return false;
 	}
 
+	if (genericJS && A->getReturnType()->isPointerTy() &&
+		PA->getPointerKindForReturn(A) != PA->getPointerKindForReturn(B))
+	{
+		return false;
+	}
+
 	if (A->empty() || B->empty())
 		return A->empty() == B->empty();
 
@@ -224,16 +240,46 @@ bool IdenticalCodeFolding::equivalentInstruction(const llvm::Instruction* A, con
 	if (!A || !B || A->getOpcode() != B->getOpcode())
 		return CacheAndReturn(false);
 
+	if (genericJS && (A->getType() != B->getType() || !equivalentPointerKind(A, B)))
+		return CacheAndReturn(false);
+
 	switch(A->getOpcode())
 	{
 		case Instruction::Alloca:
 		{
-			llvm::report_fatal_error("Allocas in wasm should be removed in the AllocaLowering pass. This is a bug");
+			if (!genericJS)
+				llvm::report_fatal_error("Allocas in wasm should be removed in the AllocaLowering pass. This is a bug");
+			const AllocaInst* a = cast<AllocaInst>(A);
+			const AllocaInst* b = cast<AllocaInst>(B);
+			return CacheAndReturn(a->getAllocatedType() == b->getAllocatedType() &&
+				equivalentOperand(a->getArraySize(), b->getArraySize()));
 		}
 		case Instruction::Unreachable:
 		{
 			return CacheAndReturn(true);
 		}
+		case Instruction::AtomicRMW:
+		case Instruction::AtomicCmpXchg:
+		case Instruction::Fence:
+		{
+			// Atomics are rare, do not bother folding them
+			return CacheAndReturn(false);
+		}
+		case Instruction::ExtractValue:
+		{
+			const ExtractValueInst* a = cast<ExtractValueInst>(A);
+			const ExtractValueInst* b = cast<ExtractValueInst>(B);
+			return CacheAndReturn(a->getIndices() == b->getIndices() &&
+				equivalentOperand(a->getAggregateOperand(), b->getAggregateOperand()));
+		}
+		case Instruction::InsertValue:
+		{
+			const InsertValueInst* a = cast<InsertValueInst>(A);
+			const InsertValueInst* b = cast<InsertValueInst>(B);
+			return CacheAndReturn(a->getIndices() == b->getIndices() &&
+				equivalentOperand(a->getAggregateOperand(), b->getAggregateOperand()) &&
+				equivalentOperand(a->getInsertedValueOperand(), b->getInsertedValueOperand()));
+		}
 		case Instruction::PtrToInt:
 		case Instruction::IntToPtr:
 		case Instruction::BitCast:
@@ -328,12 +374,14 @@ bool IdenticalCodeFolding::equivalentInstruction(const llvm::Instruction* A, con
 					{
 						return CacheAndReturn(true);
 					}
+					case Intrinsic::not_intrinsic:
+						break;
 					case Intrinsic::vastart:
 					{
-						llvm::report_fatal_error("Vastart in wasm should be removed in the AllocaLowering pass. This is a bug");
+						if (!genericJS)
+							llvm::report_fatal_error("Vastart in wasm should be removed in the AllocaLowering pass. This is a bug");
+						[[clang::fallthrough]];
 					}
-					case Intrinsic::not_intrinsic:
-						break;
 					case Intrinsic::cheerp_downcast:
 					case Intrinsic::cheerp_virtualcast:
 					{
@@ -368,46 +416,14 @@ bool IdenticalCodeFolding::equivalentInstruction(const llvm::Instruction* A, con
 					return CacheAndReturn(false);
 			}
 
+			// The called functions are compared later, by refining the classes
+			// of equivalent functions. Only record which function B calls here.
 			if (calledFunc)
 			{
-				// Traverse into functions when name does not match.
-				const Function* calledFuncB = cast<CallInst>(B)->getCalledFunction();
-				if (calledFunc != calledFuncB) {
-					auto key = make_pair(calledFunc, calledFuncB);
-					bool equivalent = false;
-					auto found = functionEquivalence.find(key);
-					if (found == functionEquivalence.end()) {
-						equivalent = equivalentFunction(calledFunc, calledFuncB);
-						functionEquivalence[key] = equivalent;
-					} else {
-						equivalent = found->second;
-					}
-
-					if (!equivalent)
-						return CacheAndReturn(false);
-				}
+				calleeMatches[ci] = cast<CallInst>(B)->getCalledFunction();
 			}
 			else if (isStaticIndirectFunction(calledValue) && isStaticIndirectFunction(calledValueB)) {
-				calledFunc = cast<Function>(cast<ConstantExpr>(calledValue)->getOperand(0));
-				auto calledFuncB = cast<Function>(cast<ConstantExpr>(calledValueB)->getOperand(0));
-				// Traverse into functions when name does not match.
-				if (calledFunc != calledFuncB) {
-					auto key = make_pair(calledFunc, calledFuncB);
-					bool equivalent = false;
-					auto found = functionEquivalence.find(key);
-					if (found == functionEquivalence.end()) {
-						equivalent = equivalentFunction(calledFunc, calledFuncB);
-						functionEquivalence[key] = equivalent;
-					} else {
-						equivalent = found->second;
-					}
-
-#if DEBUG_VERBOSE
-					llvm::errs() << "function equivalent: " << equivalent << "\n";
-#endif
-					if (!equivalent)
-						return CacheAndReturn(false);
-				}
+				calleeMatches[ci] = cast<Function>(cast<ConstantExpr>(calledValueB)->getOperand(0));
 			}
 			else if (!equivalentOperand(calledValue, calledValueB)) {
 				return CacheAndReturn(false);
@@ -452,8 +468,8 @@ bool IdenticalCodeFolding::equivalentInstruction(const llvm::Instruction* A, con
 		{
 			const SelectInst* siA = cast<SelectInst>(A);
 			const SelectInst* siB = cast<SelectInst>(B);
-			return CacheAndReturn(equivalentOperand(siA->getTrueValue(), siB->getTrueValue()) ||
-				equivalentOperand(siA->getFalseValue(), siB->getFalseValue()) ||
+			return CacheAndReturn(equivalentOperand(siA->getTrueValue(), siB->getTrueValue()) &&
+				equivalentOperand(siA->getFalseValue(), siB->getFalseValue()) &&
 				equivalentOperand(siA->getCondition(), siB->getCondition()));
 		}
 		case Instruction::SIToFP:
@@ -488,6 +504,10 @@ bool IdenticalCodeFolding::equivalentInstruction(const llvm::Instruction* A, con
 		}
 		default:
 		{
+			// Generic JS functions may contain instructions which never
+			// reach wasm/asmjs, just don't fold them
+			if (genericJS)
+				return CacheAndReturn(false);
 #ifndef NDEBUG
 			A->dump();
 #endif
@@ -530,6 +550,9 @@ bool IdenticalCodeFolding::equivalentOperand(const llvm::Value* A, const llvm::V
 		return a->getArgNo() == b->getArgNo();
 	}
 
+	if (isa<MetadataAsValue>(A) || isa<MetadataAsValue>(B))
+		return A == B;
+
 #ifndef NDEBUG
 	A->dump();
 	B->dump();
@@ -628,6 +651,10 @@ bool IdenticalCodeFolding::equivalentConstant(const llvm::Constant* A, const llv
 	if (isa<UndefValue>(A) || isa<UndefValue>(B))
 		return isa<UndefValue>(A) && isa<UndefValue>(B);
 
+	// Aggregate constants are only used by generic JS functions
+	if (genericJS)
+		return A == B;
+
 #ifndef NDEBUG
 	A->dump();
 	B->dump();
@@ -648,6 +675,11 @@ bool IdenticalCodeFolding::equivalentType(const llvm::Type* A, const llvm::Type*
 	if (A == B)
 		return true;
 
+	// In generic JS every struct type is a JS class with its own layout (see
+	// Types.cpp), and even scalars of different types are rendered differently
+	if (genericJS)
+		return false;
+
 	if (A->isArrayTy() && B->isArrayTy()) {
 		const llvm::ArrayType* a = cast<ArrayType>(A);
 		const llvm::ArrayType* b = cast<ArrayType>(B);
@@ -698,6 +730,18 @@ bool IdenticalCodeFolding::equivalentGep(const llvm::GetElementPtrInst* A, const
 		}
 	};
 
+	// Generic JS GEPs are rendered using the JS layout of the types, which
+	// are identical here. Just compare the operands.
+	if (genericJS) {
+		if (A->getNumOperands() != B->getNumOperands())
+			return false;
+		for (unsigned i = 0; i < A->getNumOperands(); i++) {
+			if (!equivalentOperand(A->getOperand(i), B->getOperand(i)))
+				return false;
+		}
+		return true;
+	}
+
 	const llvm::Module& module = *A->getParent()->getParent()->getParent();
 	GepListener gepListenerA;
 	GepListener gepListenerB;
@@ -770,22 +814,70 @@ bool IdenticalCodeFolding::ignoreInstruction(const llvm::Instruction* I)
 	return false;
 }
 
+bool IdenticalCodeFolding::equivalentPointerKind(const llvm::Value* A, const llvm::Value* B)
+{
+	if (!genericJS || !A->getType()->isPointerTy())
+		return true;
+	// The kind of the pointers decides how they are rendered, and a constant
+	// offset allows to omit the offset part of a REGULAR pointer
+	return PA->getPointerKind(A) == PA->getPointerKind(B) &&
+		PA->getConstantOffsetForPointer(A) == PA->getConstantOffsetForPointer(B);
+}
+
 bool IdenticalCodeFolding::isStaticIndirectFunction(const llvm::Value* A)
 {
 	auto ce = dyn_cast<ConstantExpr>(A);
 	return ce && ce->isCast() && isa<Function>(ce->getOperand(0));
 }
 
+void IdenticalCodeFolding::collectCallees(const Function* leader, bool ownCallees, std::vector<const Function*>& callees)
+{
+	// The calls are visited in the leader's order, so that the lists of all
+	// the functions compared with the same leader are aligned
+	for (const BasicBlock& BB : *leader) {
+		for (const Instruction& I : BB) {
+			auto it = calleeMatches.find(&I);
+			if (it == calleeMatches.end())
+				continue;
+			if (!ownCallees) {
+				callees.push_back(it->second);
+				continue;
+			}
+			const Value* calledValue = cast<CallInst>(I).getCalledValue();
+			if (isStaticIndirectFunction(calledValue))
+				calledValue = cast<ConstantExpr>(calledValue)->getOperand(0);
+			callees.push_back(cast<Function>(calledValue));
+		}
+	}
+}
+
 bool IdenticalCodeFolding::runOnModule(llvm::Module& module)
 {
 	cheerp::GlobalDepsAnalyzer &GDA = getAnalysis<cheerp::GlobalDepsAnalyzer>();
 	DL = &module.getDataLayout();
 
+	// Generic JS functions exported to JS are looked up by name, keep them
+	std::unordered_set<const Function*> jsExported;
+	for (const NamedMDNode& namedNode : module.named_metadata()) {
+		StringRef name = namedNode.getName();
+		if (name != "jsexported_free_functions" && !name.endswith("_methods"))
+			continue;
+		for (const MDNode* node : namedNode.operands())
+			jsExported.insert(cast<Function>(cast<ConstantAsMetadata>(node->getOperand(0))->getValue()));
+	}
+
 	// First, compute an hash of each function.
 	std::unordered_map<uint64_t, std::vector<Function*>> functionHashes;
+	std::vector<uint64_t> hashOrder;
+	bool hasGenericJS = false;
 	for (Function& F : module.getFunctionList()) {
-		if (F.isDeclaration() || F.getSection() != StringRef("asmjs"))
+		if (F.isDeclaration())
 			continue;
+		if (F.getSection() != StringRef("asmjs")) {
+			if (jsExported.count(&F))
+				continue;
+			hasGenericJS = true;
+		}
 
 		// Skip functions with special semantics, we really don't want to merge them with anything
 		if (F.getName() == "malloc" || F.getName() == "calloc" ||
@@ -798,78 +890,154 @@ bool IdenticalCodeFolding::runOnModule(llvm::Module& module)
 		const auto& found = functionHashes.find(hash);
 		if (found != functionHashes.end())
 			found->second.push_back(&F);
-		else
+		else {
 			functionHashes.insert({hash, {&F}});
+			hashOrder.push_back(hash);
+		}
 	}
 
-	// Second, compare the functions that have the same hash value.
-	for (auto item : functionHashes) {
-		auto& functions = item.second;
+	// The generic JS functions are only equivalent if the pointers in them
+	// have the same kinds. This is the same analysis that the backend runs
+	// after this pass, on the module as it is now.
+	if (hasGenericJS) {
+		PA.reset(new PointerAnalyzer());
+		PA->runOnModule(module);
+		PA->fullResolve();
+		PA->computeConstantOffsets(module);
+	}
 
-		if (functions.size() < 2)
-			continue;
+	// Second, split the functions with the same hash in classes of functions
+	// which are equivalent, except for the functions they call. Every function
+	// is only compared with the first function (the leader) of a class.
+	std::vector<std::vector<Function*>> classes;
+	std::unordered_map<const Function*, std::vector<const Function*>> callees;
+	for (uint64_t hash : hashOrder) {
+		std::vector<Function*> remaining = functionHashes[hash];
+		while (remaining.size() > 1) {
+			Function* leader = remaining[0];
+			std::vector<Function*> equivalent;
+			std::vector<Function*> different;
+			for (unsigned i = 1; i < remaining.size(); i++) {
+				visitedPhis.clear();
+				calleeMatches.clear();
+				if (!equivalentFunction(leader, remaining[i])) {
+					different.push_back(remaining[i]);
+					continue;
+				}
+				if (equivalent.empty()) {
+					collectCallees(leader, true, callees[leader]);
+					equivalent.push_back(leader);
+				}
+				collectCallees(leader, false, callees[remaining[i]]);
+				equivalent.push_back(remaining[i]);
+			}
+			if (!equivalent.empty())
+				classes.push_back(std::move(equivalent));
+			remaining.swap(different);
+		}
+	}
+
+	// Third, refine the classes until all the functions in a class call
+	// functions of the same class. This finds the largest set of equivalent
+	// functions, including recursive cycles of them.
+	std::unordered_map<const Function*, uint32_t> functionClass;
+	auto assignClasses = [&]() {
+		functionClass.clear();
+		for (uint32_t i = 0; i < classes.size(); i++) {
+			for (const Function* F : classes[i])
+				functionClass[F] = i;
+		}
+	};
+	assignClasses();
+	// Functions which are not in any class are only equivalent to themselves
+	typedef std::vector<std::pair<uint32_t, const Function*>> CalleeSignature;
+	auto getSignature = [&](const Function* F) {
+		CalleeSignature signature;
+		for (const Function* callee : callees[F]) {
+			auto it = functionClass.find(callee);
+			if (it != functionClass.end())
+				signature.emplace_back(it->second + 1, nullptr);
+			else
+				signature.emplace_back(0, callee);
+		}
+		return signature;
+	};
+	auto countFoldable = [&](uint32_t& functions, uint32_t& instructions) {
+		functions = 0;
+		instructions = 0;
+		for (const auto& c : classes) {
+			functions += c.size() - 1;
+			for (unsigned i = 1; i < c.size(); i++)
+				instructions += c[i]->getInstructionCount();
+		}
+	};
+	for (uint32_t iteration = 0;; iteration++) {
+		uint32_t foldableFunctions, foldableInstructions;
+		countFoldable(foldableFunctions, foldableInstructions);
+		LLVM_DEBUG(dbgs() << "ICF iteration " << iteration << ": " << classes.size() << " classes, " <<
+			foldableFunctions << " foldable functions, " << foldableInstructions << " foldable instructions\n");
+		(void)foldableFunctions;
+		(void)foldableInstructions;
+
+		bool changed = false;
+		std::vector<std::vector<Function*>> refined;
+		for (const auto& c : classes) {
+			std::map<CalleeSignature, uint32_t> groups;
+			std::vector<std::vector<Function*>> split;
+			for (Function* F : c) {
+				auto it = groups.insert({getSignature(F), split.size()});
+				if (it.second)
+					split.emplace_back();
+				split[it.first->second].push_back(F);
+			}
+			changed |= split.size() > 1;
+			for (auto& s : split) {
+				if (s.size() > 1)
+					refined.push_back(std::move(s));
+			}
+		}
+		classes.swap(refined);
+		assignClasses();
+		if (!changed)
+			break;
+	}
 
-		LLVM_DEBUG(dbgs() << "group(" << functions.size() << "):");
+	// The module is about to change, the pointer kinds are not valid anymore
+	PA.reset();
+
+	// Finally, fold every class into a single function. Functions with
+	// external linkage can't be removed, use one of them as the replacement.
+	uint32_t foldedFunctions, foldedInstructions;
+	countFoldable(foldedFunctions, foldedInstructions);
+	for (const auto& c : classes) {
+		Function* replacement = c[0];
+		for (Function* F : c) {
+			if (F->getLinkage() == llvm::GlobalValue::ExternalLinkage) {
+				replacement = F;
+				break;
+			}
+		}
+
+		LLVM_DEBUG(dbgs() << "class(" << c.size() << "):");
 		LLVM_DEBUG(
-			for (auto& function: functions)
+			for (auto& function: c)
 			{
 				dbgs() << " " << function->getName();
 			}
 		);
 		LLVM_DEBUG(dbgs() << "\n");
 
-		std::unordered_map<Function*, Function*> fold;
-		std::vector<std::pair<Function*, Function*>> foldOrder;
-
-		for (unsigned i = 0; i < functions.size(); i++) {
-			assert(!fold.count(functions[i]));
-
+		for (Function* F : c) {
 			//TODO: even certain external name are foldable, taking care of recreating the right functions in the Writer
-			if (functions[i]->getLinkage() == llvm::GlobalValue::ExternalLinkage)
-				continue;
-
-			for (unsigned j = 0; j < functions.size(); j++) {
-				if (i == j || fold.count(functions[j]))
-					continue;
-
-				visitedPhis.clear();
-
-				auto key = make_pair(functions[i], functions[j]);
-				bool equivalent = false;
-				auto found = functionEquivalence.find(key);
-				if (found == functionEquivalence.end()) {
-					equivalent = equivalentFunction(functions[i], functions[j]);
-					functionEquivalence[key] = equivalent;
-				} else {
-					equivalent = found->second;
-				}
-
-#if DEBUG_VERBOSE
-				llvm::errs() << "function equivalent: " << equivalent << "\n";
-#endif
-
-				if (equivalent) {
-					fold.insert({functions[i], functions[j]});
-					foldOrder.push_back({functions[i], functions[j]});
-					break;
+			if (F == replacement || F->getLinkage() == llvm::GlobalValue::ExternalLinkage) {
+				if (F != replacement) {
+					foldedFunctions--;
+					foldedInstructions -= F->getInstructionCount();
 				}
-			}
-		}
-
-		LLVM_DEBUG(dbgs() << "fold " << foldOrder.size() << " of " << functions.size() << '\n');
-		assert(foldOrder.size() < functions.size());
-
-		for (auto item : foldOrder) {
-			// Replace all equivalent functions with the same replacement.
-			Function* replacement = item.second;
-			for (;;) {
-				auto it = fold.find(replacement);
-				if (it == fold.end())
-					break;
-				replacement = it->second;
+				continue;
 			}
 
-			mergeTwoFunctions(item.first, replacement);
+			mergeTwoFunctions(F, replacement);
 
 			//TODO: move external name to metadata and it becames again possible to set _icf
 			if (!replacement->getName().endswith("_icf") && (replacement->getLinkage() != llvm::GlobalValue::ExternalLinkage))
@@ -879,13 +1047,18 @@ bool IdenticalCodeFolding::runOnModule(llvm::Module& module)
 				replacement->setName(replacement->getName() + "_icf");
 			}
 
-			if (GDA.asmJSExports().find(item.first) != GDA.asmJSExports().end())
+			if (GDA.asmJSExports().find(F) != GDA.asmJSExports().end())
 				GDA.insertAsmJSExport(replacement);
 
-			GDA.eraseFunction(item.first);
-			delete item.first;
+			GDA.eraseFunction(F);
+			delete F;
 		}
 	}
+	NumFoldedFunctions += foldedFunctions;
+	NumFoldedInstructions += foldedInstructions;
+
+	if (CheerpICFNearMiss)
+		mergeNearMissFunctions(module, GDA);
 
 	return true;
 }
@@ -936,6 +1109,323 @@ void IdenticalCodeFolding::mergeTwoFunctions(Function *F, Function *G) {
 	F->removeFromParent();
 }
 
+bool IdenticalCodeFolding::isParameterizable(const Instruction* I, unsigned operand)
+{
+	const Constant* C = cast<Constant>(I->getOperand(operand));
+	// Only values which are plain i32 in wasm/asmjs
+	if (!C->getType()->isIntegerTy(32) && !C->getType()->isPointerTy())
+		return false;
+	if (C->getType()->isPointerTy() && !isa<GlobalValue>(C) && !isa<ConstantExpr>(C) && !isa<ConstantPointerNull>(C))
+		return false;
+	// Intrinsics may require immediate arguments
+	if (isa<IntrinsicInst>(I))
+		return false;
+	if (const CallInst* ci = dyn_cast<CallInst>(I))
+		return &ci->getOperandUse(operand) != &ci->getCalledOperandUse();
+	if (isa<SwitchInst>(I))
+		return operand == 0;
+	// Lane indexes are encoded as immediates by the wasm writer
+	if (isa<ExtractElementInst>(I))
+		return operand == 0;
+	if (isa<InsertElementInst>(I))
+		return operand != 2;
+	// A variable size would turn a static alloca into a dynamic one
+	if (isa<AllocaInst>(I))
+		return false;
+	if (const GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(I)) {
+		if (operand == 0)
+			return true;
+		// Struct indices must be constant
+		gep_type_iterator GTI = gep_type_begin(gep);
+		std::advance(GTI, operand - 1);
+		return !GTI.isStruct();
+	}
+	return true;
+}
+
+bool IdenticalCodeFolding::nearMissFunction(Function* A, Function* B, ConstantDiffs& diffs)
+{
+	if (A->getFunctionType() != B->getFunctionType() || A->size() != B->size())
+		return false;
+
+	// Map the values of A to the values in the same position in B
+	DenseMap<const Value*, const Value*> valueMap;
+	for (auto a = A->arg_begin(), b = B->arg_begin(); a != A->arg_end(); ++a, ++b)
+		valueMap[&*a] = &*b;
+	for (auto BBA = A->begin(), BBB = B->begin(); BBA != A->end(); ++BBA, ++BBB) {
+		if (BBA->size() != BBB->size())
+			return false;
+		valueMap[&*BBA] = &*BBB;
+		for (auto IA = BBA->begin(), IB = BBB->begin(); IA != BBA->end(); ++IA, ++IB)
+			valueMap[&*IA] = &*IB;
+	}
+
+	for (auto BBA = A->begin(), BBB = B->begin(); BBA != A->end(); ++BBA, ++BBB) {
+		for (auto IA = BBA->begin(), IB = BBB->begin(); IA != BBA->end(); ++IA, ++IB) {
+			if (!IA->isSameOperationAs(&*IB))
+				return false;
+			if (const PHINode* phi = dyn_cast<PHINode>(&*IA)) {
+				for (unsigned i = 0; i < phi->getNumIncomingValues(); i++) {
+					if (valueMap[phi->getIncomingBlock(i)] != cast<PHINode>(&*IB)->getIncomingBlock(i))
+						return false;
+				}
+			}
+			for (unsigned i = 0; i < IA->getNumOperands(); i++) {
+				const Value* opA = IA->getOperand(i);
+				const Value* opB = IB->getOperand(i);
+				if (opA == opB)
+					continue;
+				auto it = valueMap.find(opA);
+				if (it != valueMap.end()) {
+					if (it->second != opB)
+						return false;
+					continue;
+				}
+				if (!isa<Constant>(opA) || !isa<Constant>(opB) || !isParameterizable(&*IA, i))
+					return false;
+				diffs.push_back({&*IA, i, cast<Constant>(const_cast<Value*>(opB))});
+				if (diffs.size() > MaxNearMissParams)
+					return false;
+			}
+		}
+	}
+	return true;
+}
+
+uint32_t IdenticalCodeFolding::estimateConstantSize(const Constant* C)
+{
+	// The opcode of the const, then a LEB128 immediate. Addresses are not
+	// known yet, assume they need 3 bytes.
+	if (const ConstantInt* ci = dyn_cast<ConstantInt>(C))
+		return 1 + getSLEB128Size(ci->getSExtValue());
+	return 4;
+}
+
+uint32_t IdenticalCodeFolding::estimateFunctionSize(const Function& F)
+{
+	// The size of the body, the entry in the function section and the
+	// locals declaration
+	uint32_t size = NearMissFunctionOverhead;
+	for (const BasicBlock& BB : F) {
+		for (const Instruction& I : BB) {
+			size++;
+			if (isa<LoadInst>(I) || isa<StoreInst>(I))
+				size += 2;
+			for (const Value* op : I.operand_values()) {
+				if (isa<BasicBlock>(op) || isa<Function>(op))
+					continue;
+				// Other values are rendered with a local.get, or inline
+				size += isa<Constant>(op) ? estimateConstantSize(cast<Constant>(op)) : 2;
+			}
+		}
+	}
+	return size;
+}
+
+bool IdenticalCodeFolding::mergeNearMissFunctions(Module& module, GlobalDepsAnalyzer& GDA)
+{
+	// Group the functions by their shape, ignoring the constants
+	std::unordered_map<uint64_t, std::vector<Function*>> shapes;
+	std::vector<uint64_t> shapeOrder;
+	for (Function& F : module.getFunctionList()) {
+		if (F.isDeclaration() || F.getSection() != StringRef("asmjs") || F.isVarArg())
+			continue;
+		if (F.getName() == "malloc" || F.getName() == "calloc" ||
+			F.getName() == "realloc" || F.getName() == "free" ||
+			F.getName() == wasmNullptrName) {
+			continue;
+		}
+		HashAccumulator64 hash;
+		hash.add((uintptr_t)F.getFunctionType());
+		for (const BasicBlock& BB : F) {
+			hash.add(45798);
+			for (const Instruction& I : BB) {
+				hash.add(I.getOpcode());
+				hash.add((uintptr_t)I.getType());
+			}
+		}
+		auto it = shapes.insert({hash.getHash(), {}});
+		if (it.second)
+			shapeOrder.push_back(hash.getHash());
+		it.first->second.push_back(&F);
+	}
+
+	bool changed = false;
+	for (uint64_t shape : shapeOrder) {
+		std::vector<Function*> remaining = shapes[shape];
+		while (remaining.size() > 1) {
+			Function* leader = remaining[0];
+			// The constants of the leader which are passed as parameters
+			std::vector<std::pair<Instruction*, unsigned>> params;
+			std::vector<std::pair<Function*, ConstantDiffs>> members;
+			std::vector<Function*> different;
+			members.push_back({leader, {}});
+			for (unsigned i = 1; i < remaining.size(); i++) {
+				ConstantDiffs diffs;
+				if (!nearMissFunction(leader, remaining[i], diffs)) {
+					different.push_back(remaining[i]);
+					continue;
+				}
+				// Identical functions are left to the exact folding
+				if (diffs.empty()) {
+					different.push_back(remaining[i]);
+					continue;
+				}
+				auto newParams = params;
+				for (const ConstantDiff& d : diffs) {
+					if (std::find(newParams.begin(), newParams.end(), std::make_pair(d.inst, d.operand)) == newParams.end())
+						newParams.push_back({d.inst, d.operand});
+				}
+				if (newParams.size() > MaxNearMissParams) {
+					different.push_back(remaining[i]);
+					continue;
+				}
+				params.swap(newParams);
+				members.push_back({remaining[i], std::move(diffs)});
+			}
+			if (members.size() > 1)
+				changed |= mergeNearMissGroup(leader, params, members, GDA);
+			remaining.swap(different);
+		}
+	}
+	return changed;
+}
+
+bool IdenticalCodeFolding::mergeNearMissGroup(Function* leader, const std::vector<std::pair<Instruction*, unsigned>>& params,
+		const std::vector<std::pair<Function*, ConstantDiffs>>& members, GlobalDepsAnalyzer& GDA)
+{
+	// The extra arguments passed to the merged function on behalf of each member
+	std::vector<SmallVector<Value*, 4>> memberArgs;
+	for (const auto& m : members) {
+		SmallVector<Value*, 4> args;
+		for (const auto& p : params)
+			args.push_back(p.first->getOperand(p.second));
+		for (const ConstantDiff& d : m.second) {
+			auto it = std::find(params.begin(), params.end(), std::make_pair(d.inst, d.operand));
+			args[it - params.begin()] = d.value;
+		}
+		memberArgs.push_back(std::move(args));
+	}
+
+	// Direct calls from wasm/asmjs are rewritten, every other use goes
+	// through a thunk that keeps the original signature
+	auto isRewritableCall = [](const Use& U) {
+		const CallInst* ci = dyn_cast<CallInst>(U.getUser());
+		return ci && ci->isCallee(&U) && ci->getParent()->getParent()->getSection() == StringRef("asmjs");
+	};
+	auto needsThunk = [&](const Function* F) {
+		if (F->getLinkage() == GlobalValue::ExternalLinkage || GDA.asmJSExports().count(F))
+			return true;
+		for (const Use& U : F->uses()) {
+			if (!isRewritableCall(U))
+				return true;
+		}
+		return false;
+	};
+
+	// Estimate the wasm size before and after merging. Every call pays for
+	// the extra constants, and every thunk for a whole function that pushes
+	// all the parameters and calls the merged body.
+	uint32_t before = 0;
+	uint32_t after = estimateFunctionSize(*leader);
+	for (const auto& p : params)
+		after = after + 2 - estimateConstantSize(cast<Constant>(p.first->getOperand(p.second)));
+	for (unsigned i = 0; i < members.size(); i++) {
+		Function* F = members[i].first;
+		before += estimateFunctionSize(*F);
+		uint32_t argsSize = 0;
+		for (Value* v : memberArgs[i])
+			argsSize += estimateConstantSize(cast<Constant>(v));
+		if (needsThunk(F))
+			after += NearMissFunctionOverhead + 2 * F->arg_size() + argsSize + 2;
+		for (const Use& U : F->uses()) {
+			if (isRewritableCall(U))
+				after += argsSize;
+		}
+	}
+	LLVM_DEBUG(dbgs() << "near miss group of " << leader->getName() << ": " << members.size() << " functions, " <<
+		params.size() << " parameters, estimated size " << before << " -> " << after << '\n');
+	if (after >= before)
+		return false;
+
+	// Build the merged function, moving the body of the leader into it
+	FunctionType* leaderType = leader->getFunctionType();
+	SmallVector<Type*, 8> paramTypes(leaderType->param_begin(), leaderType->param_end());
+	for (const auto& p : params)
+		paramTypes.push_back(p.first->getOperand(p.second)->getType());
+	FunctionType* mergedType = FunctionType::get(leaderType->getReturnType(), paramTypes, false);
+	Function* merged = Function::Create(mergedType, GlobalValue::InternalLinkage, leader->getName() + "_merged", leader->getParent());
+	merged->copyAttributesFrom(leader);
+	merged->setLinkage(GlobalValue::InternalLinkage);
+	merged->getBasicBlockList().splice(merged->begin(), leader->getBasicBlockList());
+	auto mergedArg = merged->arg_begin();
+	for (Argument& arg : leader->args()) {
+		mergedArg->takeName(&arg);
+		arg.replaceAllUsesWith(&*mergedArg);
+		++mergedArg;
+	}
+	for (const auto& p : params) {
+		mergedArg->setName("icf.const");
+		p.first->setOperand(p.second, &*mergedArg);
+		++mergedArg;
+	}
+	GDA.insertFunction(merged, true);
+
+	// The bodies of the other members are not needed anymore. The leader's
+	// body is already gone.
+	SmallVector<GlobalValue::LinkageTypes, 4> linkages;
+	for (const auto& m : members) {
+		linkages.push_back(m.first->getLinkage());
+		if (m.first != leader)
+			m.first->deleteBody();
+	}
+
+	for (unsigned i = 0; i < members.size(); i++) {
+		Function* F = members[i].first;
+		F->setLinkage(linkages[i]);
+		SmallVector<CallInst*, 8> calls;
+		for (Use& U : F->uses()) {
+			if (isRewritableCall(U))
+				calls.push_back(cast<CallInst>(U.getUser()));
+		}
+		for (CallInst* ci : calls) {
+			SmallVector<Value*, 8> args(ci->arg_begin(), ci->arg_end());
+			args.append(memberArgs[i].begin(), memberArgs[i].end());
+			CallInst* newCall = CallInst::Create(merged, args, "", ci);
+			newCall->setAttributes(ci->getAttributes());
+			newCall->setCallingConv(ci->getCallingConv());
+			newCall->setTailCallKind(ci->getTailCallKind());
+			newCall->setDebugLoc(ci->getDebugLoc());
+			newCall->takeName(ci);
+			ci->replaceAllUsesWith(newCall);
+			ci->eraseFromParent();
+		}
+
+		if (F->use_empty() && F->getLinkage() != GlobalValue::ExternalLinkage && !GDA.asmJSExports().count(F)) {
+			LLVM_DEBUG(dbgs() << "merge " << F->getName() << " into " << merged->getName() << '\n');
+			GDA.eraseFunction(F);
+			F->eraseFromParent();
+			continue;
+		}
+
+		LLVM_DEBUG(dbgs() << "thunk " << F->getName() << " to " << merged->getName() << '\n');
+		BasicBlock* entry = BasicBlock::Create(F->getContext(), "entry", F);
+		IRBuilder<> Builder(entry);
+		SmallVector<Value*, 8> args;
+		for (Argument& arg : F->args())
+			args.push_back(&arg);
+		args.append(memberArgs[i].begin(), memberArgs[i].end());
+		CallInst* call = Builder.CreateCall(merged, args);
+		if (F->getReturnType()->isVoidTy())
+			Builder.CreateRetVoid();
+		else
+			Builder.CreateRet(call);
+	}
+
+	NumNearMissMerged += members.size();
+	return true;
+}
+
 }
 
 using namespace cheerp;
@@ -0,0 +1,135 @@
+//===-- InstrProfLowering.cpp - Cheerp optimization pass --------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpInstrProfLowering"
+#include "llvm/Cheerp/InstrProfLowering.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+STATISTIC(NumCountersLowered, "Number of profile counter increments lowered");
+STATISTIC(NumValueProfilesRemoved, "Number of value profiling sites removed");
+
+namespace llvm {
+
+GlobalVariable* InstrProfLowering::getCounters(Module& M, InstrProfIncrementInst* Inc)
+{
+	GlobalVariable* nameVar = Inc->getName();
+	auto it = counters.find(nameVar->getName());
+	if (it != counters.end())
+		return it->second;
+
+	StringRef name = nameVar->getName();
+	name.consume_front("__profn_");
+	uint64_t numCounters = Inc->getNumCounters()->getZExtValue();
+	Type* Int32Ty = IntegerType::get(M.getContext(), 32);
+	ArrayType* countersTy = ArrayType::get(Int32Ty, numCounters);
+	GlobalVariable* GV = new GlobalVariable(M, countersTy, /*isConstant*/false, GlobalValue::InternalLinkage,
+		ConstantAggregateZero::get(countersTy), Twine("__profc_") + name);
+
+	// The name used by the profile is the content of the name variable
+	const ConstantDataArray* nameData = cast<ConstantDataArray>(nameVar->getInitializer());
+	Metadata* fields[] = {
+		ValueAsMetadata::get(GV),
+		MDString::get(M.getContext(), nameData->getAsString()),
+		ValueAsMetadata::get(Inc->getHash())
+	};
+	M.getOrInsertNamedMetadata("cheerp.instrprof")->addOperand(MDNode::get(M.getContext(), fields));
+	counters.insert(std::make_pair(nameVar->getName(), GV));
+	return GV;
+}
+
+void InstrProfLowering::lowerIncrement(InstrProfIncrementInst* Inc)
+{
+	Module& M = *Inc->getModule();
+	GlobalVariable* GV = getCounters(M, Inc);
+	IRBuilder<> Builder(Inc);
+	Type* Int32Ty = Builder.getInt32Ty();
+	Value* Indexes[] = { Builder.getInt32(0), Builder.getInt32(Inc->getIndex()->getZExtValue()) };
+	Value* Addr = Builder.CreateInBoundsGEP(GV->getValueType(), GV, Indexes);
+	Value* Step = Builder.getInt32(1);
+	if (InstrProfIncrementInstStep* IncStep = dyn_cast<InstrProfIncrementInstStep>(Inc))
+		Step = Builder.CreateTrunc(IncStep->getStep(), Int32Ty);
+	Value* Count = Builder.CreateLoad(Int32Ty, Addr);
+	Builder.CreateStore(Builder.CreateAdd(Count, Step), Addr);
+	Inc->eraseFromParent();
+	NumCountersLowered++;
+}
+
+bool InstrProfLowering::runOnModule(Module& M)
+{
+	counters.clear();
+	std::vector<InstrProfIncrementInst*> increments;
+	std::vector<InstrProfValueProfileInst*> valueProfiles;
+	// The counters are shared by all the copies of an inlined function, they
+	// are in linear memory if any of them is in an asmjs function
+	StringSet<> asmJSNames;
+	for (Function& F: M)
+	{
+		bool asmjs = F.getSection() == StringRef("asmjs");
+		for (Instruction& I: instructions(F))
+		{
+			if (InstrProfIncrementInst* Inc = dyn_cast<InstrProfIncrementInst>(&I))
+			{
+				increments.push_back(Inc);
+				if (asmjs)
+					asmJSNames.insert(Inc->getName()->getName());
+			}
+			else if (InstrProfValueProfileInst* VP = dyn_cast<InstrProfValueProfileInst>(&I))
+				valueProfiles.push_back(VP);
+		}
+	}
+
+	for (InstrProfValueProfileInst* VP: valueProfiles)
+	{
+		VP->eraseFromParent();
+		NumValueProfilesRemoved++;
+	}
+	// The version variable of the IR level instrumentation is not used by
+	// anything and is removed before the writer runs, remember it here
+	if (!increments.empty() && M.getNamedGlobal("__llvm_profile_raw_version"))
+		M.getOrInsertNamedMetadata("cheerp.instrprof.ir")->addOperand(MDNode::get(M.getContext(), {}));
+	for (InstrProfIncrementInst* Inc: increments)
+	{
+		bool asmjs = asmJSNames.count(Inc->getName()->getName());
+		GlobalVariable* GV = getCounters(M, Inc);
+		if (asmjs)
+			GV->setSection("asmjs");
+		lowerIncrement(Inc);
+	}
+	return !increments.empty() || !valueProfiles.empty();
+}
+
+StringRef InstrProfLowering::getPassName() const
+{
+	return "InstrProfLowering";
+}
+
+char InstrProfLowering::ID = 0;
+
+void InstrProfLowering::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	llvm::Pass::getAnalysisUsage(AU);
+}
+
+ModulePass *createInstrProfLoweringPass() { return new InstrProfLowering(); }
+
+}
+
+using namespace llvm;
+INITIALIZE_PASS_BEGIN(InstrProfLowering, "InstrProfLowering",
+        "Lower profile counters to linear memory or typed arrays", false, false)
+INITIALIZE_PASS_END(InstrProfLowering, "InstrProfLowering",
+        "Lower profile counters to linear memory or typed arrays", false, false)
@@ -11,6 +11,7 @@
 
 #include "llvm/Cheerp/CommandLine.h"
 #include "llvm/Cheerp/LinearMemoryHelper.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Module.h"
@@ -19,23 +20,42 @@
 using namespace cheerp;
 using namespace llvm;
 
+void LinearMemoryHelper::ByteListener::addZeros(uint32_t count)
+{
+	uint8_t zeros[256];
+	memset(zeros, 0, std::min<uint32_t>(count, sizeof(zeros)));
+	while(count)
+	{
+		uint32_t chunk = std::min<uint32_t>(count, sizeof(zeros));
+		addBytes(ArrayRef<uint8_t>(zeros, chunk));
+		count -= chunk;
+	}
+}
+
 void LinearMemoryHelper::compileConstantAsBytes(const Constant* c, bool asmjs, ByteListener* listener, int32_t offset) const
 {
 	const auto& targetData = module->getDataLayout();
 	if(const ConstantDataSequential* CD = dyn_cast<ConstantDataSequential>(c))
 	{
 		assert(offset==0);
-		for(uint32_t i=0;i<CD->getNumElements();i++)
-			compileConstantAsBytes(CD->getElementAsConstant(i), asmjs, listener);
+		// The raw data is stored in host order, and the elements have no padding
+		if(sys::IsLittleEndianHost && targetData.isLittleEndian())
+		{
+			StringRef raw = CD->getRawDataValues();
+			listener->addBytes(ArrayRef<uint8_t>(reinterpret_cast<const uint8_t*>(raw.data()), raw.size()));
+		}
+		else
+		{
+			for(uint32_t i=0;i<CD->getNumElements();i++)
+				compileConstantAsBytes(CD->getElementAsConstant(i), asmjs, listener);
+		}
 	}
 	else if(const UndefValue* U = dyn_cast<UndefValue>(c))
 	{
 		assert(offset==0);
-		uint32_t size = targetData.getTypeAllocSize(U->getType());
-		for (uint32_t i = 0; i < size; i++)
-			listener->addByte(0);
+		listener->addZeros(targetData.getTypeAllocSize(U->getType()));
 	}
-	else if(isa<ConstantArray>(c))
+	else if(isa<ConstantArray>(c) || isa<ConstantVector>(c))
 	{
 		assert(offset==0);
 		for(uint32_t i=0;i<c->getNumOperands();i++)
@@ -52,8 +72,7 @@ void LinearMemoryHelper::compileConstantAsBytes(const Constant* c, bool asmjs, B
 			int64_t elementOffset =  SL->getElementOffset(i);
 			Type* elementType =  ST->getElementType(i);
 			int64_t elementSize = targetData.getTypeAllocSize(elementType);
-			for (int64_t p = currentOffset; p < elementOffset; ++p)
-				listener->addByte(0);
+			listener->addZeros(elementOffset - currentOffset);
 			currentOffset = elementOffset + elementSize;
 			compileConstantAsBytes(cast<Constant>(c->getOperand(i)), asmjs, listener);
 		}
@@ -81,9 +100,7 @@ void LinearMemoryHelper::compileConstantAsBytes(const Constant* c, bool asmjs, B
 		if(const ConstantAggregateZero* Z = dyn_cast<ConstantAggregateZero>(c))
 		{
 			assert(offset==0);
-			uint32_t size = targetData.getTypeAllocSize(Z->getType());
-			for (uint32_t i = 0; i < size; i++)
-				listener->addByte(0);
+			listener->addZeros(targetData.getTypeAllocSize(Z->getType()));
 		}
 		else if(dyn_cast<ConstantPointerNull>(c))
 		{
@@ -373,6 +390,89 @@ bool LinearMemoryHelper::hasNonZeroInitialiser(const GlobalVariable* G) const
 	return !isZeroInitializer(init);
 }
 
+bool LinearMemoryHelper::isRelocationFree(const Constant* c)
+{
+	if (isa<ConstantData>(c))
+		return true;
+	if (!isa<ConstantAggregate>(c))
+		return false;
+	for (const Use& op: c->operands())
+	{
+		if (!isRelocationFree(cast<Constant>(op)))
+			return false;
+	}
+	return true;
+}
+
+uint32_t LinearMemoryHelper::getGlobalAlignment(const GlobalVariable* G) const
+{
+	const auto& targetData = module->getDataLayout();
+	return std::max(TypeSupport::getAlignmentAsmJS(targetData, G->getValueType()), G->getAlignment());
+}
+
+void LinearMemoryHelper::shareReadOnlyGlobals(SharedGlobalsMap& sharedGlobals) const
+{
+	struct StringBytesWriter: public ByteListener
+	{
+		std::string& buf;
+		StringBytesWriter(std::string& buf): buf(buf)
+		{
+		}
+		void addByte(uint8_t b) override
+		{
+			buf.push_back(b);
+		}
+		void addBytes(ArrayRef<uint8_t> bytes) override
+		{
+			buf.append(bytes.begin(), bytes.end());
+		}
+	};
+	const auto& targetData = module->getDataLayout();
+	// Only globals whose address is not significant can share their storage,
+	// and only if the bytes do not depend on the addresses being computed.
+	// Globals are visited in layout order, so the first global with some
+	// contents has the biggest alignment and owns the storage.
+	std::map<std::pair<uint32_t, std::string>, const GlobalVariable*> owners;
+	std::vector<std::pair<std::string, const GlobalVariable*>> strings;
+	for (const GlobalVariable* G: asmjsGlobals)
+	{
+		if (!G->isConstant() || !G->hasGlobalUnnamedAddr() || !hasNonZeroInitialiser(G))
+			continue;
+		if (globalizedGlobalsUsage.count(G) || !isRelocationFree(G->getInitializer()))
+			continue;
+		std::string bytes;
+		StringBytesWriter bytesWriter(bytes);
+		compileConstantAsBytes(G->getInitializer(), /*asmjs*/true, &bytesWriter);
+		uint32_t size = targetData.getTypeAllocSize(G->getValueType());
+		auto it = owners.insert(std::make_pair(std::make_pair(size, bytes), G)).first;
+		if (it->second != G)
+		{
+			sharedGlobals.insert(std::make_pair(G, std::make_pair(it->second, 0u)));
+			continue;
+		}
+		// C strings can also be placed at the end of a longer one
+		const ConstantDataArray* CDA = dyn_cast<ConstantDataArray>(G->getInitializer());
+		if (CDA && CDA->isCString() && getGlobalAlignment(G) == 1)
+			strings.emplace_back(std::string(bytes.rbegin(), bytes.rend()), G);
+	}
+	// In descending order of the reversed contents each string is preceded by
+	// the longer strings ending with it
+	std::sort(strings.begin(), strings.end(), std::greater<std::pair<std::string, const GlobalVariable*>>());
+	const std::string* ownerBytes = nullptr;
+	const GlobalVariable* owner = nullptr;
+	for (const auto& s: strings)
+	{
+		if (owner && StringRef(*ownerBytes).startswith(s.first))
+		{
+			uint32_t offset = ownerBytes->size() - s.first.size();
+			sharedGlobals.insert(std::make_pair(s.second, std::make_pair(owner, offset)));
+			continue;
+		}
+		ownerBytes = &s.first;
+		owner = s.second;
+	}
+}
+
 void LinearMemoryHelper::addGlobals()
 {
 	generateGlobalizedGlobalsUsage();
@@ -390,38 +490,49 @@ void LinearMemoryHelper::addGlobals()
 	}
 
 	std::sort(asmjsGlobals.begin(), asmjsGlobals.end(),
-		[targetData,this] (const GlobalVariable* a, const GlobalVariable* b) {
+		[this] (const GlobalVariable* a, const GlobalVariable* b) {
 			// Encode zero-initialized globals after all the others
 			uint32_t nonZeroInitializedA = hasNonZeroInitialiser(a);
 			uint32_t nonZeroInitializedB = hasNonZeroInitialiser(b);
 			if(nonZeroInitializedA != nonZeroInitializedB)
 				return nonZeroInitializedA > nonZeroInitializedB;
-			Type* aTy = a->getType()->getPointerElementType();
-			Type* bTy = b->getType()->getPointerElementType();
-			uint32_t typeAlignA = TypeSupport::getAlignmentAsmJS(targetData, aTy);
-			uint32_t typeAlignB = TypeSupport::getAlignmentAsmJS(targetData, bTy);
-			uint32_t alignA = std::max(typeAlignA, a->getAlignment());
-			uint32_t alignB = std::max(typeAlignB, b->getAlignment());
 			// Bigger alignment should be stored before smaller alignment.
-			return alignA > alignB;
+			return getGlobalAlignment(a) > getGlobalAlignment(b);
 		}
 	);
 
+	// Read-only globals with the same bytes, or C strings which are the tail
+	// of a longer one, are stored only once
+	SharedGlobalsMap sharedGlobals;
+	shareReadOnlyGlobals(sharedGlobals);
+
 	// Compute the global variable addresses.
 	for (const auto G: asmjsGlobals) {
 		//Globalized globals do not need an address
-		if (globalizedGlobalsUsage.count(G))
+		if (globalizedGlobalsUsage.count(G) || sharedGlobals.count(G))
 			continue;
 		asmjsAddressableGlobals.push_back(G);
-		Type* ty = G->getType();
-		uint32_t size = targetData.getTypeAllocSize(ty->getPointerElementType());
+		uint32_t size = targetData.getTypeAllocSize(G->getValueType());
 		// Ensure the right alignment for the type
-		uint32_t alignment = std::max(TypeSupport::getAlignmentAsmJS(targetData, ty->getPointerElementType()), G->getAlignment());
+		uint32_t alignment = getGlobalAlignment(G);
 		// The following is correct if alignment is a power of 2 (which it should be)
 		heapStart = (heapStart + alignment - 1) & ~(alignment - 1);
 		globalAddresses.emplace(G, heapStart);
 		heapStart += size;
 	}
+	for (const auto& shared: sharedGlobals)
+	{
+		const GlobalVariable* owner = shared.second.first;
+		uint32_t offset = shared.second.second;
+		// The owner of a duplicate may itself be the tail of a longer string
+		auto it = sharedGlobals.find(owner);
+		if (it != sharedGlobals.end())
+		{
+			owner = it->second.first;
+			offset += it->second.second;
+		}
+		globalAddresses.emplace(shared.first, globalAddresses.at(owner) + offset);
+	}
 }
 
 void LinearMemoryHelper::generateGlobalizedGlobalsUsage()
@@ -429,6 +540,9 @@ void LinearMemoryHelper::generateGlobalizedGlobalsUsage()
 	// TODO: add globalizedGlobals in the JS writer
 	if (mode == FunctionAddressMode::AsmJS)
 		return;
+	// Wasm globals are local to each instance, they cannot be shared between threads
+	if (WasmSharedMemory)
+		return;
 	// Identify all globals which are only ever accessed with with load/store, we can promote those to globals
 	for (const GlobalVariable& GV: module->globals())
 	{
@@ -499,6 +613,25 @@ void LinearMemoryHelper::addFunctions()
 		}
 	);
 
+	// If profile data is available (i.e. -fprofile-instr-use), put the hot
+	// functions first and the ones never executed last. The order of the
+	// code section is also the order of the function ids and of the entries
+	// in each table, so hot functions get the shortest indices, and engines
+	// which compile lazily or while streaming get to the hot code sooner.
+	auto profileRank = [] (const Function* F) -> std::pair<uint32_t, uint64_t> {
+		Function::ProfileCount count = F->getEntryCount();
+		if (!count.hasValue())
+			return std::make_pair(1u, uint64_t(0));
+		if (count.getCount() == 0)
+			return std::make_pair(2u, uint64_t(0));
+		return std::make_pair(0u, ~count.getCount());
+	};
+	std::stable_sort(unsorted.begin(), unsorted.end(),
+		[&profileRank] (const Function* a, const Function* b) {
+			return profileRank(a) < profileRank(b);
+		}
+	);
+
 	for (auto F : unsorted)
 		asmjsFunctions_.push_back(F);
 
@@ -11,6 +11,7 @@
 
 #include "llvm/Transforms/Utils/LowerSwitch.h"
 #include "llvm/Cheerp/CFGPasses.h"
+#include "llvm/IR/MDBuilder.h"
 #include <unordered_map>
 #include <unordered_set>
 
@@ -704,6 +705,259 @@ private:
 	double costCalculated;
 };
 
+//Split the cases of a switch in dense clusters, each rendered as a br_table, and in sparse groups that are lowered later.
+//The clusters are selected like SelectionDAGBuilder does, and reached through a binary search tree balanced by the profile weights
+class ClusteredLowering
+{
+public:
+	ClusteredLowering(SwitchInst* SI)
+		: SI(SI), condition(SI->getCondition()), defaultDest(SI->getDefaultDest()), F(SI->getFunction()), Ctx(SI->getContext()),
+		bitWidth(SI->getCondition()->getType()->getIntegerBitWidth()), hasWeights(false)
+	{
+		collectCases();
+		findClusters();
+	}
+	//Lowering a switch in a single cluster of the same type would not make any progress
+	bool isProfitable() const
+	{
+		if (clusters.empty())
+			return false;
+		if (clusters.size() == 1)
+			return clusters.front().isJumpTable && bitWidth == 64;
+		for (const Cluster& c: clusters)
+		{
+			if (c.isJumpTable)
+				return true;
+		}
+		return false;
+	}
+	void lower()
+	{
+		assert(isProfitable());
+		BasicBlock* origBB = SI->getParent();
+		//Every edge to the destinations is moved to the new blocks, save the incoming values to be restored there
+		for (BasicBlock* BB : successors(origBB))
+		{
+			for (PHINode& phi : BB->phis())
+			{
+				int idx;
+				while ((idx = phi.getBasicBlockIndex(origBB)) >= 0)
+					outgoingValues[&phi] = phi.removeIncomingValue(idx, false);
+			}
+		}
+		SI->eraseFromParent();
+		newBlocks.push_back(origBB);
+		emitTree(origBB, clusters);
+		for (BasicBlock* BB : newBlocks)
+		{
+			for (BasicBlock* succ : successors(BB))
+			{
+				for (PHINode& phi : succ->phis())
+				{
+					auto it = outgoingValues.find(&phi);
+					if (it != outgoingValues.end())
+						phi.addIncoming(it->second, BB);
+				}
+			}
+		}
+	}
+private:
+	struct Case
+	{
+		int64_t value;
+		BasicBlock* dest;
+		uint64_t weight;
+		bool operator<(const Case& other) const
+		{
+			return value < other.value;
+		}
+	};
+	struct Cluster
+	{
+		uint32_t first;
+		uint32_t last;
+		bool isJumpTable;
+		uint64_t weight;
+	};
+	//NOTE: this number is the maximum allowed by V8 for wasm's br_table, it is not defined in the spec
+	static const uint64_t MaxJumpTableRange = 32 * 1024;
+	//The same defaults used by SelectionDAGBuilder when not optimizing for size
+	static const uint32_t MinJumpTableEntries = 4;
+	static const uint32_t JumpTableDensity = 10;
+	void collectCases()
+	{
+		//Without profile data every case is assumed to be equally likely
+		MDNode* prof = SI->getMetadata(LLVMContext::MD_prof);
+		hasWeights = prof && prof->getNumOperands() == SI->getNumSuccessors() + 1;
+		for (auto& c: SI->cases())
+		{
+			uint64_t weight = 1;
+			if (hasWeights)
+				weight = mdconst::extract<ConstantInt>(prof->getOperand(c.getSuccessorIndex() + 1))->getZExtValue();
+			cases.push_back({getCaseValue(c.getCaseValue(), bitWidth), c.getCaseSuccessor(), weight});
+		}
+		std::sort(cases.begin(), cases.end());
+	}
+	uint64_t getRange(uint32_t first, uint32_t last) const
+	{
+		return (uint64_t)cases[last].value - (uint64_t)cases[first].value;
+	}
+	bool isDense(uint32_t first, uint32_t last) const
+	{
+		uint64_t numCases = last - first + 1;
+		return numCases >= MinJumpTableEntries && numCases * 100 >= JumpTableDensity * (getRange(first, last) + 1);
+	}
+	void findClusters()
+	{
+		const uint32_t N = cases.size();
+		if (N < MinJumpTableEntries)
+			return;
+		//minPartitions[i] is the minimum number of clusters covering the cases from i to the end, lastCase[i] is the last
+		//case of the first of them
+		std::vector<uint32_t> minPartitions(N + 1, 0);
+		std::vector<uint32_t> lastCase(N);
+		for (uint32_t i = N; i-- > 0;)
+		{
+			minPartitions[i] = minPartitions[i + 1] + 1;
+			lastCase[i] = i;
+			for (uint32_t j = i + 1; j < N && getRange(i, j) <= MaxJumpTableRange; j++)
+			{
+				if (isDense(i, j) && minPartitions[j + 1] + 1 < minPartitions[i])
+				{
+					minPartitions[i] = minPartitions[j + 1] + 1;
+					lastCase[i] = j;
+				}
+			}
+		}
+		//Consecutive cases outside of the jump tables are grouped together
+		for (uint32_t i = 0; i < N; i = lastCase[i] + 1)
+		{
+			bool isJumpTable = lastCase[i] != i && hasEnoughDestinations(i, lastCase[i]);
+			if (!isJumpTable && !clusters.empty() && !clusters.back().isJumpTable)
+				clusters.back().last = lastCase[i];
+			else
+				clusters.push_back({i, lastCase[i], isJumpTable, 0});
+		}
+		for (Cluster& c: clusters)
+		{
+			for (uint32_t i = c.first; i <= c.last; i++)
+				c.weight += cases[i].weight;
+		}
+	}
+	//A br_table needs at least 3 successors to be kept
+	bool hasEnoughDestinations(uint32_t first, uint32_t last) const
+	{
+		for (uint32_t i = first + 1; i <= last; i++)
+		{
+			if (cases[i].dest != cases[first].dest)
+				return true;
+		}
+		return false;
+	}
+	BasicBlock* createBlock()
+	{
+		BasicBlock* BB = BasicBlock::Create(Ctx, "switchcluster", F);
+		newBlocks.push_back(BB);
+		return BB;
+	}
+	void emitTree(BasicBlock* BB, ArrayRef<Cluster> subClusters)
+	{
+		if (subClusters.size() == 1)
+		{
+			emitLeaf(BB, subClusters.front());
+			return;
+		}
+		//Pick the pivot which balances the weights on each side
+		uint64_t total = 0;
+		for (const Cluster& c: subClusters)
+			total += c.weight;
+		uint64_t left = 0;
+		uint32_t pivot = 1;
+		uint64_t bestDiff = std::numeric_limits<uint64_t>::max();
+		for (uint32_t i = 1; i < subClusters.size(); i++)
+		{
+			left += subClusters[i - 1].weight;
+			uint64_t right = total - left;
+			uint64_t diff = left > right ? left - right : right - left;
+			if (diff < bestDiff)
+			{
+				bestDiff = diff;
+				pivot = i;
+			}
+		}
+		uint64_t leftWeight = 0;
+		for (uint32_t i = 0; i < pivot; i++)
+			leftWeight += subClusters[i].weight;
+
+		BasicBlock* leftBB = createBlock();
+		BasicBlock* rightBB = createBlock();
+		//The cases are ordered as signed values if they are at least 32 bits wide, and as unsigned values otherwise
+		ICmpInst::Predicate pred = bitWidth >= 32 ? ICmpInst::ICMP_SLT : ICmpInst::ICMP_ULT;
+		ICmpInst* test = new ICmpInst(*BB, pred, condition, getConstantInt(cases[subClusters[pivot].first].value), "switchPivot");
+		BranchInst* branch = BranchInst::Create(leftBB, rightBB, test, BB);
+		if (hasWeights)
+			branch->setMetadata(LLVMContext::MD_prof, createBranchWeights(leftWeight, total - leftWeight));
+
+		emitTree(leftBB, subClusters.slice(0, pivot));
+		emitTree(rightBB, subClusters.slice(pivot));
+	}
+	void emitLeaf(BasicBlock* BB, const Cluster& c)
+	{
+		uint32_t numCases = c.last - c.first + 1;
+		if (!c.isJumpTable)
+		{
+			//The sparse cases are lowered when the new switch is visited
+			SwitchInst* sparse = SwitchInst::Create(condition, defaultDest, numCases, BB);
+			for (uint32_t i = c.first; i <= c.last; i++)
+				sparse->addCase(cast<ConstantInt>(getConstantInt(cases[i].value)), cases[i].dest);
+			return;
+		}
+		const int64_t low = cases[c.first].value;
+		Value* index = condition;
+		if (low != 0)
+			index = BinaryOperator::CreateAdd(condition, getConstantInt(-low), condition->getName()+".off", BB);
+		Type* Int32Ty = IntegerType::get(Ctx, 32);
+		if (bitWidth > 32)
+		{
+			//br_table only takes 32-bit indexes, the values out of the cluster must be excluded before truncating
+			BasicBlock* tableBB = createBlock();
+			ICmpInst* test = new ICmpInst(*BB, ICmpInst::ICMP_ULE, index, getConstantInt(getRange(c.first, c.last)), "switchClusterRange");
+			BranchInst::Create(tableBB, defaultDest, test, BB);
+			index = new TruncInst(index, Int32Ty, condition->getName()+".idx", tableBB);
+			BB = tableBB;
+		}
+		SwitchInst* table = SwitchInst::Create(index, defaultDest, numCases, BB);
+		for (uint32_t i = c.first; i <= c.last; i++)
+			table->addCase(ConstantInt::get(cast<IntegerType>(index->getType()), cases[i].value - low), cases[i].dest);
+	}
+	MDNode* createBranchWeights(uint64_t trueWeight, uint64_t falseWeight) const
+	{
+		//Branch weights are 32-bit
+		while (trueWeight > std::numeric_limits<uint32_t>::max() || falseWeight > std::numeric_limits<uint32_t>::max())
+		{
+			trueWeight >>= 1;
+			falseWeight >>= 1;
+		}
+		return MDBuilder(Ctx).createBranchWeights(trueWeight, falseWeight);
+	}
+	Constant* getConstantInt(const int64_t a)
+	{
+		return ConstantInt::get(condition->getType(), a);
+	}
+
+	SwitchInst* SI;
+	Value* condition;
+	BasicBlock* defaultDest;
+	Function* F;
+	LLVMContext& Ctx;
+	const uint32_t bitWidth;
+	bool hasWeights;
+	std::vector<Case> cases;
+	std::vector<Cluster> clusters;
+	std::vector<BasicBlock*> newBlocks;
+	std::unordered_map<PHINode*, Value*> outgoingValues;
+};
+
 void CheerpLowerSwitch::processSwitchInst(SwitchInst *SI, SmallPtrSetImpl<BasicBlock*> &DeleteList, AssumptionCache *AC, LazyValueInfo *LVI)
 {
 	DataOnSwitch data(SI);
@@ -714,6 +968,16 @@ void CheerpLowerSwitch::processSwitchInst(SwitchInst *SI, SmallPtrSetImpl<BasicB
 	if(!isConvenientToLower && keepSwitch(SI))
 		return;
 
+	if(!isConvenientToLower)
+	{
+		ClusteredLowering clustered(SI);
+		if (clustered.isProfitable())
+		{
+			clustered.lower();
+			return;
+		}
+	}
+
 	if (lowering.isValid())
 		lowering.lowerGreedily(data);
 	else
@@ -0,0 +1,374 @@
+//===-- MultiValueReturns.cpp - Cheerp optimization pass --------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpMultiValueReturns"
+#include "llvm/Cheerp/MultiValueReturns.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
+
+STATISTIC(NumFunctionsRewritten, "Number of functions returning multiple values instead of using sret");
+STATISTIC(NumSlotsPromoted, "Number of sret slots in callers promoted to registers");
+
+namespace llvm {
+
+bool MultiValueReturns::isScalarType(Type* t)
+{
+	if (t->isIntegerTy() || t->isFloatTy() || t->isDoubleTy())
+		return true;
+	if (t->isPointerTy())
+		return !cheerp::TypeSupport::isClientType(t->getPointerElementType()) && cheerp::TypeSupport::isRawPointer(t, /*asmjs*/true);
+	return false;
+}
+
+uint32_t MultiValueReturns::countLeaves(Type* t)
+{
+	if (StructType* st = dyn_cast<StructType>(t))
+	{
+		uint32_t count = 0;
+		for (Type* e: st->elements())
+			count += countLeaves(e);
+		return count;
+	}
+	else if (ArrayType* at = dyn_cast<ArrayType>(t))
+		return at->getNumElements() * countLeaves(at->getElementType());
+	return 1;
+}
+
+bool MultiValueReturns::flattenType(Type* t, SmallVectorImpl<Value*>& path, LeafVector& leaves)
+{
+	Type* Int32Ty = Type::getInt32Ty(t->getContext());
+	if (StructType* st = dyn_cast<StructType>(t))
+	{
+		if (st->isOpaque() || st->hasByteLayout())
+			return false;
+		for (uint32_t i = 0; i < st->getNumElements(); i++)
+		{
+			path.push_back(ConstantInt::get(Int32Ty, i));
+			bool ok = flattenType(st->getElementType(i), path, leaves);
+			path.pop_back();
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+	else if (ArrayType* at = dyn_cast<ArrayType>(t))
+	{
+		for (uint32_t i = 0; i < at->getNumElements(); i++)
+		{
+			path.push_back(ConstantInt::get(Int32Ty, i));
+			bool ok = flattenType(at->getElementType(), path, leaves);
+			path.pop_back();
+			if (!ok)
+				return false;
+		}
+		return true;
+	}
+	if (!isScalarType(t) || leaves.size() == MaxResults)
+		return false;
+	leaves.push_back(Leaf{t, SmallVector<Value*, 4>(path.begin(), path.end())});
+	return true;
+}
+
+bool MultiValueReturns::collectLeafAccesses(Value* ptr, Type* t, uint32_t firstLeaf, AccessVector& accesses, SmallVectorImpl<Instruction*>& toErase)
+{
+	for (User* U: ptr->users())
+	{
+		if (GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(U))
+		{
+			if (GEP->getPointerOperand() != ptr || !GEP->hasAllConstantIndices())
+				return false;
+			if (!cast<ConstantInt>(GEP->getOperand(1))->isZero())
+				return false;
+			// Find out the first leaf of the field reached by the GEP
+			Type* curType = t;
+			uint32_t leaf = firstLeaf;
+			for (uint32_t i = 2; i < GEP->getNumOperands(); i++)
+			{
+				uint64_t index = cast<ConstantInt>(GEP->getOperand(i))->getZExtValue();
+				if (StructType* st = dyn_cast<StructType>(curType))
+				{
+					if (index >= st->getNumElements())
+						return false;
+					for (uint32_t j = 0; j < index; j++)
+						leaf += countLeaves(st->getElementType(j));
+					curType = st->getElementType(index);
+				}
+				else if (ArrayType* at = dyn_cast<ArrayType>(curType))
+				{
+					if (index >= at->getNumElements())
+						return false;
+					leaf += index * countLeaves(at->getElementType());
+					curType = at->getElementType();
+				}
+				else
+					return false;
+			}
+			if (!collectLeafAccesses(GEP, curType, leaf, accesses, toErase))
+				return false;
+			toErase.push_back(GEP);
+		}
+		else if (LoadInst* LI = dyn_cast<LoadInst>(U))
+		{
+			if (!LI->isSimple() || LI->getType() != t || !isScalarType(t))
+				return false;
+			accesses.push_back(std::make_pair(LI, firstLeaf));
+		}
+		else if (StoreInst* SI = dyn_cast<StoreInst>(U))
+		{
+			if (!SI->isSimple() || SI->getPointerOperand() != ptr || SI->getValueOperand() == ptr)
+				return false;
+			if (SI->getValueOperand()->getType() != t || !isScalarType(t))
+				return false;
+			accesses.push_back(std::make_pair(SI, firstLeaf));
+		}
+		else if (BitCastInst* BC = dyn_cast<BitCastInst>(U))
+		{
+			// Only allow casts used by lifetime markers, they are dropped
+			for (User* BU: BC->users())
+			{
+				const IntrinsicInst* II = dyn_cast<IntrinsicInst>(BU);
+				if (!II || (II->getIntrinsicID() != Intrinsic::lifetime_start && II->getIntrinsicID() != Intrinsic::lifetime_end))
+					return false;
+				toErase.push_back(cast<Instruction>(BU));
+			}
+			toErase.push_back(BC);
+		}
+		else
+			return false;
+	}
+	return true;
+}
+
+bool MultiValueReturns::promoteLeaves(Function& F, Value* base, const LeafVector& leaves, SmallVectorImpl<AllocaInst*>& allocas)
+{
+	AccessVector accesses;
+	SmallVector<Instruction*, 8> toErase;
+	if (!collectLeafAccesses(base, base->getType()->getPointerElementType(), 0, accesses, toErase))
+		return false;
+	Instruction* insertPoint = &*F.getEntryBlock().getFirstInsertionPt();
+	for (const Leaf& leaf: leaves)
+		allocas.push_back(new AllocaInst(leaf.type, 0, "", insertPoint));
+	for (auto& access: accesses)
+	{
+		if (LoadInst* LI = dyn_cast<LoadInst>(access.first))
+			LI->setOperand(LI->getPointerOperandIndex(), allocas[access.second]);
+		else
+		{
+			StoreInst* SI = cast<StoreInst>(access.first);
+			SI->setOperand(SI->getPointerOperandIndex(), allocas[access.second]);
+		}
+	}
+	// Users have been collected before the values they use
+	for (Instruction* I: toErase)
+		I->eraseFromParent();
+	return true;
+}
+
+bool MultiValueReturns::isCandidate(const Function& F, const SmallPtrSetImpl<const Function*>& exported, LeafVector& leaves) const
+{
+	if (F.getSection() != StringRef("asmjs") || F.isDeclaration() || F.isVarArg())
+		return false;
+	if (!F.getReturnType()->isVoidTy() || F.arg_empty() || !F.hasParamAttribute(0, Attribute::StructRet))
+		return false;
+	// JS calls exported functions with the sret argument
+	if (exported.count(&F))
+		return false;
+	// The signature can only change if all the calls are known direct calls from wasm
+	if (F.hasAddressTaken())
+		return false;
+	for (const User* U: F.users())
+	{
+		const CallInst* CI = dyn_cast<CallInst>(U);
+		if (!CI || CI->getFunction()->getSection() != StringRef("asmjs"))
+			return false;
+	}
+	SmallVector<Value*, 4> path;
+	path.push_back(ConstantInt::get(Type::getInt32Ty(F.getContext()), 0));
+	const Argument* sret = &*F.arg_begin();
+	if (!flattenType(sret->getType()->getPointerElementType(), path, leaves) || leaves.size() < 2)
+		return false;
+	// Only rewrite the function if the fields can become registers
+	AccessVector accesses;
+	SmallVector<Instruction*, 8> toErase;
+	return collectLeafAccesses(const_cast<Argument*>(sret), sret->getType()->getPointerElementType(), 0, accesses, toErase);
+}
+
+void MultiValueReturns::rewriteFunction(Function* F, const LeafVector& leaves, SetVector<AllocaInst*>& callerSlots)
+{
+	LLVMContext& Ctx = F->getContext();
+	SmallVector<Type*, 4> resultTypes;
+	for (const Leaf& leaf: leaves)
+		resultTypes.push_back(leaf.type);
+	StructType* retTy = StructType::get(Ctx, resultTypes);
+	FunctionType* oldFTy = F->getFunctionType();
+	FunctionType* newFTy = FunctionType::get(retTy, oldFTy->params().drop_front(), false);
+
+	Function* NF = Function::Create(newFTy, F->getLinkage(), F->getAddressSpace(), "", F->getParent());
+	NF->copyAttributesFrom(F);
+	AttributeList PAL = F->getAttributes();
+	SmallVector<AttributeSet, 8> argAttrs;
+	for (uint32_t i = 1; i < F->arg_size(); i++)
+		argAttrs.push_back(PAL.getParamAttributes(i));
+	NF->setAttributes(AttributeList::get(Ctx, PAL.getFnAttributes(), AttributeSet(), argAttrs));
+	NF->takeName(F);
+	NF->setSubprogram(F->getSubprogram());
+	F->setSubprogram(nullptr);
+	NF->getBasicBlockList().splice(NF->begin(), F->getBasicBlockList());
+
+	Argument* sret = &*F->arg_begin();
+	auto newArg = NF->arg_begin();
+	for (Argument& A: make_range(std::next(F->arg_begin()), F->arg_end()))
+	{
+		A.replaceAllUsesWith(&*newArg);
+		newArg->takeName(&A);
+		++newArg;
+	}
+
+	// The fields of the result become local variables, returned at the end
+	SmallVector<AllocaInst*, 4> allocas;
+	bool promoted = promoteLeaves(*NF, sret, leaves, allocas);
+	assert(promoted && sret->use_empty());
+	(void)promoted;
+	SmallVector<ReturnInst*, 4> returns;
+	for (BasicBlock& BB: *NF)
+	{
+		if (ReturnInst* RI = dyn_cast<ReturnInst>(BB.getTerminator()))
+			returns.push_back(RI);
+	}
+	for (ReturnInst* RI: returns)
+	{
+		IRBuilder<> Builder(RI);
+		Value* result = UndefValue::get(retTy);
+		for (uint32_t i = 0; i < allocas.size(); i++)
+			result = Builder.CreateInsertValue(result, Builder.CreateLoad(allocas[i]), i);
+		Builder.CreateRet(result);
+		RI->eraseFromParent();
+	}
+	DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>(*NF).getDomTree();
+	PromoteMemToReg(allocas, DT);
+
+	// Rewrite the calls, the results are stored in the original slot
+	SmallVector<CallInst*, 8> calls;
+	for (User* U: F->users())
+		calls.push_back(cast<CallInst>(U));
+	for (CallInst* CI: calls)
+	{
+		SmallVector<Value*, 8> args(std::next(CI->arg_begin()), CI->arg_end());
+		CallInst* NC = CallInst::Create(NF, args, "", CI);
+		NC->setCallingConv(CI->getCallingConv());
+		NC->setDebugLoc(CI->getDebugLoc());
+		AttributeList CallPAL = CI->getAttributes();
+		SmallVector<AttributeSet, 8> callArgAttrs;
+		for (uint32_t i = 1; i < CI->getNumArgOperands(); i++)
+			callArgAttrs.push_back(CallPAL.getParamAttributes(i));
+		NC->setAttributes(AttributeList::get(Ctx, CallPAL.getFnAttributes(), AttributeSet(), callArgAttrs));
+
+		// The writer expects all the extractvalues directly after the call
+		IRBuilder<> Builder(CI);
+		SmallVector<Value*, 4> results;
+		for (uint32_t i = 0; i < leaves.size(); i++)
+			results.push_back(Builder.CreateExtractValue(NC, i));
+		Value* slot = CI->getArgOperand(0);
+		for (uint32_t i = 0; i < leaves.size(); i++)
+			Builder.CreateStore(results[i], Builder.CreateInBoundsGEP(slot, leaves[i].path));
+		if (AllocaInst* AI = dyn_cast<AllocaInst>(slot))
+			callerSlots.insert(AI);
+		CI->eraseFromParent();
+	}
+	F->eraseFromParent();
+	NumFunctionsRewritten++;
+}
+
+bool MultiValueReturns::runOnModule(Module& M)
+{
+	// Functions called from JS must keep their signature
+	SmallPtrSet<const Function*, 16> exported;
+	for (const NamedMDNode& namedNode: M.named_metadata())
+	{
+		StringRef name = namedNode.getName();
+		if (!name.endswith("_methods") && name != "jsexported_free_functions")
+			continue;
+		for (const MDNode* node: namedNode.operands())
+		{
+			if (const ConstantAsMetadata* C = dyn_cast<ConstantAsMetadata>(node->getOperand(0)))
+			{
+				if (const Function* F = dyn_cast<Function>(C->getValue()))
+					exported.insert(F);
+			}
+		}
+	}
+
+	SmallVector<std::pair<Function*, LeafVector>, 8> candidates;
+	for (Function& F: M)
+	{
+		LeafVector leaves;
+		if (isCandidate(F, exported, leaves))
+			candidates.emplace_back(&F, std::move(leaves));
+	}
+	if (candidates.empty())
+		return false;
+
+	SetVector<AllocaInst*> callerSlots;
+	for (auto& c: candidates)
+		rewriteFunction(c.first, c.second, callerSlots);
+
+	// Promote the result slots in the callers, so that the values flow from
+	// the call to their users without going through memory
+	for (AllocaInst* AI: callerSlots)
+	{
+		if (AI->isArrayAllocation())
+			continue;
+		LeafVector leaves;
+		SmallVector<Value*, 4> path;
+		path.push_back(ConstantInt::get(Type::getInt32Ty(M.getContext()), 0));
+		if (!flattenType(AI->getAllocatedType(), path, leaves))
+			continue;
+		Function& F = *AI->getFunction();
+		SmallVector<AllocaInst*, 4> allocas;
+		if (!promoteLeaves(F, AI, leaves, allocas))
+			continue;
+		AI->eraseFromParent();
+		DominatorTree& DT = getAnalysis<DominatorTreeWrapperPass>(F).getDomTree();
+		PromoteMemToReg(allocas, DT);
+		NumSlotsPromoted++;
+	}
+	return true;
+}
+
+StringRef MultiValueReturns::getPassName() const
+{
+	return "MultiValueReturns";
+}
+
+char MultiValueReturns::ID = 0;
+
+void MultiValueReturns::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	AU.addRequired<DominatorTreeWrapperPass>();
+	llvm::Pass::getAnalysisUsage(AU);
+}
+
+ModulePass *createMultiValueReturnsPass() { return new MultiValueReturns(); }
+
+}
+
+using namespace llvm;
+INITIALIZE_PASS_BEGIN(MultiValueReturns, "MultiValueReturns",
+        "Return small aggregates as multiple wasm values", false, false)
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass)
+INITIALIZE_PASS_END(MultiValueReturns, "MultiValueReturns",
+        "Return small aggregates as multiple wasm values", false, false)
@@ -1457,6 +1457,7 @@ void PointerAnalyzer::prefetchFunc(const Function& F) const
 
 const PointerKindWrapper& PointerAnalyzer::getFinalPointerKindWrapper(const Value* p) const
 {
+	CacheGuard guard(*this);
 	// If the values is already cached just return it
 	auto it = PACache.pointerKindData.valueMap.find(p);
 	if(it!=PACache.pointerKindData.valueMap.end())
@@ -1507,6 +1508,13 @@ POINTER_KIND PointerAnalyzer::getPointerKindAssert(const Value* p) const
 }
 POINTER_KIND PointerAnalyzer::getPointerKind(const Value* p) const
 {
+	if (frozen)
+	{
+		auto it = frozenValues.find(p);
+		if (it != frozenValues.end() && it->second.hasKind)
+			return it->second.kind;
+	}
+	CacheGuard guard(*this);
 	const PointerKindWrapper& k = getFinalPointerKindWrapper(p);
 
 	if (k!=INDIRECT)
@@ -1533,6 +1541,10 @@ POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 		return SPLIT_REGULAR;
 	}
 	IndirectPointerKindConstraint c(RETURN_CONSTRAINT, F);
+	const FrozenConstraint* fc = findFrozenConstraint(c);
+	if (fc && fc->hasKind)
+		return fc->kind;
+	CacheGuard guard(*this);
 	const PointerKindWrapper& k=PointerResolverForKindVisitor(PACache).resolveConstraint(c);
 	assert(k.isKnown());
 	REGULAR_POINTER_PREFERENCE regularPreference = getRegularPreference(c, PACache);
@@ -1546,6 +1558,10 @@ POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 POINTER_KIND PointerAnalyzer::getPointerKindForStoredType(Type* pointerType) const
 {
 	IndirectPointerKindConstraint c(STORED_TYPE_CONSTRAINT, pointerType->getPointerElementType());
+	const FrozenConstraint* fc = findFrozenConstraint(c);
+	if (fc && fc->hasKind)
+		return fc->kind;
+	CacheGuard guard(*this);
 	auto it=PACache.pointerKindData.constraintsMap.find(c);
 	if(it==PACache.pointerKindData.constraintsMap.end())
 	{
@@ -1570,6 +1586,10 @@ POINTER_KIND PointerAnalyzer::getPointerKindForArgumentTypeAndIndex( const TypeA
 		return BYTE_LAYOUT;
 
 	IndirectPointerKindConstraint c(INDIRECT_ARG_CONSTRAINT, argTypeAndIndex);
+	const FrozenConstraint* fc = findFrozenConstraint(c);
+	if (fc && fc->hasKind)
+		return fc->kind;
+	CacheGuard guard(*this);
 	const PointerKindWrapper& k=PointerResolverForKindVisitor(PACache).resolveConstraint(c);
 	assert(k.isKnown());
 	REGULAR_POINTER_PREFERENCE regularPreference = getRegularPreference(c, PACache);
@@ -1586,6 +1606,10 @@ POINTER_KIND PointerAnalyzer::getPointerKindForMemberPointer(const TypeAndIndex&
 		return BYTE_LAYOUT;
 
 	IndirectPointerKindConstraint c(BASE_AND_INDEX_CONSTRAINT, baseAndIndex);
+	const FrozenConstraint* fc = findFrozenConstraint(c);
+	if (fc && fc->hasKind)
+		return fc->kind;
+	CacheGuard guard(*this);
 	auto it=PACache.pointerKindData.constraintsMap.find(c);
 	if(it==PACache.pointerKindData.constraintsMap.end())
 		return COMPLETE_OBJECT;
@@ -1617,6 +1641,15 @@ POINTER_KIND PointerAnalyzer::getPointerKindForMemberImpl(const TypeAndIndex& ba
 
 POINTER_KIND PointerAnalyzer::getPointerKindForMember(const TypeAndIndex& baseAndIndex) const
 {
+	if (frozen)
+	{
+		auto it = std::lower_bound(frozenMembers.begin(), frozenMembers.end(), baseAndIndex,
+			[](const std::pair<TypeAndIndex, POINTER_KIND>& m, const TypeAndIndex& t) { return m.first < t; });
+		if (it == frozenMembers.end() || baseAndIndex < it->first)
+			return COMPLETE_OBJECT;
+		return it->second;
+	}
+	CacheGuard guard(*this);
 	return getPointerKindForMemberImpl(baseAndIndex, PACache);
 }
 
@@ -1668,26 +1701,22 @@ REGULAR_POINTER_PREFERENCE PointerAnalyzer::getRegularPreference(const IndirectP
 	llvm_unreachable("Switch should support all kind of pointers");
 }
 
-const ConstantInt* PointerAnalyzer::getConstantOffsetForPointer(const Value * v) const
+const ConstantInt* PointerAnalyzer::resolveConstantOffset(const PointerConstantOffsetWrapper& o, PointerAnalyzerCache& cache, LLVMContext& C)
 {
-	auto it=PACache.pointerOffsetData.valueMap.find(v);
-	if(it==PACache.pointerOffsetData.valueMap.end())
-		return NULL;
-
-	if(!it->second.hasConstraints())
+	if(!o.hasConstraints())
 	{
-		if(it->second.isInvalid() || it->second.isUninitialized())
+		if(o.isInvalid() || o.isUninitialized())
 			return NULL;
-		else if(it->second.isValid())
-			return it->second.getPointerOffset();
+		else if(o.isValid())
+			return o.getPointerOffset();
 	}
-	assert(!it->second.isInvalid() && !it->second.isUnknown());
-	const PointerConstantOffsetWrapper& ret=PointerResolverForOffsetVisitor(PACache).resolvePointerOffset(it->second);
+	assert(!o.isInvalid() && !o.isUnknown());
+	const PointerConstantOffsetWrapper& ret=PointerResolverForOffsetVisitor(cache).resolvePointerOffset(o);
 	if(ret.isInvalid())
 		return NULL;
 	else if(ret.isUninitialized())
 	{
-		Type* Int32Ty=IntegerType::get(v->getContext(), 32);
+		Type* Int32Ty=IntegerType::get(C, 32);
 		return cast<ConstantInt>(ConstantInt::get(Int32Ty, 0));
 	}
 	assert(ret.isValid());
@@ -1695,31 +1724,44 @@ const ConstantInt* PointerAnalyzer::getConstantOffsetForPointer(const Value * v)
 	return ret.getPointerOffset();
 }
 
-const llvm::ConstantInt* PointerAnalyzer::getConstantOffsetForMember( const TypeAndIndex& baseAndIndex ) const
+const ConstantInt* PointerAnalyzer::getConstantOffsetForPointer(const Value * v) const
 {
-	auto it=PACache.pointerOffsetData.constraintsMap.find(IndirectPointerKindConstraint(BASE_AND_INDEX_CONSTRAINT, baseAndIndex));
-	if(it==PACache.pointerOffsetData.constraintsMap.end())
-		return NULL;
-
-	if(!it->second.hasConstraints())
+	if (frozen)
 	{
-		if(it->second.isInvalid() || it->second.isUninitialized())
-			return NULL;
-		else if(it->second.isValid())
-			return it->second.getPointerOffset();
+		auto it = frozenValues.find(v);
+		return it != frozenValues.end() ? it->second.offset : NULL;
 	}
-	assert(!it->second.isInvalid() && !it->second.isUnknown());
-	const PointerConstantOffsetWrapper& ret=PointerResolverForOffsetVisitor(PACache).resolvePointerOffset(it->second);
-	if(ret.isInvalid())
+	CacheGuard guard(*this);
+	auto it=PACache.pointerOffsetData.valueMap.find(v);
+	if(it==PACache.pointerOffsetData.valueMap.end())
 		return NULL;
-	else if(ret.isUninitialized())
+	return resolveConstantOffset(it->second, PACache, v->getContext());
+}
+
+const llvm::ConstantInt* PointerAnalyzer::getConstantOffsetForMember( const TypeAndIndex& baseAndIndex ) const
+{
+	IndirectPointerKindConstraint c(BASE_AND_INDEX_CONSTRAINT, baseAndIndex);
+	if (frozen)
 	{
-		Type* Int32Ty=IntegerType::get(baseAndIndex.type->getContext(), 32);
-		return cast<ConstantInt>(ConstantInt::get(Int32Ty, 0));
+		const FrozenConstraint* fc = findFrozenConstraint(c);
+		return fc ? fc->offset : NULL;
 	}
-	assert(ret.isValid());
-	assert(ret.getPointerOffset());
-	return ret.getPointerOffset();
+	CacheGuard guard(*this);
+	auto it=PACache.pointerOffsetData.constraintsMap.find(c);
+	if(it==PACache.pointerOffsetData.constraintsMap.end())
+		return NULL;
+	return resolveConstantOffset(it->second, PACache, baseAndIndex.type->getContext());
+}
+
+const PointerAnalyzer::FrozenConstraint* PointerAnalyzer::findFrozenConstraint(const IndirectPointerKindConstraint& c) const
+{
+	if (!frozen)
+		return NULL;
+	FrozenConstraint key { c.ptr, c.i, c.kind, UNKNOWN, NULL, false };
+	auto it = std::lower_bound(frozenConstraints.begin(), frozenConstraints.end(), key);
+	if (it == frozenConstraints.end() || key < *it)
+		return NULL;
+	return &*it;
 }
 
 void PointerAnalyzer::invalidate(const Value * v)
@@ -1868,6 +1910,134 @@ void PointerAnalyzer::computeConstantOffsets(const Module& M)
 	}
 }
 
+void PointerAnalyzer::resolveConstantOffsets()
+{
+	auto& pointerOffsetData = PACache.pointerOffsetData;
+
+	// Resolving walks the constraints of other entries, so the results are
+	// only stored once they have all been computed
+	std::vector<const Value*> values;
+	for(const auto& it: pointerOffsetData.valueMap)
+	{
+		if(it.second.hasConstraints())
+			values.push_back(it.first);
+	}
+	std::vector<TypeAndIndex> members;
+	for(const auto& it: pointerOffsetData.constraintsMap)
+	{
+		const IndirectPointerKindConstraint& c = it.first;
+		if(c.kind == BASE_AND_INDEX_CONSTRAINT && it.second.hasConstraints())
+			members.emplace_back(c.typePtr, c.i, TypeAndIndex::STRUCT_MEMBER);
+	}
+	std::vector<const ConstantInt*> valueOffsets;
+	for(const Value* v: values)
+		valueOffsets.push_back(getConstantOffsetForPointer(v));
+	std::vector<const ConstantInt*> memberOffsets;
+	for(const TypeAndIndex& m: members)
+		memberOffsets.push_back(getConstantOffsetForMember(m));
+
+	auto makeWrapper = [](const ConstantInt* offset)
+	{
+		return offset ? PointerConstantOffsetWrapper(offset) : PointerConstantOffsetWrapper(PointerConstantOffsetWrapper::INVALID);
+	};
+	for(uint32_t i=0;i<values.size();i++)
+		pointerOffsetData.valueMap.find(values[i])->second = makeWrapper(valueOffsets[i]);
+	for(uint32_t i=0;i<members.size();i++)
+	{
+		IndirectPointerKindConstraint c(BASE_AND_INDEX_CONSTRAINT, members[i]);
+		pointerOffsetData.constraintsMap.find(c)->second = makeWrapper(memberOffsets[i]);
+	}
+}
+
+void PointerAnalyzer::setConcurrentAccess(bool enabled)
+{
+	assert(status == FULLY_RESOLVED || !enabled);
+	// Resolving an offset may create a constant, and the context can't be
+	// modified concurrently
+	if(enabled)
+		resolveConstantOffsets();
+	concurrentAccess = enabled;
+}
+
+void PointerAnalyzer::freeze()
+{
+	assert(status == FULLY_RESOLVED && !frozen);
+
+	auto& pointerKindData = PACache.pointerKindData;
+	auto& pointerOffsetData = PACache.pointerOffsetData;
+
+	// Resolving may touch the caches, collect the keys first
+	std::vector<const Value*> kindValues;
+	kindValues.reserve(pointerKindData.valueMap.size());
+	for(const auto& it: pointerKindData.valueMap)
+		kindValues.push_back(it.first);
+	frozenValues.reserve(kindValues.size());
+	for(const Value* v: kindValues)
+		frozenValues[v] = FrozenPointer{NULL, getPointerKind(v), true};
+	for(const auto& it: pointerOffsetData.valueMap)
+	{
+		auto f = frozenValues.insert(std::make_pair(it.first, FrozenPointer{NULL, UNKNOWN, false})).first;
+		f->second.offset = resolveConstantOffset(it.second, PACache, it.first->getContext());
+	}
+
+	// Only the constraints which are directly queried are needed
+	std::vector<IndirectPointerKindConstraint> kindConstraints;
+	for(const auto& it: pointerKindData.constraintsMap)
+	{
+		const IndirectPointerKindConstraint& c = it.first;
+		if(c.kind == RETURN_CONSTRAINT || c.kind == STORED_TYPE_CONSTRAINT ||
+			c.kind == INDIRECT_ARG_CONSTRAINT || c.kind == BASE_AND_INDEX_CONSTRAINT)
+		{
+			kindConstraints.push_back(c);
+		}
+	}
+	for(const IndirectPointerKindConstraint& c: kindConstraints)
+	{
+		const PointerKindWrapper& k = pointerKindData.constraintsMap.find(c)->second;
+		REGULAR_POINTER_PREFERENCE regularPreference = getRegularPreference(c, PACache);
+		POINTER_KIND kind;
+		if (k!=INDIRECT)
+			kind = k.getPointerKind(regularPreference);
+		else
+			kind = PointerResolverForKindVisitor(PACache).resolvePointerKind(k).getPointerKind(regularPreference);
+		frozenConstraints.push_back(FrozenConstraint{c.ptr, c.i, c.kind, kind, NULL, true});
+	}
+	std::sort(frozenConstraints.begin(), frozenConstraints.end());
+	std::vector<FrozenConstraint> offsetConstraints;
+	for(const auto& it: pointerOffsetData.constraintsMap)
+	{
+		const IndirectPointerKindConstraint& c = it.first;
+		if(c.kind != BASE_AND_INDEX_CONSTRAINT)
+			continue;
+		FrozenConstraint key{c.ptr, c.i, c.kind, UNKNOWN, NULL, false};
+		const ConstantInt* offset = resolveConstantOffset(it.second, PACache, c.typePtr->getContext());
+		auto f = std::lower_bound(frozenConstraints.begin(), frozenConstraints.end(), key);
+		if(f != frozenConstraints.end() && !(key < *f))
+			f->offset = offset;
+		else
+		{
+			key.offset = offset;
+			offsetConstraints.push_back(key);
+		}
+	}
+	frozenConstraints.insert(frozenConstraints.end(), offsetConstraints.begin(), offsetConstraints.end());
+	std::sort(frozenConstraints.begin(), frozenConstraints.end());
+	frozenConstraints.shrink_to_fit();
+
+	// The map is already sorted
+	frozenMembers.reserve(pointerKindData.baseStructAndIndexMapForMembers.size());
+	for(const auto& it: pointerKindData.baseStructAndIndexMapForMembers)
+		frozenMembers.emplace_back(it.first, getPointerKindForMemberImpl(it.first, PACache));
+
+	// Offsets are never computed again, all the queries are now answered by the frozen tables
+	pointerOffsetData.valueMap.shrink_and_clear();
+	pointerOffsetData.argsMap.shrink_and_clear();
+	pointerOffsetData.constraintsMap.clear();
+	pointerOffsetData.baseStructAndIndexMapForMembers.clear();
+
+	frozen = true;
+}
+
 #ifndef NDEBUG
 void PointerAnalyzer::dumpPointer(const Value* v, bool dumpOwnerFunc) const
 {
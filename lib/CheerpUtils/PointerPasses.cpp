@@ -812,6 +812,11 @@ DelayInsts::InsertPoint DelayInsts::delayInst(const Instruction* I, const LoopIn
 	{
 		return InsertPoint(I);
 	}
+	// Extractvalues render the cmpxchg or multi-value call they use, they must stay in place
+	else if(I->getOpcode() == Instruction::ExtractValue && isa<Instruction>(I->getOperand(0)))
+	{
+		return InsertPoint(I);
+	}
 	else if(I->getOpcode() == Instruction::Alloca && !moveAllocas)
 		return InsertPoint(I);
 	auto it = visited.find(I);
@@ -11,6 +11,7 @@
 
 #define DEBUG_TYPE "pre-execute"
 #include "llvm/Cheerp/PreExecute.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
 #include "llvm/ExecutionEngine/Interpreter.h"
 #include "llvm/ExecutionEngine/FunctionMap.h"
@@ -22,12 +23,17 @@
 #include "llvm/Support/TargetRegistry.h"
 #include <string.h>
 #include <algorithm>
+#include <chrono>
 
 //#define DEBUG_PRE_EXECUTE 1
 
 using namespace llvm;
 
 static cl::opt<bool> PreExecuteMain("cheerp-preexecute-main", cl::desc("Run main/webMain in the PreExecuter step") );
+static cl::opt<bool> PreExecuteStats("cheerp-preexecute-stats", cl::desc("Report the outcome and the time spent on each pre-executed constructor") );
+
+STATISTIC(NumConstructorsFolded, "Number of global constructors folded by the PreExecuter");
+STATISTIC(NumConstructorsFailed, "Number of global constructors which could not be pre-executed");
 
 namespace cheerp {
 
@@ -238,6 +244,8 @@ static GenericValue pre_execute_memcpy(FunctionType *FT,
   memcpy(currentEE->GVTORP(Args[0]), currentEE->GVTORP(Args[1]),
          (size_t)(Args[2].IntVal.getLimitedValue()));
 
+  PreExecute::currentPreExecutePass->recordStore(currentEE->GVTORP(Args[0]));
+
   GenericValue GV;
   GV.IntVal = 0;
   return GV;
@@ -250,6 +258,8 @@ static GenericValue pre_execute_memmove(FunctionType *FT,
   memmove(currentEE->GVTORP(Args[0]), currentEE->GVTORP(Args[1]),
          (size_t)(Args[2].IntVal.getLimitedValue()));
 
+  PreExecute::currentPreExecutePass->recordStore(currentEE->GVTORP(Args[0]));
+
   GenericValue GV;
   GV.IntVal = 0;
   return GV;
@@ -263,6 +273,8 @@ static GenericValue pre_execute_memset(FunctionType *FT,
          (size_t)(Args[1].IntVal.getLimitedValue()),
          (size_t)(Args[2].IntVal.getLimitedValue()));
 
+  PreExecute::currentPreExecutePass->recordStore(currentEE->GVTORP(Args[0]));
+
   GenericValue GV;
   GV.IntVal = 0;
   return GV;
@@ -679,6 +691,8 @@ GlobalValue* PreExecute::getGlobalForMalloc(const DataLayout* DL, char* StoredAd
 
     if (allocData.asmjs)
         allocData.globalValue->setSection("asmjs");
+    // The engine is reused across constructors, from now on the memory is seen as the new global
+    currentEE->updateGlobalMapping(allocData.globalValue, MallocStartAddress);
     // Build an initializer
     allocData.globalValue->setInitializer(computeInitializerFromMemory(DL, newGlobalType, MallocStartAddress, allocData.asmjs));
 
@@ -793,10 +807,8 @@ Constant* PreExecute::computeInitializerFromMemory(const DataLayout* DL,
 }
 
 
-bool PreExecute::runOnConstructor( const llvm::Target* target, const std::string& triple, llvm::Module& m, llvm::Function* func)
+void PreExecute::createEngine(const llvm::Target* target, const std::string& triple, llvm::Module& m)
 {
-    bool Changed = false;
-
     std::string error;
     std::unique_ptr<Module> uniqM(&m);
     TargetMachine* machine = target->createTargetMachine(triple, "", "", TargetOptions(), None);
@@ -814,17 +826,57 @@ bool PreExecute::runOnConstructor( const llvm::Target* target, const std::string
     currentEE->InstallRetListener(RetListener);
     currentEE->InstallLazyFunctionCreator(LazyFunctionCreator);
 
+    // The allocator outlives the single constructors, memory promoted to globals
+    // stays mapped so that later constructors can keep using it
     allocator = make_unique<Allocator>(*currentEE->ValueAddresses);
+}
+
+void PreExecute::destroyEngine(llvm::Module& m)
+{
+#ifdef DEBUG_PRE_EXECUTE
+    currentEE->printMemoryStats();
+#endif
+
+    bool removed = currentEE->removeModule(&m);
+    (void)removed;
+    assert(removed && "failed to free the module from ExecutionEngine");
+
+    allocator = nullptr;
+    delete currentEE;
+
+    currentEE = NULL;
+}
+
+bool PreExecute::runOnConstructor(llvm::Module& m, llvm::Function* func)
+{
+    bool Changed = false;
+    auto startTime = std::chrono::steady_clock::now();
 
     currentEE->runFunction(func, std::vector< GenericValue >());
     if(currentEE->hasFailed())
     {
-        // Execution could not be safely completed. Clean up.
+        // Execution could not be safely completed. The engine is shared by all
+        // the constructors, so restore the memory of the globals touched so far
+        // from their (still unmodified) initializers
+        const DataLayout& DL = m.getDataLayout();
+        for(auto& it: modifiedGlobals)
+        {
+            GlobalVariable* GV = it.first;
+            void* Addr = currentEE->getPointerToGlobal(GV);
+            memset(Addr, 0, DL.getTypeAllocSize(GV->getValueType()));
+            if(GV->hasInitializer())
+                currentEE->InitializeMemory(GV->getInitializer(), Addr);
+        }
         modifiedGlobals.clear();
+        currentEE->resetFailed();
         llvm::errs() << "warning: Could not pre-execute global constructor " << func->getName() << "\n";
+        NumConstructorsFailed++;
     }
     else
+    {
         Changed = true;
+        NumConstructorsFolded++;
+    }
 
     // Compute new initializer for the modified globals
     for(auto& it: modifiedGlobals)
@@ -850,18 +902,11 @@ bool PreExecute::runOnConstructor( const llvm::Target* target, const std::string
     modifiedGlobals.clear();
     typedAllocations.clear();
 
-#ifdef DEBUG_PRE_EXECUTE
-    currentEE->printMemoryStats();
-#endif
-
-    bool removed = currentEE->removeModule(&m);
-    (void)removed;
-    assert(removed && "failed to free the module from ExecutionEngine");
-
-    allocator = nullptr;
-    delete currentEE;
-
-    currentEE = NULL;
+    if (PreExecuteStats)
+    {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+        llvm::errs() << "PreExecute: " << (Changed ? "folded " : "skipped ") << func->getName() << " in " << elapsed.count() << "us\n";
+    }
 
     return Changed;
 }
@@ -929,6 +974,9 @@ bool PreExecute::runOnModule(Module& m)
     FD.detach("fREe");
     FD.detach("rEALLOc");
 
+    if (constructorVar || PreExecuteMain)
+        createEngine(target, triple, m);
+
     if (constructorVar)
     {
         const Constant *initializer = constructorVar->getInitializer();
@@ -939,7 +987,7 @@ bool PreExecute::runOnModule(Module& m)
         {
             Constant *elem = cast<Constant>(*it);
             Function* func = cast<Function>(elem->getAggregateElement(1));
-            if(runOnConstructor(target, triple, m, func))
+            if(runOnConstructor(m, func))
                 Changed |= true;
             else
                 newConstructors.push_back(elem);
@@ -947,19 +995,26 @@ bool PreExecute::runOnModule(Module& m)
     }
 
 
+    Function* mainFunc = nullptr;
     if (PreExecuteMain)
     {
-        Function* mainFunc = m.getFunction("_Z7webMainv");
+        mainFunc = m.getFunction("_Z7webMainv");
         if (!mainFunc)
             mainFunc = m.getFunction("main");
         assert(mainFunc && "unable to find main/webMain in module!");
-        if(runOnConstructor(target, triple, m, mainFunc))
-        {
+        if(runOnConstructor(m, mainFunc))
             Changed |= true;
-            mainFunc->eraseFromParent();
-        }
+        else
+            mainFunc = nullptr;
     }
 
+    if (currentEE)
+        destroyEngine(m);
+
+    // Only erase main after the engine has released the module
+    if (mainFunc)
+        mainFunc->eraseFromParent();
+
     // Delete global constructors and remove the main body
     if (constructorVar)
     {
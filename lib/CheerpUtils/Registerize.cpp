@@ -22,7 +22,10 @@
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/PostDominators.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 #include "llvm/Support/raw_ostream.h"
+#include <atomic>
 
 using namespace llvm;
 
@@ -57,16 +60,81 @@ bool Registerize::runOnModule(Module & M)
 	return false;
 }
 
-void Registerize::assignRegisters(Module & M, cheerp::PointerAnalyzer& PA)
+void Registerize::assignRegisters(Module & M, cheerp::PointerAnalyzer& PA, unsigned numThreads)
 {
 	assert(!RegistersAssigned);
-	for (Function& F: M)
-		assignRegistersToInstructions(F, PA);
+	if (numThreads != 1)
+		assignRegistersConcurrently(M, PA, numThreads);
+	else
+	{
+		for (Function& F: M)
+			assignRegistersToInstructions(F, PA);
+	}
 #ifndef NDEBUG
 	RegistersAssigned = true;
 #endif
 }
 
+void Registerize::assignRegistersConcurrently(Module & M, cheerp::PointerAnalyzer& PA, unsigned numThreads)
+{
+	std::vector<Function*> functions;
+	for (Function& F: M)
+	{
+		if (!F.empty())
+			functions.push_back(&F);
+	}
+	const uint32_t count = functions.size();
+	if (count == 0)
+		return;
+	if (numThreads == 0)
+		numThreads = llvm::heavyweight_hardware_concurrency();
+	numThreads = std::max(1u, std::min<unsigned>(numThreads, count));
+
+	// Every worker is a private copy of the pass, so that the registers being
+	// assigned and the loop info of the current function are owned by a single
+	// thread. After each function the results are moved out of the worker.
+	std::vector<std::unique_ptr<Registerize>> workers;
+	for (unsigned t = 0; t < numThreads; t++)
+	{
+		workers.emplace_back(new Registerize(froundAvailable, wasm));
+		workers.back()->isConcurrentWorker = true;
+	}
+
+	std::vector<FunctionRegisters> results(count);
+	std::atomic<uint32_t> nextFunction(0);
+	ThreadPool pool(numThreads);
+	for (auto& worker: workers)
+	{
+		Registerize* w = worker.get();
+		pool.async([w, count, &functions, &results, &nextFunction, &PA]()
+		{
+			uint32_t i;
+			while ((i = nextFunction++) < count)
+			{
+				Function* F = functions[i];
+				w->assignRegistersToInstructions(*F, PA);
+				FunctionRegisters& r = results[i];
+				std::swap(r.registersMap, w->registersMap);
+				std::swap(r.edgeRegistersMap, w->edgeRegistersMap);
+				std::swap(r.selfRefRegistersMap, w->selfRefRegistersMap);
+				r.registers = std::move(w->registersForFunctionMap[F]);
+				w->registersForFunctionMap.clear();
+			}
+		});
+	}
+	pool.wait();
+
+	// Merge in module order, so that the result does not depend on scheduling
+	for (uint32_t i = 0; i < count; i++)
+	{
+		FunctionRegisters& r = results[i];
+		registersMap.insert(r.registersMap.begin(), r.registersMap.end());
+		edgeRegistersMap.merge(r.edgeRegistersMap);
+		selfRefRegistersMap.insert(r.selfRefRegistersMap.begin(), r.selfRefRegistersMap.end());
+		registersForFunctionMap[functions[i]] = std::move(r.registers);
+	}
+}
+
 StringRef Registerize::getPassName() const
 {
 	return "CheerpRegisterize";
@@ -378,7 +446,17 @@ void Registerize::extendRangeForUsedOperands(Instruction& I, LiveRangesTy& liveR
 
 uint32_t Registerize::assignToRegisters(Function& F, const InstIdMapTy& instIdMap, const LiveRangesTy& liveRanges, const PointerAnalyzer& PA)
 {
-	LI = &(getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo());
+	// Concurrent workers can't use the pass manager, they compute the loop info locally
+	DominatorTree localDT;
+	LoopInfo localLI;
+	if (isConcurrentWorker)
+	{
+		localDT.recalculate(F);
+		localLI.analyze(localDT);
+		LI = &localLI;
+	}
+	else
+		LI = &(getAnalysis<LoopInfoWrapperPass>(F).getLoopInfo());
 
 	llvm::SmallVector<RegisterRange, 4> registers;
 
@@ -2935,6 +3013,9 @@ Registerize::REGISTER_KIND Registerize::getRegKindFromType(const llvm::Type* t,
 		return FLOAT;
 	else if(t->isFloatingPointTy())
 		return DOUBLE;
+	// 128-bit vectors are only allowed in wasm, where they become v128 locals
+	else if(asmjs && wasm && t->isVectorTy())
+		return VECTOR;
 	// Raw pointers are just integers
 	else if(TypeSupport::isRawPointer(t, asmjs))
 		return INTEGER;
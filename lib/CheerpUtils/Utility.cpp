@@ -218,7 +218,35 @@ bool InlineableCache::isInlineableImpl(const Instruction& I)
 		}
 		return true;
 	};
-	if(I.getOpcode()==Instruction::GetElementPtr)
+	if(I.getOpcode()==Instruction::AtomicCmpXchg)
+	{
+		// The loaded value is extracted directly after the cmpxchg (see AtomicLowering), the extractvalue renders it
+		return !I.use_empty();
+	}
+	else if(I.getOpcode()==Instruction::ExtractValue && isa<AtomicCmpXchgInst>(I.getOperand(0)))
+	{
+		return false;
+	}
+	else if(I.getOpcode()==Instruction::Call && I.getType()->isStructTy())
+	{
+		// Multiple results are extracted directly after the call (see MultiValueReturns), the first extractvalue renders it
+		return !I.use_empty();
+	}
+	else if(I.getOpcode()==Instruction::ExtractValue && isa<CallInst>(I.getOperand(0)))
+	{
+		return false;
+	}
+	else if(I.getOpcode()==Instruction::InsertValue)
+	{
+		// Chains of insertvalue building multiple results are rendered by the return
+		for(const User* U: I.users())
+		{
+			if(!isa<ReturnInst>(U) && !isa<InsertValueInst>(U))
+				return false;
+		}
+		return !I.use_empty();
+	}
+	else if(I.getOpcode()==Instruction::GetElementPtr)
 	{
 		POINTER_KIND IPointerKind = PA.getPointerKind(&I);
 		if(IPointerKind == RAW)
@@ -252,6 +280,11 @@ bool InlineableCache::isInlineableImpl(const Instruction& I)
 		// Split regular, regular, and byte layout are always inlined.
 		return true;
 	}
+	else if(I.getOpcode()==Instruction::BitCast && I.getType()->isVectorTy())
+	{
+		// Bitcasts between wasm vectors are no-ops
+		return !hasMoreThan1Use || !isa<Instruction>(I.getOperand(0)) || !isInlineableRecursion(*cast<Instruction>(I.getOperand(0)));
+	}
 	else if(I.getOpcode()==Instruction::BitCast)
 	{
 		POINTER_KIND IPointerKind = PA.getPointerKind(&I);
@@ -422,6 +455,8 @@ bool InlineableCache::isInlineableImpl(const Instruction& I)
 			case Instruction::Switch:
 			case Instruction::Unreachable:
 			case Instruction::VAArg:
+			case Instruction::AtomicRMW:
+			case Instruction::Fence:
 				return false;
 			case Instruction::Add:
 			case Instruction::Sub:
@@ -1292,7 +1327,11 @@ void initializeCheerpOpts(PassRegistry &Registry)
 	initializeFixIrreducibleControlFlowPass(Registry);
 	initializeCheerpLowerSwitchPass(Registry);
 	initializeByValLoweringPass(Registry);
+	initializeAtomicLoweringPass(Registry);
+	initializeMultiValueReturnsPass(Registry);
 	initializeI64LoweringPassPass(Registry);
+	initializeInstrProfLoweringPass(Registry);
+	initializeVTableDevirtualizationPass(Registry);
 	initializeCheerpLowerSwitchPass(Registry);
 }
 
@@ -0,0 +1,251 @@
+//===-- VTableDevirtualization.cpp - Cheerp optimization pass --------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpVTableDevirtualization"
+#include "llvm/Cheerp/VTableDevirtualization.h"
+#include "llvm/Cheerp/Utility.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+STATISTIC(NumVirtualCalls, "Number of virtual call sites found");
+STATISTIC(NumDevirtualizedCalls, "Number of virtual call sites made direct");
+
+namespace llvm {
+
+static bool isVTable(const GlobalVariable& GV)
+{
+	return GV.getName().startswith("_ZTV") || GV.getName().startswith("_ZTC");
+}
+
+static void collectAggregateTypes(Type* T, SmallPtrSetImpl<Type*>& types)
+{
+	if (!T->isStructTy() && !T->isArrayTy())
+		return;
+	if (!types.insert(T).second)
+		return;
+	for (Type* sub: T->subtypes())
+		collectAggregateTypes(sub, types);
+}
+
+static void collectObjects(Constant* C, DenseMap<Type*, SmallVector<Constant*, 4>>& objects)
+{
+	Type* T = C->getType();
+	if (!T->isStructTy() && !T->isArrayTy())
+		return;
+	objects[T].push_back(C);
+	uint32_t numElements = T->isStructTy() ? T->getStructNumElements() : T->getArrayNumElements();
+	for (uint32_t i = 0; i < numElements; i++)
+	{
+		if (Constant* E = C->getAggregateElement(i))
+			collectObjects(E, objects);
+	}
+}
+
+// DynamicAllocInfo ignores asmjs allocations, so they are detected here
+static bool isAllocation(const CallBase& CB)
+{
+	const Function* F = CB.getCalledFunction();
+	if (!F)
+		return false;
+	switch (F->getIntrinsicID())
+	{
+		case Intrinsic::cheerp_allocate:
+		case Intrinsic::cheerp_allocate_array:
+		case Intrinsic::cheerp_reallocate:
+			return true;
+		default:
+			break;
+	}
+	StringRef name = F->getName();
+	return name == "malloc" || name == "calloc" || name == "realloc" ||
+		name == "_Znwj" || name == "_Znaj";
+}
+
+void VTableDevirtualization::collectCastOfVTable(Type* srcTy, Type* dstTy)
+{
+	if (!srcTy->isPointerTy() || !dstTy->isPointerTy())
+		return;
+	// A vtable seen through another type adds its slots to the objects of
+	// that type, which are not known
+	if (vtableObjects.count(srcTy->getPointerElementType()))
+		collectAggregateTypes(dstTy->getPointerElementType(), unknownTypes);
+}
+
+void VTableDevirtualization::collectVTables(Module& M)
+{
+	for (GlobalVariable& GV: M.globals())
+	{
+		if (isVTable(GV) && GV.isConstant() && GV.hasDefinitiveInitializer())
+			collectObjects(GV.getInitializer(), vtableObjects);
+		else
+			collectAggregateTypes(GV.getValueType(), unknownTypes);
+	}
+	SmallVector<ConstantExpr*, 4> constantCasts;
+	ConstantExpr::getAllFromOpcode(constantCasts, M.getContext(), Instruction::BitCast);
+	for (ConstantExpr* CE: constantCasts)
+		collectCastOfVTable(CE->getOperand(0)->getType(), CE->getType());
+	for (Function& F: M)
+	{
+		for (Instruction& I: instructions(F))
+		{
+			if (AllocaInst* AI = dyn_cast<AllocaInst>(&I))
+				collectAggregateTypes(AI->getAllocatedType(), unknownTypes);
+			else if (BitCastInst* BC = dyn_cast<BitCastInst>(&I))
+				collectCastOfVTable(BC->getSrcTy(), BC->getDestTy());
+			else if (CallBase* CB = dyn_cast<CallBase>(&I))
+			{
+				// Objects allocated on the heap are not known either, look at
+				// every type the memory is used as
+				if (!isAllocation(*CB) || !CB->getType()->isPointerTy())
+					continue;
+				collectAggregateTypes(CB->getType()->getPointerElementType(), unknownTypes);
+				for (User* U: CB->users())
+				{
+					if (BitCastInst* BC = dyn_cast<BitCastInst>(U))
+						if (BC->getDestTy()->isPointerTy())
+							collectAggregateTypes(BC->getDestTy()->getPointerElementType(), unknownTypes);
+				}
+			}
+		}
+	}
+}
+
+Function* VTableDevirtualization::findSingleTarget(CallBase& CB) const
+{
+	// Look for a load from a constant slot of a vtable object
+	LoadInst* slot = dyn_cast<LoadInst>(CB.getCalledValue()->stripPointerCastsSafe());
+	if (!slot || slot->isVolatile())
+		return nullptr;
+	GEPOperator* GEP = dyn_cast<GEPOperator>(slot->getPointerOperand());
+	if (!GEP || GEP->getNumIndices() < 2 || !GEP->hasAllConstantIndices())
+		return nullptr;
+	if (!cast<Constant>(GEP->getOperand(1))->isNullValue())
+		return nullptr;
+	Type* vtableType = GEP->getSourceElementType();
+	if (unknownTypes.count(vtableType))
+		return nullptr;
+	auto it = vtableObjects.find(vtableType);
+	if (it == vtableObjects.end())
+		return nullptr;
+	NumVirtualCalls++;
+
+	Function* target = nullptr;
+	for (Constant* C: it->second)
+	{
+		for (auto idx = GEP->idx_begin() + 1; idx != GEP->idx_end() && C; ++idx)
+			C = C->getAggregateElement(cast<Constant>(*idx));
+		if (!C)
+			return nullptr;
+		C = cast<Constant>(C->stripPointerCastsSafe());
+		// Empty slots are never called
+		if (isa<ConstantPointerNull>(C) || isa<UndefValue>(C))
+			continue;
+		Function* F = dyn_cast<Function>(C);
+		if (!F || (target && target != F))
+			return nullptr;
+		target = F;
+	}
+	return target;
+}
+
+bool VTableDevirtualization::devirtualize(CallBase& CB, Function* target)
+{
+	Value* calledValue = CB.getCalledValue();
+	if (target->getType() == calledValue->getType())
+	{
+		CB.setCalledFunction(target);
+		return true;
+	}
+	// Overrides may have a different type than the slot. Only casts of
+	// linear memory pointers are free, so genericjs calls need an exact match
+	CallInst* CI = dyn_cast<CallInst>(&CB);
+	if (!CI || CI->getParent()->getParent()->getSection() != StringRef("asmjs") ||
+		target->getSection() != StringRef("asmjs"))
+		return false;
+	FunctionType* FTy = target->getFunctionType();
+	auto isCastable = [](Type* from, Type* to)
+	{
+		return from == to || (from->isPointerTy() && to->isPointerTy()) ||
+			(from->isPointerTy() && to->isIntegerTy()) || (from->isIntegerTy() && to->isPointerTy());
+	};
+	if (FTy->isVarArg() || FTy->getNumParams() != CI->getNumArgOperands())
+		return false;
+	if (!isCastable(FTy->getReturnType(), CI->getType()))
+		return false;
+	for (uint32_t i = 0; i < FTy->getNumParams(); i++)
+	{
+		if (!isCastable(CI->getArgOperand(i)->getType(), FTy->getParamType(i)))
+			return false;
+	}
+	CI->setCalledOperand(ConstantExpr::getBitCast(target, calledValue->getType()));
+	return cheerp::replaceCallOfBitCastWithBitCastOfCall(*CI, /*mayFail*/false, /*performPtrIntConversions*/true);
+}
+
+bool VTableDevirtualization::runOnModule(Module& M)
+{
+	vtableObjects.clear();
+	unknownTypes.clear();
+	collectVTables(M);
+	if (vtableObjects.empty())
+		return false;
+
+	std::vector<std::pair<CallBase*, Function*>> sites;
+	for (Function& F: M)
+	{
+		for (Instruction& I: instructions(F))
+		{
+			CallBase* CB = dyn_cast<CallBase>(&I);
+			if (!CB || CB->getCalledFunction() || CB->isInlineAsm())
+				continue;
+			if (Function* target = findSingleTarget(*CB))
+				sites.emplace_back(CB, target);
+		}
+	}
+
+	bool Changed = false;
+	for (auto& site: sites)
+	{
+		if (!devirtualize(*site.first, site.second))
+			continue;
+		LLVM_DEBUG(dbgs() << "Devirtualized call to " << site.second->getName() << " in " << site.first->getFunction()->getName() << "\n");
+		NumDevirtualizedCalls++;
+		Changed = true;
+	}
+	return Changed;
+}
+
+StringRef VTableDevirtualization::getPassName() const
+{
+	return "VTableDevirtualization";
+}
+
+char VTableDevirtualization::ID = 0;
+
+void VTableDevirtualization::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	llvm::Pass::getAnalysisUsage(AU);
+}
+
+ModulePass *createVTableDevirtualizationPass() { return new VTableDevirtualization(); }
+
+}
+
+using namespace llvm;
+INITIALIZE_PASS_BEGIN(VTableDevirtualization, "VTableDevirtualization",
+        "Make virtual calls with a single possible target direct", false, false)
+INITIALIZE_PASS_END(VTableDevirtualization, "VTableDevirtualization",
+        "Make virtual calls with a single possible target direct", false, false)
@@ -299,7 +299,7 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 	{
 		if (BrInst->isUnconditional())
 		{
-			Token* Prologue = Token::createPrologue(BBT->getBB(), 0);
+			Token* Prologue = Tokens.createPrologue(BBT->getBB(), 0);
 			InsertPt = Tokens.insertAfter(InsertPt, Prologue);
 			const DomTreeNode* Dom = DT.getNode(BrInst->getSuccessor(0));
 			bool Nested = CurNode->getBlock() == getUniqueForwardPredecessor(Dom->getBlock(), LI);
@@ -308,17 +308,17 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 		}
 		else
 		{
-			Token* If = Token::createIf(BBT->getBB());
+			Token* If = Tokens.createIf(BBT->getBB());
 			auto IfPt = Tokens.insertAfter(InsertPt, If);
-			Token* IfPrologue = Token::createPrologue(BBT->getBB(), 0);
+			Token* IfPrologue = Tokens.createPrologue(BBT->getBB(), 0);
 			IfPt = Tokens.insertAfter(IfPt, IfPrologue);
 
-			Token* Else = Token::createElse(If);
+			Token* Else = Tokens.createElse(If);
 			auto ElsePt = Tokens.insertAfter(IfPt, Else);
-			Token* ElsePrologue = Token::createPrologue(BBT->getBB(), 1);
+			Token* ElsePrologue = Tokens.createPrologue(BBT->getBB(), 1);
 			ElsePt = Tokens.insertAfter(ElsePt, ElsePrologue);
 
-			Token* End = Token::createIfEnd(If, Else);
+			Token* End = Tokens.createIfEnd(If, Else);
 			auto EndPt = Tokens.insertAfter(ElsePt, End);
 
 			const DomTreeNode* IfDom = DT.getNode(BrInst->getSuccessor(0));
@@ -335,7 +335,7 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 	else if (isa<SwitchInst>(Term) && !NestSwitches)
 	{
 		const SwitchInst* SwInst = cast<SwitchInst>(Term);
-		Token* Switch = Token::createSwitch(BBT->getBB());
+		Token* Switch = Tokens.createSwitch(BBT->getBB());
 		InsertPt = Tokens.insertAfter(InsertPt, Switch);
 		Token* Prev = Switch;
 		std::vector<Token*> Branches;
@@ -343,15 +343,15 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 		{
 			for (int idx: Indexes)
 			{
-				Token* Case = Token::createCase(BBT->getBB(), idx, Prev);
+				Token* Case = Tokens.createCase(BBT->getBB(), idx, Prev);
 				Prev = Case;
 				InsertPt = Tokens.insertAfter(InsertPt, Case);
 			}
-			Token* Br = Token::createBranch(nullptr);
+			Token* Br = Tokens.createBranch(nullptr);
 			InsertPt = Tokens.insertAfter(InsertPt, Br);
 			Branches.push_back(Br);
 		});
-		Token* End = Token::createSwitchEnd(Switch, Prev);
+		Token* End = Tokens.createSwitchEnd(Switch, Prev);
 		InsertPt = Tokens.insertAfter(InsertPt, End);
 		std::vector<Scope> SwitchScopes;
 		Scopes.reserve(SwInst->getNumSuccessors());
@@ -360,7 +360,7 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 		for_each_succ(BBT->getBB(), [&](const BasicBlock* Succ, const SmallVectorImpl<int>& Ids)
 		{
 			processBlockScopes({Branches[i]});
-			Token* Prologue = Token::createPrologue(BBT->getBB(), Ids.front());
+			Token* Prologue = Tokens.createPrologue(BBT->getBB(), Ids.front());
 			InsertPt = Tokens.insertAfter(InsertPt, Prologue);
 
 			const DomTreeNode* Dom = DT.getNode(const_cast<BasicBlock*>(Succ));
@@ -384,7 +384,7 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 	else if (isa<SwitchInst>(Term) && NestSwitches)
 	{
 		const SwitchInst* SwInst = cast<SwitchInst>(Term);
-		Token* Switch = Token::createSwitch(BBT->getBB());
+		Token* Switch = Tokens.createSwitch(BBT->getBB());
 		InsertPt = Tokens.insertAfter(InsertPt, Switch);
 		Token* Prev = Switch;
 		TokenList::iterator FirstPt = Tokens.end();
@@ -394,11 +394,11 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 		{
 			for (int idx: Indexes)
 			{
-				Token* Case = Token::createCase(BBT->getBB(), idx, Prev);
+				Token* Case = Tokens.createCase(BBT->getBB(), idx, Prev);
 				Prev = Case;
 				InsertPt = Tokens.insertAfter(InsertPt, Case);
 			}
-			Token* Prologue = Token::createPrologue(BBT->getBB(), Indexes.front());
+			Token* Prologue = Tokens.createPrologue(BBT->getBB(), Indexes.front());
 			InsertPt = Tokens.insertAfter(InsertPt, Prologue);
 			if (!SwitchScopes.empty())
 			{
@@ -413,7 +413,7 @@ void TokenListBuilder::processBlockTerminator(Token* BBT, const DomTreeNode* Cur
 			Scope S { Scope::Case, Dom, Tokens.end(), Nested};
 			SwitchScopes.push_back(S);
 		});
-		Token* End = Token::createSwitchEnd(Switch, Prev);
+		Token* End = Tokens.createSwitchEnd(Switch, Prev);
 		InsertPt = Tokens.insertAfter(InsertPt, End);
 		SwitchScopes.back().EndPt = InsertPt; 
 		Scopes.insert(Scopes.end(), SwitchScopes.rbegin(), SwitchScopes.rend());
@@ -454,8 +454,8 @@ void TokenListBuilder::popScopes(const DomTreeNode* CurNode)
 				{
 					auto LoopHeaderIt = LoopHeaders.find(CurScope.Dom->getBlock());
 					Token* Br = LoopHeaderIt == LoopHeaders.end()
-						? Token::createBranch(nullptr)
-						: Token::createBranch(LoopHeaderIt->getSecond());
+						? Tokens.createBranch(nullptr)
+						: Tokens.createBranch(LoopHeaderIt->getSecond());
 					BlockScopes[CurScope.Dom->getBlock()].push_back(Br);
 					InsertPt = Tokens.insertAfter(InsertPt, Br);
 				}
@@ -485,8 +485,8 @@ void TokenListBuilder::processLoopScopes(const BasicBlock* CurBB)
 	// Open a new loop
 	if (CurL->getHeader() == CurBB)
 	{
-		Token* Loop = Token::createLoop();
-		Token* End = Token::createLoopEnd(Loop);
+		Token* Loop = Tokens.createLoop();
+		Token* End = Tokens.createLoopEnd(Loop);
 
 		auto LoopPt = Tokens.insertAfter(InsertPt, Loop);
 		auto EndPt = Tokens.insertAfter(LoopPt, End);
@@ -524,8 +524,8 @@ void TokenListBuilder::processBlockScopes(const std::vector<Token*>& Branches)
 	{
 		assert(Branch->getKind() == Token::TK_Branch);
 
-		Token* Block = Token::createBlock();
-		Token* End = Token::createBlockEnd(Block);
+		Token* Block = Tokens.createBlock();
+		Token* End = Tokens.createBlockEnd(Block);
 		Branch->setMatch(End);
 
 		auto TargetPt = Tokens.insertAfter(EndPt, End);
@@ -555,7 +555,7 @@ void TokenListBuilder::processBlock(const BasicBlock* CurBB, bool Delayed)
 	processLoopScopes(CurBB);
 
 	// Create the token for this basic block and add it to the list
-	Token* BBT = Token::createBasicBlock(CurBB);
+	Token* BBT = Tokens.createBasicBlock(CurBB);
 	InsertPt = Tokens.insertAfter(InsertPt, BBT);
 	BlockTokenMap.insert(std::make_pair(CurBB, BBT));
 
@@ -893,7 +893,7 @@ void TokenListOptimizer::removeEmptyIfs()
 				{
 					Token* Else = T;
 					Token* End = Else->getMatch();
-					Token* IfNot = Token::createIfNot(EmptyIf->getBB());
+					Token* IfNot = Tokens.createIfNot(EmptyIf->getBB());
 					IfNot->setMatch(End);
 					End->setMatch(IfNot);
 					Tokens.insertAfter(EmptyIf->getIter(), IfNot);
@@ -907,7 +907,7 @@ void TokenListOptimizer::removeEmptyIfs()
 					const Value* Cond = cast<BranchInst>(Term)->getCondition();
 					if (mayContainSideEffects(Cond, PA))
 					{
-						Token* CondT = Token::createCondition(EmptyIf->getBB());
+						Token* CondT = Tokens.createCondition(EmptyIf->getBB());
 						Tokens.insert(EmptyIf->getIter(), CondT);
 					}
 					erase(EmptyIf);
@@ -940,8 +940,8 @@ void TokenListOptimizer::createBrIfs()
 			return;
 		bool IsIfNot = T->getKind() == Token::TK_IfNot;
 		Token* BrIf = IsIfNot
-			? Token::createBrIfNot(T->getBB(), Branch->getMatch())
-			: Token::createBrIf(T->getBB(), Branch->getMatch());
+			? Tokens.createBrIfNot(T->getBB(), Branch->getMatch())
+			: Tokens.createBrIf(T->getBB(), Branch->getMatch());
 		Tokens.insert(T->getIter(), BrIf);
 		erase(T);
 		erase(Branch);
@@ -970,8 +970,8 @@ void TokenListOptimizer::createBrIfsFromIfs()
 
 		bool IsIfNot = T->getKind() == Token::TK_IfNot;
 		Token* BrIf = IsIfNot
-			? Token::createBrIf(T->getBB(), End2)
-			: Token::createBrIfNot(T->getBB(), End2);
+			? Tokens.createBrIf(T->getBB(), End2)
+			: Tokens.createBrIfNot(T->getBB(), End2);
 		Tokens.insert(T->getIter(), BrIf);
 		erase(T);
 		erase(End);
@@ -1050,7 +1050,7 @@ void TokenListOptimizer::removeUnnededNesting()
 			return;
 		auto removeElse = [&]()
 		{
-			Token* NewEnd = Token::createIfEnd(If, nullptr);
+			Token* NewEnd = Tokens.createIfEnd(If, nullptr);
 			Tokens.insert(Else->getIter(), NewEnd);
 			erase(Else);
 			erase(End);
@@ -1058,7 +1058,7 @@ void TokenListOptimizer::removeUnnededNesting()
 		auto removeIf = [&]()
 		{
 			Tokens.moveAfter(End->getIter(), std::next(If->getIter()), Else->getIter());
-			Token* IfNot = Token::createIfNot(If->getBB());
+			Token* IfNot = Tokens.createIfNot(If->getBB());
 			IfNot->setMatch(End);
 			End->setMatch(IfNot);
 			Tokens.insert(Else->getIter(), IfNot);
@@ -1328,6 +1328,8 @@ static Token::TokenResultType getTokenResultType(const llvm::Instruction* I, con
 			return Token::TokenResultType::F32;
 		case Registerize::DOUBLE:
 			return Token::TokenResultType::F64;
+		case Registerize::VECTOR:
+			return Token::TokenResultType::V128;
 		default:
 			break;
 	}
@@ -10,10 +10,12 @@
 //===----------------------------------------------------------------------===//
 
 #include <algorithm>
+#include <atomic>
 #include <limits>
 
 #include "Relooper.h"
 #include "CFGStackifier.h"
+#include "WasmPeephole.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Cheerp/BuiltinInstructions.h"
@@ -23,7 +25,10 @@
 #include "llvm/Cheerp/WasmWriter.h"
 #include "llvm/Cheerp/Writer.h"
 #include "llvm/IR/Type.h"
+#include "llvm/IR/TypeFinder.h"
 #include "llvm/Support/LEB128.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
 
 using namespace cheerp;
 using namespace llvm;
@@ -96,6 +101,9 @@ static inline void encodeRegisterKind(Registerize::REGISTER_KIND regKind, WasmBu
 		case Registerize::OBJECT:
 			encodeULEB128(0x6f, stream);
 			break;
+		case Registerize::VECTOR:
+			encodeULEB128(0x7b, stream);
+			break;
 	}
 }
 
@@ -109,6 +117,8 @@ static uint32_t getValType(const Type* t)
 		return 0x7d;
 	else if (t->isDoubleTy())
 		return 0x7c;
+	else if (t->isVectorTy())
+		return 0x7b;
 	else if (t->isPointerTy())
 		return 0x6f;
 	else
@@ -121,6 +131,53 @@ static uint32_t getValType(const Type* t)
 	}
 }
 
+enum VECTOR_SHAPE { I8X16 = 0, I16X8, I32X4, I64X2, F32X4, F64X2 };
+
+// Only 128-bit vectors can be mapped to v128 values. Vectors of i1 are the
+// result of comparisons, each lane is a mask as wide as the compared lanes.
+static VECTOR_SHAPE getVectorShape(const Type* t)
+{
+	if (!WasmSIMD)
+		llvm::report_fatal_error("Vector types are only supported in wasm with -cheerp-wasm-simd");
+	const VectorType* vt = cast<VectorType>(t);
+	const Type* elementType = vt->getElementType();
+	uint32_t numElements = vt->getNumElements();
+	uint32_t laneBits = 0;
+	if (elementType->isIntegerTy(1))
+		laneBits = 128 / numElements;
+	else if (elementType->isIntegerTy() && elementType->getIntegerBitWidth() * numElements == 128)
+		laneBits = elementType->getIntegerBitWidth();
+	else if (elementType->isPointerTy() && numElements == 4)
+		laneBits = 32;
+	else if (elementType->isFloatTy() && numElements == 4)
+		return F32X4;
+	else if (elementType->isDoubleTy() && numElements == 2)
+		return F64X2;
+	switch (numElements * laneBits == 128 ? laneBits : 0)
+	{
+		case 8:
+			return I8X16;
+		case 16:
+			return I16X8;
+		case 32:
+			return I32X4;
+		case 64:
+			return I64X2;
+		default:
+			break;
+	}
+#ifndef NDEBUG
+	t->dump();
+#endif
+	llvm::report_fatal_error("Unsupported vector type, only 128-bit vectors are supported in wasm");
+}
+
+static uint32_t getVectorLaneBytes(VECTOR_SHAPE shape)
+{
+	static const uint32_t laneBytes[] = { 1, 2, 4, 8, 4, 8 };
+	return laneBytes[shape];
+}
+
 static void encodeValType(const Type* t, WasmBuffer& stream)
 {
 	encodeULEB128(getValType(t), stream);
@@ -899,7 +956,7 @@ void CheerpWasmWriter::encodeBinOp(const llvm::Instruction& I, WasmBuffer& code)
 			compileOperand(code, I.getOperand(1));
 			break;
 		case Instruction::FSub:
-			if (I.getOperand(0) == ConstantFP::getZeroValueForNegation(I.getOperand(0)->getType()))
+			if (isa<Constant>(I.getOperand(0)) && cast<Constant>(I.getOperand(0))->isNegativeZeroValue())
 			{
 				//Wasm has an operator negate on floating point
 				//(-0.0) - something -> neg(something)
@@ -1033,6 +1090,101 @@ void CheerpWasmWriter::encodeInst(WasmU32U32Opcode opcode, uint32_t i1, uint32_t
 	encodeULEB128(i2, code);
 }
 
+void CheerpWasmWriter::encodeInst(WasmFCOpcode opcode, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfc);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+}
+
+void CheerpWasmWriter::encodeInst(WasmFCU32Opcode opcode, uint32_t immediate, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfc);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+	encodeULEB128(immediate, code);
+}
+
+void CheerpWasmWriter::encodeInst(WasmFCU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfc);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+	encodeULEB128(i1, code);
+	encodeULEB128(i2, code);
+}
+
+void CheerpWasmWriter::encodeInst(WasmSIMDOpcode opcode, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfd);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+}
+
+void CheerpWasmWriter::encodeInst(WasmSIMDLaneOpcode opcode, uint8_t lane, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfd);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+	code << static_cast<char>(lane);
+}
+
+void CheerpWasmWriter::encodeInst(WasmSIMDBytesOpcode opcode, const uint8_t bytes[16], WasmBuffer& code)
+{
+	code << static_cast<char>(0xfd);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+	code.write(reinterpret_cast<const char*>(bytes), 16);
+}
+
+void CheerpWasmWriter::encodeInst(WasmSIMDU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfd);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+	encodeULEB128(i1, code);
+	encodeULEB128(i2, code);
+}
+
+void CheerpWasmWriter::encodeInst(WasmThreadsOpcode opcode, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfe);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+	// Reserved byte
+	code << static_cast<char>(0x00);
+}
+
+void CheerpWasmWriter::encodeInst(WasmThreadsU32U32Opcode opcode, uint32_t i1, uint32_t i2, WasmBuffer& code)
+{
+	code << static_cast<char>(0xfe);
+	encodeULEB128(static_cast<uint32_t>(opcode), code);
+	encodeULEB128(i1, code);
+	encodeULEB128(i2, code);
+}
+
+void CheerpWasmWriter::encodeAtomicInst(WasmThreadsU32U32Opcode i32Opcode, const llvm::Type* ty, uint32_t offset, WasmBuffer& code)
+{
+	// Atomic accesses are laid out as i32, i64, i32 8-bit, i32 16-bit starting from the i32 opcode
+	// The alignment must be the natural one
+	uint32_t bitWidth = 32;
+	if(ty->isIntegerTy())
+		bitWidth = std::max(8u, ty->getIntegerBitWidth());
+	else if(ty->isDoubleTy())
+		bitWidth = 64;
+	uint32_t opcode = static_cast<uint32_t>(i32Opcode);
+	switch(bitWidth)
+	{
+		case 8:
+			encodeInst(static_cast<WasmThreadsU32U32Opcode>(opcode + 2), 0x0, offset, code);
+			break;
+		case 16:
+			encodeInst(static_cast<WasmThreadsU32U32Opcode>(opcode + 3), 0x1, offset, code);
+			break;
+		case 32:
+			encodeInst(i32Opcode, 0x2, offset, code);
+			break;
+		case 64:
+			encodeInst(static_cast<WasmThreadsU32U32Opcode>(opcode + 1), 0x3, offset, code);
+			break;
+		default:
+			llvm::errs() << "bit width: " << bitWidth << '\n';
+			llvm_unreachable("unknown integer bit width");
+	}
+}
+
 void CheerpWasmWriter::encodePredicate(const llvm::Type* ty, const llvm::CmpInst::Predicate predicate, WasmBuffer& code)
 {
 	assert(ty->isIntegerTy() || ty->isPointerTy());
@@ -1101,6 +1253,40 @@ void CheerpWasmWriter::encodeLoad(const llvm::Type* ty, uint32_t offset,
 	}
 }
 
+void CheerpWasmWriter::encodeSignExtend(uint32_t bitWidth, WasmBuffer& code)
+{
+	assert(bitWidth < 32);
+	if(WasmSignExt && bitWidth == 8)
+		encodeInst(WasmOpcode::I32_EXTEND8_S, code);
+	else if(WasmSignExt && bitWidth == 16)
+		encodeInst(WasmOpcode::I32_EXTEND16_S, code);
+	else
+	{
+		encodeInst(WasmS32Opcode::I32_CONST, 32-bitWidth, code);
+		encodeInst(WasmOpcode::I32_SHL, code);
+		encodeInst(WasmS32Opcode::I32_CONST, 32-bitWidth, code);
+		encodeInst(WasmOpcode::I32_SHR_S, code);
+	}
+}
+
+void CheerpWasmWriter::encodeTruncSat(const llvm::Type* srcTy, const llvm::Type* dstTy, bool isSigned, WasmBuffer& code)
+{
+	if(srcTy->isFloatTy())
+	{
+		if(dstTy->isIntegerTy(64))
+			encodeInst(isSigned ? WasmFCOpcode::I64_TRUNC_SAT_F32_S : WasmFCOpcode::I64_TRUNC_SAT_F32_U, code);
+		else
+			encodeInst(isSigned ? WasmFCOpcode::I32_TRUNC_SAT_F32_S : WasmFCOpcode::I32_TRUNC_SAT_F32_U, code);
+	}
+	else
+	{
+		if(dstTy->isIntegerTy(64))
+			encodeInst(isSigned ? WasmFCOpcode::I64_TRUNC_SAT_F64_S : WasmFCOpcode::I64_TRUNC_SAT_F64_U, code);
+		else
+			encodeInst(isSigned ? WasmFCOpcode::I32_TRUNC_SAT_F64_S : WasmFCOpcode::I32_TRUNC_SAT_F64_U, code);
+	}
+}
+
 void CheerpWasmWriter::encodeWasmIntrinsic(WasmBuffer& code, const llvm::Function* F)
 {
 	const auto& builtin = TypedBuiltinInstr::getMathTypedBuiltin(*F);
@@ -1308,10 +1494,7 @@ void CheerpWasmWriter::compileSignedInteger(WasmBuffer& code, const llvm::Value*
 	}
 	else
 	{
-		encodeInst(WasmS32Opcode::I32_CONST, shiftAmount, code);
-		encodeInst(WasmOpcode::I32_SHL, code);
-		encodeInst(WasmS32Opcode::I32_CONST, shiftAmount, code);
-		encodeInst(WasmOpcode::I32_SHR_S, code);
+		encodeSignExtend(32-shiftAmount, code);
 	}
 }
 
@@ -1338,6 +1521,18 @@ void CheerpWasmWriter::compileUnsignedInteger(WasmBuffer& code, const llvm::Valu
 
 void CheerpWasmWriter::compileTypedZero(WasmBuffer& code, llvm::Type* t)
 {
+	if (StructType* st = dyn_cast<StructType>(t))
+	{
+		for (Type* e: st->elements())
+			compileTypedZero(code, e);
+		return;
+	}
+	if (t->isVectorTy())
+	{
+		uint8_t zeros[16] = {0};
+		encodeInst(WasmSIMDBytesOpcode::V128_CONST, zeros, code);
+		return;
+	}
 	// Encode a literal f64, f32 or i32 zero as the return value.
 	encodeLiteralType(t, code);
 	if (t->isDoubleTy()) {
@@ -1349,6 +1544,33 @@ void CheerpWasmWriter::compileTypedZero(WasmBuffer& code, llvm::Type* t)
 	}
 }
 
+void CheerpWasmWriter::compileAggregateElements(WasmBuffer& code, const llvm::Value* v)
+{
+	const StructType* st = cast<StructType>(v->getType());
+	for (uint32_t i = 0; i < st->getNumElements(); i++)
+	{
+		// Look for the last insertvalue for this element in the chain
+		const Value* agg = v;
+		while (const InsertValueInst* iv = dyn_cast<InsertValueInst>(agg))
+		{
+			if (iv->getIndices()[0] == i)
+				break;
+			agg = iv->getAggregateOperand();
+		}
+		if (const InsertValueInst* iv = dyn_cast<InsertValueInst>(agg))
+			compileOperand(code, iv->getInsertedValueOperand());
+		else if (const ConstantStruct* cs = dyn_cast<ConstantStruct>(agg))
+			compileOperand(code, cs->getOperand(i));
+		else
+		{
+			// zeroinitializer or undef. getAggregateElement would create a new
+			// constant, and methods may be compiled concurrently
+			assert(isa<ConstantAggregateZero>(agg) || isa<UndefValue>(agg));
+			compileTypedZero(code, st->getElementType(i));
+		}
+	}
+}
+
 void CheerpWasmWriter::compileConstantExpr(WasmBuffer& code, const ConstantExpr* ce)
 {
 	switch(ce->getOpcode())
@@ -1472,7 +1694,11 @@ void CheerpWasmWriter::compileConstant(WasmBuffer& code, const Constant* c, bool
 {
 	if (hasPutTeeLocalOnStack(code, c))
 		return;
-	if(const ConstantExpr* CE = dyn_cast<ConstantExpr>(c))
+	if(c->getType()->isVectorTy())
+	{
+		compileVectorConstant(code, c);
+	}
+	else if(const ConstantExpr* CE = dyn_cast<ConstantExpr>(c))
 	{
 		compileConstantExpr(code, CE);
 	}
@@ -1620,7 +1846,8 @@ const char* CheerpWasmWriter::getIntegerPredicate(llvm::CmpInst::Predicate p)
 bool CheerpWasmWriter::isSignedLoad(const Value* V) const
 {
 	const LoadInst* LI = dyn_cast<LoadInst>(V);
-	if(!LI)
+	// Atomic loads are always zero extended
+	if(!LI || LI->isAtomic())
 		return false;
 	if(GlobalVariable* ptrGV = dyn_cast<GlobalVariable>(LI->getOperand(0)))
 	{
@@ -1956,8 +2183,390 @@ void CheerpWasmWriter::flushSetLocalDependencies(WasmBuffer& code, const Instruc
 	flushGeneric(code, I, localsDependencies);
 }
 
+void CheerpWasmWriter::compileVectorConstant(WasmBuffer& code, const Constant* c)
+{
+	struct LaneListener: public LinearMemoryHelper::ByteListener
+	{
+		uint8_t* lane;
+		LaneListener(uint8_t* lane):lane(lane)
+		{
+		}
+		void addByte(uint8_t b) override
+		{
+			*(lane++) = b;
+		}
+	};
+	const VECTOR_SHAPE shape = getVectorShape(c->getType());
+	const uint32_t laneBytes = getVectorLaneBytes(shape);
+	const bool isMask = cast<VectorType>(c->getType())->getElementType()->isIntegerTy(1);
+	uint8_t bytes[16] = {0};
+	// The elements are not read with getAggregateElement, since it may create
+	// new constants and methods may be compiled concurrently
+	if (const ConstantVector* CV = dyn_cast<ConstantVector>(c))
+	{
+		for (uint32_t i = 0; i < CV->getNumOperands(); i++)
+		{
+			const Constant* element = CV->getOperand(i);
+			if (isa<UndefValue>(element))
+				continue;
+			if (isMask)
+			{
+				if (element->isOneValue())
+					std::fill(bytes + i * laneBytes, bytes + (i + 1) * laneBytes, 0xff);
+				continue;
+			}
+			LaneListener listener(bytes + i * laneBytes);
+			linearHelper.compileConstantAsBytes(element, /* asmjs */ true, &listener);
+		}
+	}
+	else if (isa<ConstantDataVector>(c))
+	{
+		LaneListener listener(bytes);
+		linearHelper.compileConstantAsBytes(c, /* asmjs */ true, &listener);
+	}
+	else if (!isa<ConstantAggregateZero>(c) && !isa<UndefValue>(c))
+	{
+#ifndef NDEBUG
+		c->dump();
+#endif
+		llvm::report_fatal_error("Cannot handle this vector constant");
+	}
+	encodeInst(WasmSIMDBytesOpcode::V128_CONST, bytes, code);
+}
+
+void CheerpWasmWriter::compileSplatScalar(WasmBuffer& code, const Value* v)
+{
+	// Wasm shifts take a single scalar amount for all the lanes
+	const Value* scalar = nullptr;
+	// The splat value of constant data and of zeroinitializer is a new
+	// constant, encode the amount directly
+	if (isa<ConstantAggregateZero>(v))
+	{
+		encodeInst(WasmS32Opcode::I32_CONST, 0, code);
+		return;
+	}
+	else if (const ConstantDataVector* CDV = dyn_cast<ConstantDataVector>(v))
+	{
+		if (CDV->isSplat())
+		{
+			encodeInst(WasmS32Opcode::I32_CONST, int32_t(CDV->getElementAsInteger(0)), code);
+			return;
+		}
+	}
+	else if (const ConstantVector* CV = dyn_cast<ConstantVector>(v))
+		scalar = CV->getSplatValue();
+	else if (const ShuffleVectorInst* SVI = dyn_cast<ShuffleVectorInst>(v))
+	{
+		const InsertElementInst* IEI = dyn_cast<InsertElementInst>(SVI->getOperand(0));
+		if (SVI->isZeroEltSplat() && IEI && isa<ConstantInt>(IEI->getOperand(2)) &&
+			cast<ConstantInt>(IEI->getOperand(2))->isZero())
+			scalar = IEI->getOperand(1);
+	}
+	if (!scalar)
+		llvm::report_fatal_error("Vector shifts are only supported with a splat amount in wasm");
+	compileOperand(code, scalar);
+	if (scalar->getType()->isIntegerTy(64))
+		encodeInst(WasmOpcode::I32_WRAP_I64, code);
+}
+
+void CheerpWasmWriter::compileVectorInstruction(WasmBuffer& code, const Instruction& I)
+{
+	const Type* t = isa<StoreInst>(I) ? cast<StoreInst>(I).getValueOperand()->getType() :
+			isa<ExtractElementInst>(I) || isa<CmpInst>(I) ? I.getOperand(0)->getType() : I.getType();
+	const VECTOR_SHAPE shape = getVectorShape(t);
+	const uint32_t laneBytes = getVectorLaneBytes(shape);
+	const bool isMask = cast<VectorType>(t)->getElementType()->isIntegerTy(1);
+	switch(I.getOpcode())
+	{
+#define VECTOROP(Ty, i8, i16, i32, i64, f32, f64) \
+		case Instruction::Ty: \
+		{ \
+			static const int opcodes[] = { i8, i16, i32, i64, f32, f64 }; \
+			if (opcodes[shape] < 0) \
+				llvm::report_fatal_error("Unsupported vector " #Ty " in wasm"); \
+			compileOperand(code, I.getOperand(0)); \
+			compileOperand(code, I.getOperand(1)); \
+			encodeInst(static_cast<WasmSIMDOpcode>(opcodes[shape]), code); \
+			return; \
+		}
+		VECTOROP( Add, 0x6e, 0x8e, 0xae, 0xce,   -1,   -1)
+		VECTOROP( Sub, 0x71, 0x91, 0xb1, 0xd1,   -1,   -1)
+		VECTOROP( Mul,   -1, 0x95, 0xb5, 0xd5,   -1,   -1)
+		VECTOROP( And, 0x4e, 0x4e, 0x4e, 0x4e,   -1,   -1)
+		VECTOROP(  Or, 0x50, 0x50, 0x50, 0x50,   -1,   -1)
+		VECTOROP(FAdd,   -1,   -1,   -1,   -1, 0xe4, 0xf0)
+		VECTOROP(FMul,   -1,   -1,   -1,   -1, 0xe6, 0xf2)
+		VECTOROP(FDiv,   -1,   -1,   -1,   -1, 0xe7, 0xf3)
+#undef VECTOROP
+		case Instruction::Xor:
+		{
+			compileOperand(code, I.getOperand(0));
+			// xor with all ones is a bitwise not
+			if (isa<Constant>(I.getOperand(1)) && cast<Constant>(I.getOperand(1))->isAllOnesValue())
+			{
+				encodeInst(WasmSIMDOpcode::V128_NOT, code);
+				return;
+			}
+			compileOperand(code, I.getOperand(1));
+			encodeInst(WasmSIMDOpcode::V128_XOR, code);
+			return;
+		}
+		case Instruction::FSub:
+		{
+			const bool isNeg = isa<Constant>(I.getOperand(0)) && cast<Constant>(I.getOperand(0))->isNegativeZeroValue();
+			if (!isNeg)
+				compileOperand(code, I.getOperand(0));
+			compileOperand(code, I.getOperand(1));
+			if (shape == F32X4)
+				encodeInst(isNeg ? WasmSIMDOpcode::F32X4_NEG : WasmSIMDOpcode::F32X4_SUB, code);
+			else
+				encodeInst(isNeg ? WasmSIMDOpcode::F64X2_NEG : WasmSIMDOpcode::F64X2_SUB, code);
+			return;
+		}
+		case Instruction::FNeg:
+		{
+			compileOperand(code, I.getOperand(0));
+			encodeInst(shape == F32X4 ? WasmSIMDOpcode::F32X4_NEG : WasmSIMDOpcode::F64X2_NEG, code);
+			return;
+		}
+#define VECTORSHIFT(Ty, name) \
+		case Instruction::Ty: \
+		{ \
+			compileOperand(code, I.getOperand(0)); \
+			compileSplatScalar(code, I.getOperand(1)); \
+			switch (shape) \
+			{ \
+				case I8X16: encodeInst(WasmSIMDOpcode::I8X16_##name, code); break; \
+				case I16X8: encodeInst(WasmSIMDOpcode::I16X8_##name, code); break; \
+				case I32X4: encodeInst(WasmSIMDOpcode::I32X4_##name, code); break; \
+				default: encodeInst(WasmSIMDOpcode::I64X2_##name, code); break; \
+			} \
+			return; \
+		}
+		VECTORSHIFT( Shl,   SHL)
+		VECTORSHIFT(AShr, SHR_S)
+		VECTORSHIFT(LShr, SHR_U)
+#undef VECTORSHIFT
+		case Instruction::ICmp:
+		{
+			const ICmpInst& ci = cast<ICmpInst>(I);
+			compileOperand(code, ci.getOperand(0));
+			compileOperand(code, ci.getOperand(1));
+			switch(ci.getPredicate())
+			{
+#define VECTORPREDICATE(Ty, name) \
+				case CmpInst::ICMP_##Ty: \
+					switch (shape) \
+					{ \
+						case I8X16: encodeInst(WasmSIMDOpcode::I8X16_##name, code); break; \
+						case I16X8: encodeInst(WasmSIMDOpcode::I16X8_##name, code); break; \
+						case I32X4: encodeInst(WasmSIMDOpcode::I32X4_##name, code); break; \
+						default: llvm::report_fatal_error("Unsupported i64x2 comparison in wasm"); \
+					} \
+					return;
+				VECTORPREDICATE(ULT, LT_U)
+				VECTORPREDICATE(UGT, GT_U)
+				VECTORPREDICATE(ULE, LE_U)
+				VECTORPREDICATE(UGE, GE_U)
+#undef VECTORPREDICATE
+#define VECTORPREDICATE(Ty, name) \
+				case CmpInst::ICMP_##Ty: \
+					switch (shape) \
+					{ \
+						case I8X16: encodeInst(WasmSIMDOpcode::I8X16_##name, code); break; \
+						case I16X8: encodeInst(WasmSIMDOpcode::I16X8_##name, code); break; \
+						case I32X4: encodeInst(WasmSIMDOpcode::I32X4_##name, code); break; \
+						default: encodeInst(WasmSIMDOpcode::I64X2_##name, code); break; \
+					} \
+					return;
+				VECTORPREDICATE( EQ,   EQ)
+				VECTORPREDICATE( NE,   NE)
+				VECTORPREDICATE(SLT, LT_S)
+				VECTORPREDICATE(SGT, GT_S)
+				VECTORPREDICATE(SLE, LE_S)
+				VECTORPREDICATE(SGE, GE_S)
+#undef VECTORPREDICATE
+				default:
+					llvm_unreachable("unknown predicate");
+			}
+		}
+		case Instruction::FCmp:
+		{
+			const FCmpInst& ci = cast<FCmpInst>(I);
+			compileOperand(code, ci.getOperand(0));
+			compileOperand(code, ci.getOperand(1));
+			switch(ci.getPredicate())
+			{
+				// Wasm comparisons are ordered, except for ne
+#define VECTORPREDICATE(Ty, name) \
+				case CmpInst::FCMP_##Ty: \
+					if (shape == F32X4) \
+						encodeInst(WasmSIMDOpcode::F32X4_##name, code); \
+					else \
+						encodeInst(WasmSIMDOpcode::F64X2_##name, code); \
+					return;
+				VECTORPREDICATE(OEQ, EQ)
+				VECTORPREDICATE(UNE, NE)
+				VECTORPREDICATE(OLT, LT)
+				VECTORPREDICATE(OGT, GT)
+				VECTORPREDICATE(OLE, LE)
+				VECTORPREDICATE(OGE, GE)
+#undef VECTORPREDICATE
+				default:
+					llvm::report_fatal_error("Unsupported vector floating point comparison in wasm");
+			}
+		}
+		case Instruction::Select:
+		{
+			const SelectInst& si = cast<SelectInst>(I);
+			compileOperand(code, si.getTrueValue());
+			compileOperand(code, si.getFalseValue());
+			if (si.getCondition()->getType()->isVectorTy())
+			{
+				compileOperand(code, si.getCondition());
+				encodeInst(WasmSIMDOpcode::V128_BITSELECT, code);
+			}
+			else
+			{
+				compileCondition(code, si.getCondition(), /*booleanInvert*/false);
+				encodeInst(WasmOpcode::SELECT, code);
+			}
+			return;
+		}
+		case Instruction::SExt:
+		case Instruction::ZExt:
+		{
+			// Masks already have all the bits of the lane set
+			if (!cast<VectorType>(I.getOperand(0)->getType())->getElementType()->isIntegerTy(1))
+				llvm::report_fatal_error("Unsupported vector extension in wasm");
+			compileOperand(code, I.getOperand(0));
+			if (I.getOpcode() == Instruction::ZExt)
+			{
+				// A splat of 1 in every lane
+				uint8_t ones[16] = {0};
+				for (uint32_t i = 0; i < 16; i += laneBytes)
+					ones[i] = 1;
+				encodeInst(WasmSIMDBytesOpcode::V128_CONST, ones, code);
+				encodeInst(WasmSIMDOpcode::V128_AND, code);
+			}
+			return;
+		}
+		case Instruction::SIToFP:
+		case Instruction::UIToFP:
+		case Instruction::FPToSI:
+		case Instruction::FPToUI:
+		{
+			if (shape != F32X4 && shape != I32X4)
+				llvm::report_fatal_error("Unsupported vector conversion in wasm");
+			compileOperand(code, I.getOperand(0));
+			switch (I.getOpcode())
+			{
+				case Instruction::SIToFP:
+					encodeInst(WasmSIMDOpcode::F32X4_CONVERT_I32X4_S, code);
+					break;
+				case Instruction::UIToFP:
+					encodeInst(WasmSIMDOpcode::F32X4_CONVERT_I32X4_U, code);
+					break;
+				// Out of range values are poison, so saturating is fine
+				case Instruction::FPToSI:
+					encodeInst(WasmSIMDOpcode::I32X4_TRUNC_SAT_F32X4_S, code);
+					break;
+				default:
+					encodeInst(WasmSIMDOpcode::I32X4_TRUNC_SAT_F32X4_U, code);
+					break;
+			}
+			return;
+		}
+		case Instruction::BitCast:
+		{
+			// Bitcasts between 128-bit vectors are no-ops
+			getVectorShape(I.getOperand(0)->getType());
+			compileOperand(code, I.getOperand(0));
+			return;
+		}
+		case Instruction::Load:
+		{
+			if (isMask)
+				llvm::report_fatal_error("Unsupported load of a vector of i1 in wasm");
+			uint32_t offset = compileLoadStorePointer(code, cast<LoadInst>(I).getPointerOperand());
+			encodeInst(WasmSIMDU32U32Opcode::V128_LOAD, 0x4, offset, code);
+			return;
+		}
+		case Instruction::Store:
+		{
+			if (isMask)
+				llvm::report_fatal_error("Unsupported store of a vector of i1 in wasm");
+			const StoreInst& si = cast<StoreInst>(I);
+			uint32_t offset = compileLoadStorePointer(code, si.getPointerOperand());
+			compileOperand(code, si.getValueOperand());
+			encodeInst(WasmSIMDU32U32Opcode::V128_STORE, 0x4, offset, code);
+			return;
+		}
+		case Instruction::ExtractElement:
+		case Instruction::InsertElement:
+		{
+			const bool isExtract = isa<ExtractElementInst>(I);
+			const Value* index = I.getOperand(isExtract ? 1 : 2);
+			if (!isa<ConstantInt>(index) || isMask)
+				llvm::report_fatal_error("Unsupported vector element access in wasm");
+			uint8_t lane = cast<ConstantInt>(index)->getZExtValue();
+			compileOperand(code, I.getOperand(0));
+			if (!isExtract)
+				compileOperand(code, I.getOperand(1));
+			// Extract opcodes are at even offsets from the replace ones, narrow lanes are zero extended
+			static const uint32_t extractOpcodes[] = { 0x16, 0x19, 0x1b, 0x1d, 0x1f, 0x21 };
+			static const uint32_t replaceOpcodes[] = { 0x17, 0x1a, 0x1c, 0x1e, 0x20, 0x22 };
+			encodeInst(static_cast<WasmSIMDLaneOpcode>(isExtract ? extractOpcodes[shape] : replaceOpcodes[shape]), lane, code);
+			return;
+		}
+		case Instruction::ShuffleVector:
+		{
+			const ShuffleVectorInst& svi = cast<ShuffleVectorInst>(I);
+			if (svi.changesLength())
+				llvm::report_fatal_error("Unsupported vector shuffle changing the length in wasm");
+			const InsertElementInst* iei = dyn_cast<InsertElementInst>(svi.getOperand(0));
+			if (svi.isZeroEltSplat() && iei && isa<ConstantInt>(iei->getOperand(2)) &&
+				cast<ConstantInt>(iei->getOperand(2))->isZero())
+			{
+				// Splat of a scalar, the other lanes of the insertelement are never used
+				static const uint32_t splatOpcodes[] = { 0x0f, 0x10, 0x11, 0x12, 0x13, 0x14 };
+				compileOperand(code, iei->getOperand(1));
+				encodeInst(static_cast<WasmSIMDOpcode>(splatOpcodes[shape]), code);
+				return;
+			}
+			uint8_t bytes[16];
+			for (uint32_t i = 0; i < 16 / laneBytes; i++)
+			{
+				int maskValue = svi.getMaskValue(i);
+				// Undef lanes can take any value
+				if (maskValue < 0)
+					maskValue = 0;
+				for (uint32_t j = 0; j < laneBytes; j++)
+					bytes[i * laneBytes + j] = maskValue * laneBytes + j;
+			}
+			compileOperand(code, svi.getOperand(0));
+			compileOperand(code, svi.getOperand(1));
+			encodeInst(WasmSIMDBytesOpcode::I8X16_SHUFFLE, bytes, code);
+			return;
+		}
+		default:
+		{
+#ifndef NDEBUG
+			I.dump();
+#endif
+			llvm::report_fatal_error("Unsupported vector instruction in wasm");
+		}
+	}
+}
+
 bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruction& I)
 {
+	if((I.getType()->isVectorTy() && !isa<CallInst>(I)) || isa<ExtractElementInst>(I) ||
+		(isa<StoreInst>(I) && I.getOperand(0)->getType()->isVectorTy()))
+	{
+		compileVectorInstruction(code, I);
+		return false;
+	}
 	switch(I.getOpcode())
 	{
 		case Instruction::Alloca:
@@ -2034,6 +2643,35 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 						// NOTE: No point in adding a return even if 'useTailCall' is true
 						return true;
 					}
+					case Intrinsic::wasm_atomic_wait_i32:
+					case Intrinsic::wasm_atomic_wait_i64:
+					{
+						uint32_t offset = compileLoadStorePointer(code, ci.getOperand(0));
+						compileOperand(code, ci.getOperand(1));
+						compileOperand(code, ci.getOperand(2));
+						if(intrinsicId == Intrinsic::wasm_atomic_wait_i32)
+							encodeInst(WasmThreadsU32U32Opcode::MEMORY_ATOMIC_WAIT32, 0x2, offset, code);
+						else
+							encodeInst(WasmThreadsU32U32Opcode::MEMORY_ATOMIC_WAIT64, 0x3, offset, code);
+						if(useTailCall)
+						{
+							encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
+						return false;
+					}
+					case Intrinsic::wasm_atomic_notify:
+					{
+						uint32_t offset = compileLoadStorePointer(code, ci.getOperand(0));
+						compileOperand(code, ci.getOperand(1));
+						encodeInst(WasmThreadsU32U32Opcode::MEMORY_ATOMIC_NOTIFY, 0x2, offset, code);
+						if(useTailCall)
+						{
+							encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
+						return false;
+					}
 					case Intrinsic::stacksave:
 					{
 						encodeInst(WasmU32Opcode::GET_GLOBAL, stackTopGlobal, code);
@@ -2180,6 +2818,14 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 						compileOperand(code, ci.op_begin()->get());
 						compileOperand(code, (ci.op_begin() + 1)->get());
 						compileOperand(code, (ci.op_begin() + 2)->get());
+						if(WasmBulkMemory)
+						{
+							// Both memory indices are 0, the only memory
+							encodeInst(WasmFCU32U32Opcode::MEMORY_COPY, 0, 0, code);
+							if(useTailCall)
+								encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
 						llvm::Function* f = module.getFunction("memmove");
 						uint32_t functionId = linearHelper.getFunctionIds().at(f);
 						encodeInst(WasmU32Opcode::CALL, functionId, code);
@@ -2194,6 +2840,14 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 						compileOperand(code, ci.op_begin()->get());
 						compileOperand(code, (ci.op_begin() + 1)->get());
 						compileOperand(code, (ci.op_begin() + 2)->get());
+						if(WasmBulkMemory)
+						{
+							// Both memory indices are 0, the only memory
+							encodeInst(WasmFCU32U32Opcode::MEMORY_COPY, 0, 0, code);
+							if(useTailCall)
+								encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
 						llvm::Function* f = module.getFunction("memcpy");
 						uint32_t functionId = linearHelper.getFunctionIds().at(f);
 						encodeInst(WasmU32Opcode::CALL, functionId, code);
@@ -2208,6 +2862,14 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 						compileOperand(code, ci.op_begin()->get());
 						compileOperand(code, (ci.op_begin() + 1)->get());
 						compileOperand(code, (ci.op_begin() + 2)->get());
+						if(WasmBulkMemory)
+						{
+							// The memory index is 0, the only memory
+							encodeInst(WasmFCU32Opcode::MEMORY_FILL, 0, code);
+							if(useTailCall)
+								encodeInst(WasmOpcode::RETURN, code);
+							return true;
+						}
 						llvm::Function* f = module.getFunction("memset");
 						uint32_t functionId = linearHelper.getFunctionIds().at(f);
 						encodeInst(WasmU32Opcode::CALL, functionId, code);
@@ -2461,6 +3123,16 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 		case Instruction::Load:
 		{
 			const LoadInst& li = cast<LoadInst>(I);
+			if(li.isAtomic())
+			{
+				uint32_t offset = compileLoadStorePointer(code, li.getPointerOperand());
+				encodeAtomicInst(WasmThreadsU32U32Opcode::I32_ATOMIC_LOAD, li.getType(), offset, code);
+				if(li.getType()->isFloatTy())
+					encodeInst(WasmOpcode::F32_REINTERPRET_I32, code);
+				else if(li.getType()->isDoubleTy())
+					encodeInst(WasmOpcode::F64_REINTERPRET_I64, code);
+				break;
+			}
 			if(GlobalVariable* ptrGV = dyn_cast<GlobalVariable>(li.getOperand(0)))
 			{
 				auto it = globalizedGlobalsIDs.find(ptrGV);
@@ -2486,6 +3158,17 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 			const StoreInst& si = cast<StoreInst>(I);
 			const Value* ptrOp=si.getPointerOperand();
 			const Value* valOp=si.getValueOperand();
+			if(si.isAtomic())
+			{
+				uint32_t offset = compileLoadStorePointer(code, ptrOp);
+				compileOperand(code, valOp);
+				if(valOp->getType()->isFloatTy())
+					encodeInst(WasmOpcode::I32_REINTERPRET_F32, code);
+				else if(valOp->getType()->isDoubleTy())
+					encodeInst(WasmOpcode::I64_REINTERPRET_F64, code);
+				encodeAtomicInst(WasmThreadsU32U32Opcode::I32_ATOMIC_STORE, valOp->getType(), offset, code);
+				break;
+			}
 			if(const GlobalVariable* ptrGV = dyn_cast<GlobalVariable>(ptrOp))
 			{
 				auto it = globalizedGlobalsIDs.find(ptrGV);
@@ -2554,6 +3237,106 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 			}
 			break;
 		}
+		case Instruction::AtomicRMW:
+		{
+			// Operations without a wasm opcode are expanded by AtomicLowering
+			const AtomicRMWInst& ai = cast<AtomicRMWInst>(I);
+			uint32_t offset = compileLoadStorePointer(code, ai.getPointerOperand());
+			compileOperand(code, ai.getValOperand());
+			WasmThreadsU32U32Opcode op;
+			switch(ai.getOperation())
+			{
+				case AtomicRMWInst::Xchg:
+					op = WasmThreadsU32U32Opcode::I32_ATOMIC_RMW_XCHG;
+					break;
+				case AtomicRMWInst::Add:
+					op = WasmThreadsU32U32Opcode::I32_ATOMIC_RMW_ADD;
+					break;
+				case AtomicRMWInst::Sub:
+					op = WasmThreadsU32U32Opcode::I32_ATOMIC_RMW_SUB;
+					break;
+				case AtomicRMWInst::And:
+					op = WasmThreadsU32U32Opcode::I32_ATOMIC_RMW_AND;
+					break;
+				case AtomicRMWInst::Or:
+					op = WasmThreadsU32U32Opcode::I32_ATOMIC_RMW_OR;
+					break;
+				case AtomicRMWInst::Xor:
+					op = WasmThreadsU32U32Opcode::I32_ATOMIC_RMW_XOR;
+					break;
+				default:
+					llvm::report_fatal_error("Unsupported atomicrmw operation in wasm");
+			}
+			encodeAtomicInst(op, ai.getType(), offset, code);
+			break;
+		}
+		case Instruction::AtomicCmpXchg:
+		{
+			// Only the loaded value is produced, the success flag is an explicit comparison (see AtomicLowering)
+			const AtomicCmpXchgInst& ci = cast<AtomicCmpXchgInst>(I);
+			uint32_t offset = compileLoadStorePointer(code, ci.getPointerOperand());
+			compileOperand(code, ci.getCompareOperand());
+			compileOperand(code, ci.getNewValOperand());
+			encodeAtomicInst(WasmThreadsU32U32Opcode::I32_ATOMIC_RMW_CMPXCHG, ci.getCompareOperand()->getType(), offset, code);
+			break;
+		}
+		case Instruction::ExtractValue:
+		{
+			// The only aggregates that reach the writer are the results of cmpxchg and multi-value calls
+			const ExtractValueInst& ev = cast<ExtractValueInst>(I);
+			if (const CallInst* ci = dyn_cast<CallInst>(ev.getAggregateOperand()))
+			{
+				// The first extractvalue renders the call, then assigns all the results (see MultiValueReturns)
+				assert(ev.getPrevNode() == ci);
+				uint32_t numResults = cast<StructType>(ci->getType())->getNumElements();
+				SmallVector<const ExtractValueInst*, 4> results(numResults, nullptr);
+				for (const Instruction* next = &ev; next; next = next->getNextNode())
+				{
+					const ExtractValueInst* nextEv = dyn_cast<ExtractValueInst>(next);
+					if (!nextEv || nextEv->getAggregateOperand() != ci)
+						break;
+					results[nextEv->getIndices()[0]] = nextEv;
+				}
+				// Make sure the old values of the locals are not needed anymore
+				for (const ExtractValueInst* result: results)
+				{
+					if (result)
+						flushSetLocalDependencies(code, *result);
+				}
+				compileInlineInstruction(code, *ci);
+				// The results are on the stack, the last one on top
+				for (uint32_t i = numResults; i-- > 1;)
+				{
+					const ExtractValueInst* result = results[i];
+					if (!result || result->use_empty())
+					{
+						encodeInst(WasmOpcode::DROP, code);
+						continue;
+					}
+					// The extract of index 0 may have been removed, this one is then not the first result
+					if (result != &ev)
+					{
+						assert(compiled.count(result) == 0);
+						compiled.insert(result);
+					}
+					uint32_t reg = registerize.getRegisterId(result, edgeContext);
+					encodeInst(WasmU32Opcode::SET_LOCAL, localMap.at(reg), code);
+				}
+				// The first result is assigned as the value of this instruction
+				if (results[0] == &ev)
+					break;
+				encodeInst(WasmOpcode::DROP, code);
+				return true;
+			}
+			assert(isa<AtomicCmpXchgInst>(ev.getAggregateOperand()) && ev.getIndices()[0] == 0);
+			compileInlineInstruction(code, *cast<Instruction>(ev.getAggregateOperand()));
+			break;
+		}
+		case Instruction::Fence:
+		{
+			encodeInst(WasmThreadsOpcode::ATOMIC_FENCE, code);
+			break;
+		}
 		case Instruction::Switch:
 			break;
 		case Instruction::Trunc:
@@ -2574,7 +3357,10 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 				//       so blindly casting it to Instruction is safe
 				if(isReturnPartOfTailCall(ri) && !isInlineable(*cast<Instruction>(retVal)))
 					break;
-				compileOperand(code, I.getOperand(0));
+				if(retVal->getType()->isStructTy())
+					compileAggregateElements(code, retVal);
+				else
+					compileOperand(code, I.getOperand(0));
 			}
 			break;
 		}
@@ -2595,12 +3381,7 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 			{
 				uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
 				if (bitWidth < 32)
-				{
-					encodeInst(WasmS32Opcode::I32_CONST, 32-bitWidth, code);
-					encodeInst(WasmOpcode::I32_SHL, code);
-					encodeInst(WasmS32Opcode::I32_CONST, 32-bitWidth, code);
-					encodeInst(WasmOpcode::I32_SHR_S, code);
-				}
+					encodeSignExtend(bitWidth, code);
 			}
 			// TODO convert directly to i64 without passing from i32
 			if (I.getType()->isIntegerTy(64))
@@ -2628,6 +3409,12 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 						encodeInst(WasmOpcode::I32_TRUNC_S_F64, code);
 				}
 			}
+			else if(WasmNontrappingFPToInt)
+			{
+				// The saturating opcodes never trap
+				compileOperand(code, I.getOperand(0));
+				encodeTruncSat(I.getOperand(0)->getType(), I.getType(), /*isSigned*/true, code);
+			}
 			else if (I.getOperand(0)->getType()->isFloatTy())
 			{
 				int bits = I.getType()->getIntegerBitWidth();
@@ -2704,6 +3491,12 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 						encodeInst(WasmOpcode::I32_TRUNC_U_F64, code);
 				}
 			}
+			else if(WasmNontrappingFPToInt)
+			{
+				// The saturating opcodes never trap
+				compileOperand(code, I.getOperand(0));
+				encodeTruncSat(I.getOperand(0)->getType(), I.getType(), /*isSigned*/false, code);
+			}
 			else if (I.getOperand(0)->getType()->isFloatTy())
 			{
 				int bits = I.getType()->getIntegerBitWidth();
@@ -2776,10 +3569,7 @@ bool CheerpWasmWriter::compileInlineInstruction(WasmBuffer& code, const Instruct
 			if(bitWidth < 32)
 			{
 				// Sign extend
-				encodeInst(WasmS32Opcode::I32_CONST, 32-bitWidth, code);
-				encodeInst(WasmOpcode::I32_SHL, code);
-				encodeInst(WasmS32Opcode::I32_CONST, 32-bitWidth, code);
-				encodeInst(WasmOpcode::I32_SHR_S, code);
+				encodeSignExtend(bitWidth, code);
 			}
 			if (I.getType()->isDoubleTy()) {
 				if (bitWidth == 64)
@@ -2871,6 +3661,16 @@ void CheerpWasmWriter::compileInstructionAndSet(WasmBuffer& code, const llvm::In
 		return;
 	if (isa<PHINode>(&I) || isInlineable(I))
 		return;
+	if (const ExtractValueInst* ev = dyn_cast<ExtractValueInst>(&I))
+	{
+		// Only the first extractvalue of a multi-value call is compiled, it assigns all the results
+		const Instruction* ci = dyn_cast<CallInst>(ev->getAggregateOperand());
+		if (ci && ev->getPrevNode() != ci)
+		{
+			compileInstructionAndSet(code, *ci->getNextNode());
+			return;
+		}
+	}
 	if(const IntrinsicInst* II=dyn_cast<IntrinsicInst>(&I))
 	{
 		//Skip some kind of intrinsics
@@ -2908,7 +3708,10 @@ void CheerpWasmWriter::compileInstructionAndSet(WasmBuffer& code, const llvm::In
 	if(!ret && !I.getType()->isVoidTy())
 	{
 		if(I.use_empty()) {
-			encodeInst(WasmOpcode::DROP, code);
+			// Only multi-value calls push more than one value, cmpxchg pushes just the loaded value
+			uint32_t numResults = isa<CallInst>(I) && I.getType()->isStructTy() ? I.getType()->getStructNumElements() : 1;
+			for(uint32_t i = 0; i < numResults; i++)
+				encodeInst(WasmOpcode::DROP, code);
 		} else {
 			uint32_t reg = registerize.getRegisterId(&I, edgeContext);
 			uint32_t local = localMap.at(reg);
@@ -3114,6 +3917,7 @@ void CheerpWasmWriter::compileMethodLocals(WasmBuffer& code, const vector<int>&
 	groups += (uint32_t) locals.at(Registerize::DOUBLE) > 0;
 	groups += (uint32_t) locals.at(Registerize::FLOAT) > 0;
 	groups += (uint32_t) locals.at(Registerize::OBJECT) > 0;
+	groups += (uint32_t) locals.at(Registerize::VECTOR) > 0;
 
 	// Local declarations are compressed into a vector whose entries
 	// consist of:
@@ -3148,6 +3952,11 @@ void CheerpWasmWriter::compileMethodLocals(WasmBuffer& code, const vector<int>&
 		encodeULEB128(locals.at(Registerize::OBJECT), code);
 		encodeRegisterKind(Registerize::OBJECT, code);
 	}
+
+	if (locals.at(Registerize::VECTOR)) {
+		encodeULEB128(locals.at(Registerize::VECTOR), code);
+		encodeRegisterKind(Registerize::VECTOR, code);
+	}
 }
 
 void CheerpWasmWriter::compileMethodParams(WasmBuffer& code, const FunctionType* fTy)
@@ -3165,6 +3974,12 @@ void CheerpWasmWriter::compileMethodResult(WasmBuffer& code, const Type* ty)
 	{
 		encodeULEB128(0, code);
 	}
+	else if (const StructType* st = dyn_cast<StructType>(ty))
+	{
+		encodeULEB128(st->getNumElements(), code);
+		for (const Type* e: st->elements())
+			encodeValType(e, code);
+	}
 	else
 	{
 		encodeULEB128(1, code);
@@ -3299,8 +4114,8 @@ static int getResultKind(const Token& T)
 	const int kind = T.getResultType();
 
 	//getResultType will map to the proper kind only for
-	//	NONE -> 0x40 and {I32, I64, F32 and F64} -> {0x7F, 0x7E, 0x7D, 0x7C}
-	if (kind != 0x40 && (kind > 0x7F || kind < 0x7C))
+	//	NONE -> 0x40 and {I32, I64, F32, F64 and V128} -> {0x7F, 0x7E, 0x7D, 0x7C, 0x7B}
+	if (kind != 0x40 && (kind > 0x7F || kind < 0x7B))
 		llvm_unreachable("Unexpected result type");
 
 	//currently anyref or multi-values are not handled
@@ -3498,7 +4313,7 @@ void CheerpWasmWriter::compileMethod(WasmBuffer& code, const Function& F)
 	const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&F);
 	uint32_t localCount = regsInfo.size() + (int)needsLabel;
 
-	vector<int> locals(5, 0);
+	vector<int> locals(6, 0);
 	localMap.assign(localCount, 0);
 	uint32_t reg = 0;
 
@@ -3545,6 +4360,13 @@ void CheerpWasmWriter::compileMethod(WasmBuffer& code, const Function& F)
 				offset += locals.at((int)Registerize::DOUBLE);
 				offset += locals.at((int)Registerize::FLOAT);
 				break;
+			case Registerize::VECTOR:
+				offset += locals.at((int)Registerize::INTEGER);
+				offset += locals.at((int)Registerize::INTEGER64);
+				offset += locals.at((int)Registerize::DOUBLE);
+				offset += locals.at((int)Registerize::FLOAT);
+				offset += locals.at((int)Registerize::OBJECT);
+				break;
 		}
 		localMap[reg++] += offset;
 	}
@@ -3573,8 +4395,16 @@ void CheerpWasmWriter::compileMethod(WasmBuffer& code, const Function& F)
 		}
 		else
 		{
-			DominatorTree &DT = pass.getAnalysis<DominatorTreeWrapperPass>(const_cast<Function&>(F)).getDomTree();
-			LoopInfo &LI = pass.getAnalysis<LoopInfoWrapperPass>(const_cast<Function&>(F)).getLoopInfo();
+			// Concurrent workers can't use the pass manager, they compute the same analyses locally
+			DominatorTree localDT;
+			LoopInfo localLI;
+			if (isConcurrentWorker)
+			{
+				localDT.recalculate(const_cast<Function&>(F));
+				localLI.analyze(localDT);
+			}
+			DominatorTree &DT = isConcurrentWorker ? localDT : pass.getAnalysis<DominatorTreeWrapperPass>(const_cast<Function&>(F)).getDomTree();
+			LoopInfo &LI = isConcurrentWorker ? localLI : pass.getAnalysis<LoopInfoWrapperPass>(const_cast<Function&>(F)).getLoopInfo();
 			CFGStackifier CN(F, LI, DT, registerize, PA, CFGStackifier::Wasm);
 
 			const auto possibleBBs = CN.selectBasicBlocksWithPossibleIncomingResult();
@@ -3641,15 +4471,41 @@ void CheerpWasmWriter::generateNOP(WasmBuffer& code)
 	}
 }
 
+uint32_t CheerpWasmWriter::getInitMemoryFunctionId() const
+{
+	// The imports come first, and only the methods within the limit are emitted
+	uint32_t numFunctions = linearHelper.functions().size();
+	uint32_t numImports = linearHelper.getMaxFunctionId() - numFunctions;
+	return numImports + std::min(numFunctions, COMPILE_METHOD_LIMIT);
+}
+
+bool CheerpWasmWriter::needsInitMemoryType() const
+{
+	if (!usePassiveSegments())
+		return false;
+	const FunctionType* fTy = FunctionType::get(Type::getVoidTy(Ctx), false);
+	return !linearHelper.getFunctionTypeIndices().count(fTy);
+}
+
+uint32_t CheerpWasmWriter::getInitMemoryTypeIndex() const
+{
+	const FunctionType* fTy = FunctionType::get(Type::getVoidTy(Ctx), false);
+	const auto& found = linearHelper.getFunctionTypeIndices().find(fTy);
+	if (found != linearHelper.getFunctionTypeIndices().end())
+		return found->second;
+	return linearHelper.getFunctionTypes().size();
+}
+
 void CheerpWasmWriter::compileTypeSection()
 {
-	if (linearHelper.getFunctionTypes().empty())
+	const bool extraType = needsInitMemoryType();
+	if (linearHelper.getFunctionTypes().empty() && !extraType)
 		return;
 
 	Section section(0x01, "Type", this);
 
 	// Encode number of entries in the type section.
-	encodeULEB128(linearHelper.getFunctionTypes().size(), section);
+	encodeULEB128(linearHelper.getFunctionTypes().size() + extraType, section);
 
 	// Define function type variables
 	for (const auto& fTy : linearHelper.getFunctionTypes())
@@ -3658,6 +4514,13 @@ void CheerpWasmWriter::compileTypeSection()
 		compileMethodParams(section, fTy);
 		compileMethodResult(section, fTy->getReturnType());
 	}
+	if (extraType)
+	{
+		FunctionType* fTy = FunctionType::get(Type::getVoidTy(Ctx), false);
+		encodeULEB128(0x60, section);
+		compileMethodParams(section, fTy);
+		compileMethodResult(section, fTy->getReturnType());
+	}
 }
 
 void CheerpWasmWriter::compileImport(WasmBuffer& code, StringRef funcName, FunctionType* fTy)
@@ -3694,7 +4557,7 @@ void CheerpWasmWriter::compileImportSection()
 			importedBuiltins++;
 	}
 
-	uint32_t importedTotal = importedBuiltins + globalDeps.asmJSImports().size();
+	uint32_t importedTotal = importedBuiltins + globalDeps.asmJSImports().size() + useWorkers();
 
 	if (importedTotal == 0 || !useWasmLoader)
 		return;
@@ -3737,11 +4600,24 @@ void CheerpWasmWriter::compileImportSection()
 		compileImport(section, namegen.getBuiltinName(NameGenerator::TAN), f64_f64_1);
 	if(globalDeps.needsBuiltin(BuiltinInstr::BUILTIN::GROW_MEM))
 		compileImport(section, namegen.getBuiltinName(NameGenerator::GROW_MEM), i32_i32_1);
+	if(useWorkers())
+	{
+		// The shared memory is created by the loader, and passed to every worker
+		std::string moduleName = "i";
+		encodeULEB128(moduleName.size(), section);
+		section.write(moduleName.data(), moduleName.size());
+		StringRef fieldName = namegen.getBuiltinName(NameGenerator::MEMORY);
+		encodeULEB128(fieldName.size(), section);
+		section.write(fieldName.data(), fieldName.size());
+		// Encode kind as 'Memory' (= 2).
+		encodeULEB128(0x02, section);
+		encodeMemoryLimits(section);
+	}
 }
 
 void CheerpWasmWriter::compileFunctionSection()
 {
-	if (linearHelper.getFunctionTypes().empty())
+	if (linearHelper.getFunctionTypes().empty() && !usePassiveSegments())
 		return;
 
 	Section section(0x03, "Function", this);
@@ -3750,7 +4626,7 @@ void CheerpWasmWriter::compileFunctionSection()
 	count = std::min(count, COMPILE_METHOD_LIMIT); // TODO
 
 	// Encode number of entries in the function section.
-	encodeULEB128(count, section);
+	encodeULEB128(count + usePassiveSegments(), section);
 
 	// Define function type ids
 	size_t i = 0;
@@ -3764,6 +4640,9 @@ void CheerpWasmWriter::compileFunctionSection()
 		if (++i >= COMPILE_METHOD_LIMIT)
 			break; // TODO
 	}
+
+	if (usePassiveSegments())
+		encodeULEB128(getInitMemoryTypeIndex(), section);
 }
 
 
@@ -3835,7 +4714,7 @@ CheerpWasmWriter::GLOBAL_CONSTANT_ENCODING CheerpWasmWriter::shouldEncodeConstan
 	}
 }
 
-void CheerpWasmWriter::compileMemoryAndGlobalSection()
+void CheerpWasmWriter::encodeMemoryLimits(WasmBuffer& code) const
 {
 	// Define the memory for the module in WasmPage units. The heap size is
 	// defined in MiB and the wasm page size is 64 KiB. Thus, the wasm heap
@@ -3849,20 +4728,27 @@ void CheerpWasmWriter::compileMemoryAndGlobalSection()
 	if (noGrowMemory)
 		minMemory = maxMemory;
 
+	// from the spec:
+	//limits ::= 0x00 n:u32          => {min n, max e, unshared}
+	//           0x01 n:u32 m:u32    => {min n, max m, unshared}
+	//           0x03 n:u32 m:u32    => {min n, max m, shared}
+	// We use 0x01 and 0x03 only for now
+	int memType = sharedMemory ? 0x03 : 0x01;
+	encodeULEB128(memType, code);
+	// Encode minimum and maximum memory parameters.
+	encodeULEB128(minMemory, code);
+	encodeULEB128(maxMemory, code);
+}
+
+void CheerpWasmWriter::compileMemoryAndGlobalSection()
+{
+	// With workers the memory is imported
+	if (!useWorkers())
 	{
 		Section section(0x05, "Memory", this);
 
 		encodeULEB128(1, section);
-		// from the spec:
-		//limits ::= 0x00 n:u32          => {min n, max e, unshared}
-		//           0x01 n:u32 m:u32    => {min n, max m, unshared}
-		//           0x03 n:u32 m:u32    => {min n, max m, shared}
-		// We use 0x01 and 0x03 only for now
-		int memType = sharedMemory ? 0x03 : 0x01;
-		encodeULEB128(memType, section);
-		// Encode minimum and maximum memory parameters.
-		encodeULEB128(minMemory, section);
-		encodeULEB128(maxMemory, section);
+		encodeMemoryLimits(section);
 	}
 
 	// Temporary map for the globalized constants. We update the global one at the end, to avoid
@@ -4049,9 +4935,16 @@ void CheerpWasmWriter::compileExportSection()
 			globalDeps.asmJSExports().end());
 
 	// We export the memory unconditionally, but may also need to export the table
+	// Workers need the table to call the start function, and the stack top to
+	// set it. The loader expects the table whenever the module has one.
+	const bool exportTable = (exportedTable || useWorkers()) && !linearHelper.getFunctionTables().empty();
 	uint32_t extraExports = 1;
-	if(exportedTable)
-		extraExports = 2;
+	if(exportTable)
+		extraExports++;
+	if(usePassiveSegments() && useWasmLoader)
+		extraExports++;
+	if(useWorkers())
+		extraExports++;
 	encodeULEB128(exports.size() + extraExports, section);
 
 	// Encode the memory.
@@ -4061,7 +4954,7 @@ void CheerpWasmWriter::compileExportSection()
 	encodeULEB128(0x02, section);
 	encodeULEB128(0, section);
 
-	if(exportedTable)
+	if(exportTable)
 	{
 		// Encode the table
 		StringRef name = "tbl";
@@ -4071,6 +4964,26 @@ void CheerpWasmWriter::compileExportSection()
 		encodeULEB128(0, section);
 	}
 
+	if(usePassiveSegments() && useWasmLoader)
+	{
+		// Encode the memory initialization function, the loader calls it
+		StringRef name = namegen.getBuiltinName(NameGenerator::INIT_MEMORY);
+		encodeULEB128(name.size(), section);
+		section.write(name.data(), name.size());
+		encodeULEB128(0x00, section);
+		encodeULEB128(getInitMemoryFunctionId(), section);
+	}
+
+	if(useWorkers())
+	{
+		// Encode the stack top global, each worker starts with its own stack
+		StringRef name = namegen.getBuiltinName(NameGenerator::STACK_TOP);
+		encodeULEB128(name.size(), section);
+		section.write(name.data(), name.size());
+		encodeULEB128(0x03, section);
+		encodeULEB128(stackTopGlobal, section);
+	}
+
 	for (const llvm::Function* F : exports) {
 		// Encode the method name.
 		name = namegen.getName(F);
@@ -4094,6 +5007,14 @@ void CheerpWasmWriter::compileStartSection()
 	if (useWasmLoader)
 		return;
 
+	// The memory initialization will call _start when it is done
+	if (usePassiveSegments())
+	{
+		Section section(0x08, "Start", this);
+		encodeULEB128(getInitMemoryFunctionId(), section);
+		return;
+	}
+
 	// Experimental entry point for wasm code
 	llvm::Function* entry = module.getFunction("_start");
 	if(!entry)
@@ -4150,85 +5071,216 @@ void CheerpWasmWriter::compileCodeSection()
 	// Encode the number of methods in the code section.
 	uint32_t count = linearHelper.functions().size();
 	count = std::min(count, COMPILE_METHOD_LIMIT);
-	encodeULEB128(count, section);
+	encodeULEB128(count + usePassiveSegments(), section);
 #if WASM_DUMP_METHODS
 	llvm::errs() << "method count: " << count << '\n';
 #endif
 
-	size_t i = 0;
-
-	for (const Function* F: linearHelper.functions())
+	if (codegenThreads != 1)
 	{
-		Chunk<128> method;
+		std::vector<std::string> methods;
+		compileMethodsConcurrently(methods, count);
+		for (const std::string& method: methods)
+		{
+			encodeULEB128(method.size(), section);
+			section << method;
+		}
+	}
+	else
+	{
+		size_t i = 0;
+
+		for (const Function* F: linearHelper.functions())
+		{
+			Chunk<128> method;
 #if WASM_DUMP_METHODS
-		llvm::errs() << i << " method name: " << F->getName() << '\n';
+			llvm::errs() << i << " method name: " << F->getName() << '\n';
 #endif
-		compileMethod(method, *F);
+			compileMethod(method, *F);
 
-		filterNop(method.buf());
-		nopLocations.clear();
+			filterNop(method.buf());
+			nopLocations.clear();
+			if (!WasmNoPeephole)
+				WasmPeephole::optimize(method.buf(), F->arg_size(), F->getName());
 
 #if WASM_DUMP_METHOD_DATA
-		llvm::errs() << "method length: " << method.tell() << '\n';
-		llvm::errs() << "method: " << string_to_hex(method.str()) << '\n';
+			llvm::errs() << "method length: " << method.tell() << '\n';
+			llvm::errs() << "method: " << string_to_hex(method.str()) << '\n';
 #endif
+			encodeULEB128(method.tell(), section);
+			section << method.str();
+
+			if (++i == COMPILE_METHOD_LIMIT)
+				break; // TODO
+		}
+	}
+
+	// The synthetic memory initialization comes after all the other methods
+	if (usePassiveSegments())
+	{
+		Chunk<128> method;
+		compileInitMemoryMethod(method);
 		encodeULEB128(method.tell(), section);
 		section << method.str();
+	}
+}
 
-		if (++i == COMPILE_METHOD_LIMIT)
-			break; // TODO
+void CheerpWasmWriter::compileInitMemoryMethod(WasmBuffer& code)
+{
+	// No locals
+	encodeULEB128(0, code);
+	for (uint32_t i = 0; i < passiveSegments.size(); i++)
+	{
+		encodeInst(WasmS32Opcode::I32_CONST, passiveSegments[i].first, code);
+		encodeInst(WasmS32Opcode::I32_CONST, 0, code);
+		encodeInst(WasmS32Opcode::I32_CONST, passiveSegments[i].second, code);
+		encodeInst(WasmFCU32U32Opcode::MEMORY_INIT, i, 0, code);
+		encodeInst(WasmFCU32Opcode::DATA_DROP, i, code);
+	}
+	// Without the loader this is the start function, chain the real one
+	llvm::Function* entry = module.getFunction("_start");
+	if (!useWasmLoader && entry)
+	{
+		uint32_t functionId = linearHelper.getFunctionIds().at(entry);
+		if (functionId < COMPILE_METHOD_LIMIT)
+			encodeInst(WasmU32Opcode::CALL, functionId, code);
+	}
+	encodeInst(WasmOpcode::END, code);
+}
+
+void CheerpWasmWriter::compileMethodsConcurrently(std::vector<std::string>& methods, uint32_t count)
+{
+	const std::vector<const Function*>& functions = linearHelper.functions();
+	methods.resize(count);
+
+	unsigned numThreads = codegenThreads ? codegenThreads : llvm::heavyweight_hardware_concurrency();
+	numThreads = std::max(1u, std::min(numThreads, count));
+
+	// The linear memory helper uses the data layout of the module, which
+	// computes the struct layouts lazily. Compute all of them now.
+	TypeFinder structTypes;
+	structTypes.run(module, /*onlyNamed*/false);
+	for (StructType* st: structTypes)
+	{
+		if (st->isSized())
+			module.getDataLayout().getStructLayout(st);
+	}
+
+	// Every worker is a private copy of the writer, so that all the per-method
+	// state (current function, local map, tee_local candidates, nop locations,
+	// edge context, ...) is owned by a single thread. The module-wide state is
+	// only read while compiling methods.
+	std::vector<std::unique_ptr<CheerpWasmWriter>> workers;
+	for (unsigned t = 0; t < numThreads; t++)
+	{
+		workers.emplace_back(new CheerpWasmWriter(*this));
+		workers.back()->isConcurrentWorker = true;
+	}
+
+	// Methods are handed out one at a time, the results are stored by index
+	std::atomic<uint32_t> nextMethod(0);
+	ThreadPool pool(numThreads);
+	for (auto& worker: workers)
+	{
+		CheerpWasmWriter* w = worker.get();
+		pool.async([w, count, &functions, &methods, &nextMethod]()
+		{
+			uint32_t i;
+			while ((i = nextMethod++) < count)
+			{
+				Chunk<128> method;
+				w->compileMethod(method, *functions[i]);
+
+				w->filterNop(method.buf());
+				w->nopLocations.clear();
+				if (!WasmNoPeephole)
+					WasmPeephole::optimize(method.buf(), functions[i]->arg_size(), functions[i]->getName());
+
+				methods[i] = method.str().str();
+			}
+		});
 	}
+	pool.wait();
 }
 
 void CheerpWasmWriter::encodeDataSectionChunk(WasmBuffer& data, uint32_t address, StringRef buf)
 {
-	// In the current version of WebAssembly, at most one memory is
-	// allowed in a module. Consequently, the only valid memidx is 0.
-	encodeULEB128(0, data);
-	// The offset into memory, which is the address
-	encodeLiteralType(Type::getInt32Ty(Ctx), data);
-	encodeSLEB128(address, data);
-	// Encode the end of the instruction sequence.
-	encodeULEB128(0x0b, data);
+	if (usePassiveSegments())
+	{
+		// Passive segment, the address is only used by memory.init
+		encodeULEB128(0x01, data);
+		passiveSegments.emplace_back(address, buf.size());
+	}
+	else
+	{
+		// In the current version of WebAssembly, at most one memory is
+		// allowed in a module. Consequently, the only valid memidx is 0.
+		encodeULEB128(0, data);
+		// The offset into memory, which is the address
+		encodeLiteralType(Type::getInt32Ty(Ctx), data);
+		encodeSLEB128(address, data);
+		// Encode the end of the instruction sequence.
+		encodeULEB128(0x0b, data);
+	}
 	// Prefix the number of bytes to the bytes vector.
 	encodeULEB128(buf.size(), data);
 	data.write(buf.data(), buf.size());
 }
 
+uint32_t CheerpWasmWriter::getDataSegmentCost(uint32_t address, uint32_t size) const
+{
+	// The size prefix of the bytes
+	uint32_t cost = getULEB128Size(size);
+	if (usePassiveSegments())
+	{
+		uint32_t index = passiveSegments.size();
+		// The segment flag, and the memory.init and data.drop sequence in
+		// the memory initialization method
+		cost += 1;
+		cost += 1 + getSLEB128Size(address) + 2 + 1 + getSLEB128Size(size);
+		cost += 2 + getULEB128Size(index) + 1;
+		cost += 2 + getULEB128Size(index);
+	}
+	else
+	{
+		// The memory index, and the i32.const expression of the address
+		cost += 1 + 1 + getSLEB128Size(address) + 1;
+	}
+	return cost;
+}
+
 uint32_t CheerpWasmWriter::encodeDataSectionChunks(WasmBuffer& data, uint32_t address, StringRef buf)
 {
-	// Split data section buffer into chunks based on 6 (or more) zero bytes.
+	// Split the buffer on the runs of zero bytes which are longer than the
+	// encoding of a new segment starting after them.
 	uint32_t chunks = 0;
-	size_t cur = 0, last = 0, end = 0;
-	std::string delimiter("\0\0\0\0\0\0\0", 6);
-	while ((cur = buf.find(delimiter, last)) != std::string::npos) {
-		std::string chunk = buf.substr(last, cur - last);
-		assert(chunk.size() == cur - last);
-		assert(address + last > end);
-		encodeDataSectionChunk(data, address + last, chunk);
-		chunks++;
-
-		end = address + last + chunk.size();
-
-		// Skip the delimiter and all consecutive zero bytes.
-		last = cur + delimiter.length();
-		for (; last < buf.size() && buf[last] == 0; last++);
+	size_t start = 0, pos = 0;
+	while (pos < buf.size())
+	{
+		if (buf[pos])
+		{
+			pos++;
+			continue;
+		}
+		size_t zerosEnd = pos;
+		for (; zerosEnd < buf.size() && !buf[zerosEnd]; zerosEnd++);
+		// Trailing zeros are stripped before this function is called
+		assert(zerosEnd < buf.size());
+		if (zerosEnd - pos > getDataSegmentCost(address + zerosEnd, buf.size() - zerosEnd))
+		{
+			encodeDataSectionChunk(data, address + start, buf.substr(start, pos - start));
+			chunks++;
+			start = zerosEnd;
+		}
+		pos = zerosEnd;
 	}
-
-	// If the buffer ends with zero bytes (last == buf.size()), an empty chunk
-	// will be encoded. This should not happen, and is prevented by stripping
-	// leading and trailing zeros from the buffer when this function is called.
-	assert(last < buf.size());
-	encodeDataSectionChunk(data, address + last, buf.substr(last));
+	encodeDataSectionChunk(data, address + start, buf.substr(start));
 
 	return chunks + 1;
 }
 
-void CheerpWasmWriter::compileDataSection()
+uint32_t CheerpWasmWriter::encodeDataSegments(WasmBuffer& data)
 {
-	Section section(0x0b, "Data", this);
-
-	Chunk<128> data;
 	uint32_t count = 0;
 
 	auto globals = linearHelper.addressableGlobals();
@@ -4262,8 +5314,7 @@ void CheerpWasmWriter::compileDataSection()
 			long written = bytes.tell();
 			uint32_t nextAddress = linearHelper.getGlobalVariableAddress(GV);
 			uint32_t padding = nextAddress - (address + written);
-			for (uint32_t i = 0; i < padding; i++)
-				bytes << (char)0;
+			bytesWriter.addZeros(padding);
 
 			linearHelper.compileConstantAsBytes(init,/* asmjs */ true, &bytesWriter);
 		}
@@ -4293,8 +5344,22 @@ void CheerpWasmWriter::compileDataSection()
 			break;
 	}
 
+	return count;
+}
+
+void CheerpWasmWriter::compileDataCountSection(uint32_t count)
+{
+	Section section(0x0c, "DataCount", this);
+
 	encodeULEB128(count, section);
-	section << data.str();
+}
+
+void CheerpWasmWriter::compileDataSection(StringRef segments, uint32_t count)
+{
+	Section section(0x0b, "Data", this);
+
+	encodeULEB128(count, section);
+	section << segments;
 }
 
 void CheerpWasmWriter::compileNameSection()
@@ -4335,6 +5400,11 @@ void CheerpWasmWriter::compileModule()
 	encodeULEB128(0x00, stream);
 	encodeULEB128(0x00, stream);
 
+	// The data segments are encoded in advance, since the initialization of
+	// passive segments in the code section depends on their layout
+	Chunk<128> dataSegments;
+	uint32_t dataSegmentsCount = encodeDataSegments(dataSegments);
+
 	compileTypeSection();
 
 	compileImportSection();
@@ -4351,9 +5421,12 @@ void CheerpWasmWriter::compileModule()
 
 	compileElementSection();
 
+	if (usePassiveSegments())
+		compileDataCountSection(dataSegmentsCount);
+
 	compileCodeSection();
 
-	compileDataSection();
+	compileDataSection(dataSegments.str(), dataSegmentsCount);
 
 	if (prettyCode) {
 		compileNameSection();
@@ -4370,6 +5443,11 @@ void CheerpWasmWriter::WasmBytesWriter::addByte(uint8_t byte)
 	code.write(reinterpret_cast<char*>(&byte), 1);
 }
 
+void CheerpWasmWriter::WasmBytesWriter::addBytes(llvm::ArrayRef<uint8_t> bytes)
+{
+	code.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
 void CheerpWasmWriter::WasmGepWriter::addValue(const llvm::Value* v, uint32_t size)
 {
 	addedValues.emplace_back(v, size);
@@ -23,7 +23,11 @@
 #include "llvm/IR/Dominators.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/TypeFinder.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include <atomic>
 
 using namespace llvm;
 using namespace std;
@@ -2118,11 +2122,17 @@ void CheerpWriter::compileConstantArrayMembers(const Constant* C)
 	{
 		const ConstantDataSequential* CD = dyn_cast<ConstantDataSequential>(C);
 		assert(CD);
+		// Read the raw elements, getElementAsConstant creates new constants
+		// and methods may be compiled concurrently
+		bool asmjs = currentFun && currentFun->getSection() == StringRef("asmjs");
 		for(uint32_t i=0;i<CD->getNumElements();i++)
 		{
 			if(i!=0)
 				stream << ',';
-			compileConstant(CD->getElementAsConstant(i));
+			if(CD->getElementType()->isFloatingPointTy())
+				compileFloatingPointConstant(CD->getElementAsAPFloat(i), CD->getElementType(), HIGHEST, asmjs);
+			else
+				compileIntegerConstant(CD->getElementAsAPInt(i), HIGHEST);
 		}
 	}
 }
@@ -2137,6 +2147,131 @@ bool CheerpWriter::doesConstantDependOnUndefined(const Constant* C) const
 		return false;
 }
 
+void CheerpWriter::compileFloatingPointConstant(const APFloat& value, Type* t, PARENT_PRIORITY parentPrio, bool asmjs)
+{
+	bool isFloat = t->isFloatTy();
+	bool useFloat = false;
+	
+	if(value.isInfinity())
+	{
+		if (isFloat && needsFloatCoercion(parentPrio))
+			stream<< namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << '(';
+		if(value.isNegative())
+		{
+			if(parentPrio > LOWEST)
+				stream << ' ';
+			stream << '-';
+		}
+
+		stream << "Infinity";
+		if (isFloat && needsFloatCoercion(parentPrio))
+			stream << ')';
+	}
+	else if(value.isNaN())
+	{
+		if (isFloat && needsFloatCoercion(parentPrio))
+			stream<< namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << '(';
+		stream << "NaN";
+		if (isFloat && needsFloatCoercion(parentPrio))
+			stream << ')';
+	}
+	else
+	{
+		APFloat apf = value;
+		// We want the most compact representation possible, so we first try
+		// to represent the number with a maximum of nuumeric_limits::digits10.
+		// We convert the string back to a double, and if it is not the same
+		// as the original we try again with numeric_limits::max_digits10
+		
+		// Needed by APFloat::convert, not used here
+		bool losesInfo = false;
+		SmallString<32> buf;
+
+		apf.convert(APFloat::IEEEdouble(), APFloat::roundingMode::rmNearestTiesToEven, &losesInfo);
+		assert(!losesInfo);
+		double original = apf.convertToDouble();
+
+		apf.toString(buf, std::numeric_limits<double>::digits10);
+		double converted = 0;
+		sscanf(buf.c_str(),"%lf",&converted);
+		if(converted != original)
+		{
+			buf.clear();
+			apf.toString(buf, std::numeric_limits<double>::max_digits10);
+		}
+
+		apf.convert(APFloat::IEEEsingle(), APFloat::roundingMode::rmNearestTiesToEven, &losesInfo);
+		// If we don't lose information or if the actual type is a float
+		// (and thus we don't care that we are losing it), try to see if
+		// it is shorter to use a float instead of a double (using fround)
+		if(useMathFround && (!losesInfo || t->isFloatTy()))
+		{
+			float original = apf.convertToFloat();
+			SmallString<32> tmpbuf;
+			apf.toString(tmpbuf, std::numeric_limits<float>::digits10);
+			float converted = 0;
+			sscanf(tmpbuf.c_str(),"%f",&converted);
+			if(converted != original)
+			{
+				tmpbuf.clear();
+				apf.toString(tmpbuf, std::numeric_limits<float>::max_digits10);
+			}
+			// We actually use the float only if it is shorter to write,
+			// including the call to fround
+			size_t floatsize = tmpbuf.size() + namegen.getBuiltinName(NameGenerator::Builtin::FROUND).size()+2;  
+			if(buf.size() > floatsize || isFloat)
+			{
+				useFloat = true;
+				// In asm.js double and float are distinct types, so
+				// we cast back to double if needed
+				if(asmjs && t->isDoubleTy())
+				{
+					if (parentPrio > LOWEST)
+						stream << ' ';
+					stream << '+';
+				}
+				if(parentPrio != FROUND)
+					stream << namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << '(';
+				buf = tmpbuf;
+			}
+			else if(parentPrio > LOWEST && value.isNegative())
+				stream << ' ';
+		}
+		// asm.js require the floating point literals to have a dot
+		if(asmjs && buf.find('.') == StringRef::npos)
+		{
+			auto it = buf.begin();
+			// We must insert the dot before the exponent part
+			// (or at the end if there is no exponent)
+			for (;it != buf.end() && *it != 'E' && *it != 'e'; it++);
+			buf.insert(it,'.');
+		}
+		// If the number is in the form `0.xyz...` we can remove the leading 0
+		int start = 0;
+		if (buf[0] == '0' && buf.size() > 2)
+			start = 1;
+		stream << buf.c_str()+start;
+		if (useFloat && parentPrio != FROUND)
+			stream << ')';
+	}
+}
+
+void CheerpWriter::compileIntegerConstant(const APInt& value, PARENT_PRIORITY parentPrio)
+{
+	if(value.getBitWidth()>=32)
+	{
+		if(parentPrio > LOWEST && value.isNegative())
+			stream << ' ';
+		stream << value.getSExtValue();
+	}
+	else
+		stream << value.getZExtValue();
+	if(value.getBitWidth()==64)
+	{
+		stream << 'n';
+	}
+}
+
 void CheerpWriter::compileConstant(const Constant* c, PARENT_PRIORITY parentPrio)
 {
 	//TODO: what to do when currentFun == nullptr? for now asmjs=false
@@ -2244,128 +2379,11 @@ void CheerpWriter::compileConstant(const Constant* c, PARENT_PRIORITY parentPrio
 	}
 	else if(isa<ConstantFP>(c))
 	{
-		bool isFloat = c->getType()->isFloatTy();
-		const ConstantFP* f=cast<ConstantFP>(c);
-		bool useFloat = false;
-		
-		if(f->getValueAPF().isInfinity())
-		{
-			if (isFloat && needsFloatCoercion(parentPrio))
-				stream<< namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << '(';
-			if(f->getValueAPF().isNegative())
-			{
-				if(parentPrio > LOWEST)
-					stream << ' ';
-				stream << '-';
-			}
-
-			stream << "Infinity";
-			if (isFloat && needsFloatCoercion(parentPrio))
-				stream << ')';
-		}
-		else if(f->getValueAPF().isNaN())
-		{
-			if (isFloat && needsFloatCoercion(parentPrio))
-				stream<< namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << '(';
-			stream << "NaN";
-			if (isFloat && needsFloatCoercion(parentPrio))
-				stream << ')';
-		}
-		else
-		{
-			APFloat apf = f->getValueAPF();
-			// We want the most compact representation possible, so we first try
-			// to represent the number with a maximum of nuumeric_limits::digits10.
-			// We convert the string back to a double, and if it is not the same
-			// as the original we try again with numeric_limits::max_digits10
-			
-			// Needed by APFloat::convert, not used here
-			bool losesInfo = false;
-			SmallString<32> buf;
-
-			apf.convert(APFloat::IEEEdouble(), APFloat::roundingMode::rmNearestTiesToEven, &losesInfo);
-			assert(!losesInfo);
-			double original = apf.convertToDouble();
-
-			apf.toString(buf, std::numeric_limits<double>::digits10);
-			double converted = 0;
-			sscanf(buf.c_str(),"%lf",&converted);
-			if(converted != original)
-			{
-				buf.clear();
-				apf.toString(buf, std::numeric_limits<double>::max_digits10);
-			}
-
-			apf.convert(APFloat::IEEEsingle(), APFloat::roundingMode::rmNearestTiesToEven, &losesInfo);
-			// If we don't lose information or if the actual type is a float
-			// (and thus we don't care that we are losing it), try to see if
-			// it is shorter to use a float instead of a double (using fround)
-			if(useMathFround && (!losesInfo || f->getType()->isFloatTy()))
-			{
-				float original = apf.convertToFloat();
-				SmallString<32> tmpbuf;
-				apf.toString(tmpbuf, std::numeric_limits<float>::digits10);
-				float converted = 0;
-				sscanf(tmpbuf.c_str(),"%f",&converted);
-				if(converted != original)
-				{
-					tmpbuf.clear();
-					apf.toString(tmpbuf, std::numeric_limits<float>::max_digits10);
-				}
-				// We actually use the float only if it is shorter to write,
-				// including the call to fround
-				size_t floatsize = tmpbuf.size() + namegen.getBuiltinName(NameGenerator::Builtin::FROUND).size()+2;  
-				if(buf.size() > floatsize || isFloat)
-				{
-					useFloat = true;
-					// In asm.js double and float are distinct types, so
-					// we cast back to double if needed
-					if(asmjs && f->getType()->isDoubleTy())
-					{
-						if (parentPrio > LOWEST)
-							stream << ' ';
-						stream << '+';
-					}
-					if(parentPrio != FROUND)
-						stream << namegen.getBuiltinName(NameGenerator::Builtin::FROUND) << '(';
-					buf = tmpbuf;
-				}
-				else if(parentPrio > LOWEST && f->getValueAPF().isNegative())
-					stream << ' ';
-			}
-			// asm.js require the floating point literals to have a dot
-			if(asmjs && buf.find('.') == StringRef::npos)
-			{
-				auto it = buf.begin();
-				// We must insert the dot before the exponent part
-				// (or at the end if there is no exponent)
-				for (;it != buf.end() && *it != 'E' && *it != 'e'; it++);
-				buf.insert(it,'.');
-			}
-			// If the number is in the form `0.xyz...` we can remove the leading 0
-			int start = 0;
-			if (buf[0] == '0' && buf.size() > 2)
-				start = 1;
-			stream << buf.c_str()+start;
-			if (useFloat && parentPrio != FROUND)
-				stream << ')';
-		}
+		compileFloatingPointConstant(cast<ConstantFP>(c)->getValueAPF(), c->getType(), parentPrio, asmjs);
 	}
 	else if(isa<ConstantInt>(c))
 	{
-		const ConstantInt* i=cast<ConstantInt>(c);
-		if(i->getBitWidth()>=32)
-		{
-			if(parentPrio > LOWEST && i->isNegative())
-				stream << ' ';
-			stream << i->getSExtValue();
-		}
-		else
-			stream << i->getZExtValue();
-		if(i->getBitWidth()==64)
-		{
-			stream << 'n';
-		}
+		compileIntegerConstant(cast<ConstantInt>(c)->getValue(), parentPrio);
 	}
 	else if(isa<ConstantPointerNull>(c))
 	{
@@ -2762,6 +2780,7 @@ void CheerpWriter::compileMethodArgs(User::const_op_iterator it, User::const_op_
 				{
 					while(st->getDirectBase())
 						st = st->getDirectBase();
+					// This type already exists, compileMethods creates it before compiling concurrently
 					tp = st->getPointerTo();
 				}
 				compilePointerAs(*cur, PA.getPointerKindForStoredType(tp));
@@ -2862,6 +2881,8 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 						compileOperand(retVal, FROUND);
 						stream << ')';
 						break;
+					case Registerize::VECTOR:
+						llvm::report_fatal_error("Vector registers are only supported in wasm");
 					case Registerize::OBJECT:
 						POINTER_KIND k=PA.getPointerKindForReturn(ri.getParent()->getParent());
 						// For SPLIT_REGULAR we return the .d part and store the .o part into oSlot
@@ -4274,6 +4295,8 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 					case Registerize::FLOAT:
 						stream << ')';
 						break;
+					case Registerize::VECTOR:
+						llvm::report_fatal_error("Vector registers are only supported in wasm");
 					case Registerize::OBJECT:
 						break;
 				}
@@ -4334,6 +4357,8 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 					case Registerize::FLOAT:
 						stream << ')';
 						break;
+					case Registerize::VECTOR:
+						llvm::report_fatal_error("Vector registers are only supported in wasm");
 					case Registerize::OBJECT:
 						if(PA.getPointerKindAssert(&ci) == SPLIT_REGULAR && !ci.use_empty())
 						{
@@ -5444,8 +5469,16 @@ void CheerpWriter::compileMethod(const Function& F)
 			compileMethodLocals(F, false);
 			CheerpRenderInterface ri(this, namegen.getBuiltinName(NameGenerator::Builtin::LABEL), NewLine, asmjs);
 
-			DominatorTree &DT = pass.getAnalysis<DominatorTreeWrapperPass>(const_cast<Function&>(F)).getDomTree();
-			LoopInfo &LI = pass.getAnalysis<LoopInfoWrapperPass>(const_cast<Function&>(F)).getLoopInfo();
+			// Concurrent workers can't use the pass manager, they compute the same analyses locally
+			DominatorTree localDT;
+			LoopInfo localLI;
+			if (isConcurrentWorker)
+			{
+				localDT.recalculate(const_cast<Function&>(F));
+				localLI.analyze(localDT);
+			}
+			DominatorTree &DT = isConcurrentWorker ? localDT : pass.getAnalysis<DominatorTreeWrapperPass>(const_cast<Function&>(F)).getDomTree();
+			LoopInfo &LI = isConcurrentWorker ? localLI : pass.getAnalysis<LoopInfoWrapperPass>(const_cast<Function&>(F)).getLoopInfo();
 			CFGStackifier::Mode Mode = asmjs ? CFGStackifier::AsmJS : CFGStackifier::GenericJS;
 			CFGStackifier CN(F, LI, DT, registerize, PA, Mode);
 			compileTokens(CN.Tokens);
@@ -5475,6 +5508,8 @@ void CheerpWriter::compileMethod(const Function& F)
 				case Registerize::DOUBLE:
 					stream << " 0.";
 					break;
+				case Registerize::VECTOR:
+					llvm::report_fatal_error("Vector registers are only supported in wasm");
 				case Registerize::OBJECT:
 					llvm::errs() << "OBJECT register kind should not appear in asm.js functions\n";
 					llvm::report_fatal_error("please report a bug");
@@ -5487,6 +5522,152 @@ void CheerpWriter::compileMethod(const Function& F)
 	currentFun = NULL;
 }
 
+CheerpWriter::CheerpWriter(const CheerpWriter& parent, llvm::raw_ostream& s, SourceMapGenerator* sourceMapRecorder):
+	module(parent.module),
+	pass(parent.pass),
+	targetData(parent.targetData),
+	currentFun(NULL),
+	PA(parent.PA),
+	registerize(parent.registerize),
+	edgeContext(),
+	globalDeps(parent.globalDeps),
+	linearHelper(parent.linearHelper),
+	namegen(parent.namegen),
+	allocaStoresExtractor(parent.allocaStoresExtractor),
+	types(parent.types),
+	compiledGVars(parent.compiledGVars),
+	heapNames(parent.heapNames),
+	asmJSMem(parent.asmJSMem),
+	asmJSMemFile(parent.asmJSMemFile),
+	sourceMapGenerator(sourceMapRecorder),
+	functionToDebugInfoMap(parent.functionToDebugInfoMap),
+	NewLine(),
+	useNativeJavaScriptMath(parent.useNativeJavaScriptMath),
+	useMathImul(parent.useMathImul),
+	useMathFround(parent.useMathFround),
+	makeModule(parent.makeModule),
+	addCredits(parent.addCredits),
+	measureTimeToMain(parent.measureTimeToMain),
+	heapSize(parent.heapSize),
+	checkBounds(parent.checkBounds),
+	useCfgLegacy(parent.useCfgLegacy),
+	wasmFile(parent.wasmFile),
+	forceTypedArrays(parent.forceTypedArrays),
+	symbolicGlobalsAsmJS(parent.symbolicGlobalsAsmJS),
+	readableOutput(parent.readableOutput),
+	areDummiesDeclared(parent.areDummiesDeclared),
+	areAsmJSExportsDeclared(parent.areAsmJSExportsDeclared),
+	areJsExportedExportsDeclared(parent.areJsExportedExportsDeclared),
+	isRootNeeded(parent.isRootNeeded),
+	codegenThreads(1),
+	isConcurrentWorker(true),
+	blockDepth(0),
+	lastDepth0Block(nullptr),
+	stream(s, sourceMapRecorder, parent.readableOutput)
+{
+}
+
+void CheerpWriter::compileMethods(const std::vector<const Function*>& functions)
+{
+	if (codegenThreads == 1 || functions.size() < 2)
+	{
+		for (const Function* F: functions)
+			compileMethod(*F);
+		return;
+	}
+
+	struct RenderedMethod
+	{
+		std::string code;
+		SourceMapGenerator::Recording mappings;
+		ostream_proxy::State finalState;
+	};
+	struct Worker
+	{
+		std::string buffer;
+		llvm::raw_string_ostream out;
+		std::unique_ptr<SourceMapGenerator> recorder;
+		std::unique_ptr<CheerpWriter> writer;
+		Worker(const CheerpWriter& parent, SourceMapGenerator* sourceMapGenerator): out(buffer)
+		{
+			if (sourceMapGenerator)
+				recorder = sourceMapGenerator->createRecorder();
+			writer.reset(new CheerpWriter(parent, out, recorder.get()));
+		}
+	};
+
+	unsigned numThreads = codegenThreads ? codegenThreads : llvm::heavyweight_hardware_concurrency();
+	numThreads = std::max<size_t>(1, std::min<size_t>(numThreads, functions.size()));
+
+	// The workers must not create types, and the linear memory helper uses the
+	// data layout of the module, which computes the struct layouts lazily.
+	// Variadic arguments are passed as pointers to the base class, so create
+	// those pointer types and all the struct layouts now.
+	TypeFinder structTypes;
+	structTypes.run(module, /*onlyNamed*/false);
+	for (StructType* st: structTypes)
+	{
+		if (st->isSized())
+			module.getDataLayout().getStructLayout(st);
+		if (st->getDirectBase())
+		{
+			StructType* base = st->getDirectBase();
+			while (base->getDirectBase())
+				base = base->getDirectBase();
+			base->getPointerTo();
+		}
+	}
+
+	std::vector<RenderedMethod> methods(functions.size());
+	std::vector<std::unique_ptr<Worker>> workers;
+	for (unsigned t = 0; t < numThreads; t++)
+		workers.emplace_back(new Worker(*this, sourceMapGenerator));
+
+	// Every method starts from the current indentation state. This is the same
+	// as the serial output as long as methods do not change the indentation.
+	const ostream_proxy::State initialState = stream.getState();
+	std::atomic<size_t> nextMethod(0);
+	ThreadPool pool(numThreads);
+	for (auto& worker: workers)
+	{
+		Worker* w = worker.get();
+		pool.async([w, &functions, &methods, &nextMethod, &initialState]()
+		{
+			size_t i;
+			while ((i = nextMethod++) < functions.size())
+			{
+				w->writer->stream.setState(initialState);
+				w->writer->compileMethod(*functions[i]);
+				w->out.flush();
+				methods[i].code = std::move(w->buffer);
+				w->buffer.clear();
+				if (w->recorder)
+					methods[i].mappings = w->recorder->takeRecording();
+				methods[i].finalState = w->writer->stream.getState();
+			}
+		});
+	}
+	pool.wait();
+
+	// Splice the methods in order, source maps offsets are rebased on the current position
+	for (const RenderedMethod& m: methods)
+	{
+		stream.getRawStream() << m.code;
+		if (sourceMapGenerator)
+			sourceMapGenerator->replay(m.mappings);
+		stream.setState(m.finalState);
+	}
+	// Merge back the side effects of compiling the methods
+	for (auto& worker: workers)
+	{
+		for (int i = HEAP8; i <= LAST_WASM; i++)
+		{
+			if (worker->writer->isHeapNameUsed(i))
+				markHeapNameAsUsed(i);
+		}
+	}
+}
+
 CheerpWriter::GlobalSubExprInfo CheerpWriter::compileGlobalSubExpr(const GlobalDepsAnalyzer::SubExprVec& subExpr)
 {
 	for ( auto it = std::next(subExpr.begin()); it != subExpr.end(); ++it )
@@ -5681,7 +5862,7 @@ void CheerpWriter::compileGlobalsInitAsmJS()
 		BinaryBytesWriter bytesWriter(os);
 		uint32_t last_address = linearHelper.getStackStart();
 		uint32_t last_size = 0;
-		for ( const GlobalVariable* GV : linearHelper.globals() )
+		for ( const GlobalVariable* GV : linearHelper.addressableGlobals() )
 		{
 			if (GV->hasInitializer())
 			{
@@ -5689,10 +5870,7 @@ void CheerpWriter::compileGlobalsInitAsmJS()
 				Type* ty = init->getType();
 				uint32_t cur_address = linearHelper.getGlobalVariableAddress(GV);
 				uint32_t padding = cur_address - (last_address+last_size);
-				for ( uint32_t i = 0; i < padding; i++ )
-				{
-					os << (char)0;
-				}
+				bytesWriter.addZeros(padding);
 				linearHelper.compileConstantAsBytes(init,/* asmjs */ true, &bytesWriter);
 				last_size = targetData.getTypeAllocSize(ty);
 				last_address = cur_address;
@@ -5705,7 +5883,7 @@ void CheerpWriter::compileGlobalsInitAsmJS()
 	}
 	else
 	{
-		for ( const GlobalVariable* GV : linearHelper.globals() )
+		for ( const GlobalVariable* GV : linearHelper.addressableGlobals() )
 		{
 			if (GV->hasInitializer())
 			{
@@ -5750,6 +5928,8 @@ void CheerpWriter::compileParamTypeAnnotationsAsmJS(const Function* F)
 			case Registerize::DOUBLE:
 				stream << '+' << getName(&*curArg);
 				break;
+			case Registerize::VECTOR:
+				llvm::report_fatal_error("Vector registers are only supported in wasm");
 			case Registerize::OBJECT:
 				stream << getName(&*curArg);
 				break;
@@ -5939,6 +6119,55 @@ void CheerpWriter::compileFetchBuffer()
 	stream << "}" << NewLine;
 }
 
+void CheerpWriter::compileFetchWasm()
+{
+	const std::string fetchBuffer = namegen.getBuiltinName(NameGenerator::FETCHBUFFER);
+	stream << "function " << namegen.getBuiltinName(NameGenerator::FETCHWASM) <<"(p){" << NewLine;
+	stream << "var f='function';" << NewLine;
+	// Fallback to the downloaded buffer, streaming also fails if the server does not use the application/wasm type
+	stream << "function c(){" << NewLine;
+	stream << "var b=_=>" << fetchBuffer << "(p).then(b=>WebAssembly.compile(b));" << NewLine;
+	if (WasmStreaming)
+	{
+		stream << "if(typeof fetch===f&&typeof WebAssembly.compileStreaming===f)" << NewLine;
+		stream << "return WebAssembly.compileStreaming(fetch(p)).catch(b);" << NewLine;
+	}
+	stream << "return b();" << NewLine;
+	stream << "}" << NewLine;
+	if (WasmModuleCache.empty())
+	{
+		stream << "return c();" << NewLine;
+		stream << "}" << NewLine;
+		return;
+	}
+	// Any failure of IndexedDB, including modules that cannot be stored, just skips the cache
+	stream << "var k=\"";
+	auto& rawStream = stream.getRawStream();
+	uint64_t beginVal = rawStream.tell();
+	compileEscapedString(rawStream, WasmModuleCache, /*forJSON*/false);
+	stream.syncRawStream(beginVal);
+	stream << ":\"+p;" << NewLine;
+	stream << "if(typeof indexedDB==='undefined')return c();" << NewLine;
+	stream << "return new Promise(y=>{" << NewLine;
+	stream << "var r=indexedDB.open('cheerp',1);" << NewLine;
+	stream << "r.onupgradeneeded=_=>r.result.createObjectStore('wasm');" << NewLine;
+	stream << "r.onsuccess=_=>y(r.result);" << NewLine;
+	stream << "r.onerror=_=>y(null);" << NewLine;
+	stream << "}).then(d=>{" << NewLine;
+	stream << "if(!d)return c();" << NewLine;
+	stream << "return new Promise(y=>{" << NewLine;
+	stream << "try{" << NewLine;
+	stream << "var g=d.transaction('wasm').objectStore('wasm').get(k);" << NewLine;
+	stream << "g.onsuccess=_=>y(g.result instanceof WebAssembly.Module?g.result:null);" << NewLine;
+	stream << "g.onerror=_=>y(null);" << NewLine;
+	stream << "}catch(e){y(null);}" << NewLine;
+	stream << "}).then(m=>m||c().then(m=>{" << NewLine;
+	stream << "try{d.transaction('wasm','readwrite').objectStore('wasm').put(m,k);}catch(e){}" << NewLine;
+	stream << "return m;" << NewLine;
+	stream << "}));" << NewLine;
+	stream << "});" << NewLine;
+	stream << "}" << NewLine;
+}
 
 void CheerpWriter::compileSourceMapsBegin()
 {
@@ -6043,6 +6272,8 @@ void CheerpWriter::compileHelpers()
 	// Utility function for loading files
 	if(!wasmFile.empty() || asmJSMem)
 		compileFetchBuffer();
+	if(useWasmModuleLoader())
+		compileFetchWasm();
 
 	if (globalDeps.needAsmJS() && checkBounds)
 	{
@@ -6120,13 +6351,15 @@ void CheerpWriter::compileAsmJSClosure()
 	for ( const GlobalVariable* GV : linearHelper.globals() )
 		compileGlobalAsmJS(*GV);
 
+	std::vector<const Function*> methods;
 	for (const Function* F : globalDeps.insideModule())
 	{
 		if (!F->empty())
 		{
-			compileMethod(*F);
+			methods.push_back(F);
 		}
 	}
+	compileMethods(methods);
 
 	compileFunctionTablesAsmJS();
 
@@ -6210,6 +6443,7 @@ void CheerpWriter::compileAsmJSTopLevel()
 
 void CheerpWriter::compileGenericJS()
 {
+	std::vector<const Function*> methods;
 	for (const Function* F: globalDeps.outsideModule())
 	{
 		if (!F->empty())
@@ -6217,9 +6451,10 @@ void CheerpWriter::compileGenericJS()
 #ifdef CHEERP_DEBUG_POINTERS
 			dumpAllPointers(*F, PA);
 #endif //CHEERP_DEBUG_POINTERS
-			compileMethod(*F);
+			methods.push_back(F);
 		}
 	}
+	compileMethods(methods);
 	for ( const GlobalVariable & GV : module.getGlobalList() )
 	{
 		// Skip global ctors array
@@ -6291,10 +6526,33 @@ void CheerpWriter::compileWasmLoader()
 	compileDeclareExports();
 
 	const std::string shortestName = namegen.getShortestLocalName();
-	stream << namegen.getBuiltinName(NameGenerator::FETCHBUFFER) << "('" << wasmFile << "').then(" << shortestName << "=>" << NewLine;
-	stream << "WebAssembly.instantiate(" << shortestName << "," << NewLine;
+	const bool moduleLoader = useWasmModuleLoader();
+	const StringRef fetchName = namegen.getBuiltinName(moduleLoader ? NameGenerator::FETCHWASM : NameGenerator::FETCHBUFFER);
+	if (useWasmWorkers())
+	{
+		// Workers load this same script, and receive the compiled module and the memory from the thread starting them
+		stream << "var __worker=typeof WorkerGlobalScope!=='undefined'&&self instanceof WorkerGlobalScope,__workerData=null,__wasmModule=null,";
+		stream << "__script=__worker?self.location.href:document.currentScript.src;" << NewLine;
+		stream << "function __cheerpStartWorker(f,a,s){var w=new Worker(__script);";
+		stream << "w.postMessage({module:__wasmModule,memory:__asm." << namegen.getBuiltinName(NameGenerator::MEMORY) << ",func:f,arg:a,stackTop:s});return w;}" << NewLine;
+		stream << "(__worker?new Promise(" << shortestName << "=>self.onmessage=e=>{__workerData=e.data;" << shortestName << "(__workerData.module);}):";
+		stream << fetchName << "('" << wasmFile << "')).then(" << shortestName << "=>" << NewLine;
+	}
+	else
+		stream << fetchName << "('" << wasmFile << "').then(" << shortestName << "=>" << NewLine;
+	stream << "WebAssembly.instantiate(";
+	// The compiled module is also what workers need
+	if (moduleLoader && useWasmWorkers())
+		stream << "__wasmModule=";
+	stream << shortestName << "," << NewLine;
 	stream << "{i:{" << NewLine;
 	compileImports();
+	if (useWasmWorkers())
+	{
+		uint32_t pages = heapSize << 4;
+		stream << namegen.getBuiltinName(NameGenerator::MEMORY) << ":__worker?__workerData.memory:";
+		stream << "new WebAssembly.Memory({initial:" << pages << ",maximum:" << pages << ",shared:true})," << NewLine;
+	}
 	if(globalDeps.needsBuiltin(BuiltinInstr::BUILTIN::ACOS_F))
 		stream << namegen.getBuiltinName(NameGenerator::ACOS) << ":Math.acos," << NewLine;
 	if(globalDeps.needsBuiltin(BuiltinInstr::BUILTIN::ASIN_F))
@@ -6324,14 +6582,53 @@ void CheerpWriter::compileWasmLoader()
 	}
 	stream << "}})" << NewLine;
 	stream << ").then(" << shortestName << "=>{" << NewLine;
-	stream << "__asm=" << shortestName << ".instance.exports;" << NewLine;
+	if (moduleLoader)
+	{
+		// Instantiating a compiled module only returns the instance
+		stream << "__asm=" << shortestName << ".exports;" << NewLine;
+	}
+	else if (useWasmWorkers())
+	{
+		// Instantiating a compiled module only returns the instance
+		stream << "__asm=(" << shortestName << ".instance||" << shortestName << ").exports;" << NewLine;
+		stream << "__wasmModule=" << shortestName << ".module||__workerData.module;" << NewLine;
+	}
+	else
+		stream << "__asm=" << shortestName << ".instance.exports;" << NewLine;
 	stream << "__heap=__asm." << namegen.getBuiltinName(NameGenerator::MEMORY) << ".buffer;" << NewLine;
+	// The passive data segments must be copied in memory before running any code
+	// Workers share the memory, which is already initialized
+	if (useWasmWorkers())
+		stream << "if(!__worker)__asm." << namegen.getBuiltinName(NameGenerator::INIT_MEMORY) << "();" << NewLine;
 	if (globalDeps.needAsmJS())
 	{
 		stream << namegen.getBuiltinName(NameGenerator::Builtin::ASSIGN_HEAPS) << "(__heap);" << NewLine;
 	}
 }
 
+bool CheerpWriter::useWasmWorkers() const
+{
+	return !wasmFile.empty() && WasmBulkMemory && WasmSharedMemory;
+}
+
+bool CheerpWriter::useWasmModuleLoader() const
+{
+	return !wasmFile.empty() && (WasmStreaming || !WasmModuleCache.empty());
+}
+
+void CheerpWriter::compileWasmWorkerStart()
+{
+	// Workers only run the requested function on their own stack, constructors already ran on the main thread
+	stream << "if(__worker){" << NewLine;
+	stream << "__asm." << namegen.getBuiltinName(NameGenerator::STACK_TOP) << ".value=__workerData.stackTop;" << NewLine;
+	// The module always exports the table for workers, but it has no table if
+	// no function address is taken. Then there is nothing a worker can run.
+	if (!linearHelper.getFunctionTables().empty())
+		stream << "__asm.tbl.get(__workerData.func)(__workerData.arg);" << NewLine;
+	stream << "return;" << NewLine;
+	stream << "}" << NewLine;
+}
+
 void CheerpWriter::compileDeclareExports()
 {
 	for (auto i: globalDeps.asmJSExports())
@@ -6572,6 +6869,56 @@ void CheerpWriter::compileConstructors()
 	}
 }
 
+void CheerpWriter::compileProfileDump()
+{
+	const NamedMDNode* profileData = module.getNamedMetadata("cheerp.instrprof");
+	if (!profileData)
+		return;
+
+	stream << "function __cheerp_profile_dump(){" << NewLine;
+	stream << "var s=\"";
+	// Counters collected by the IR level instrumentation are flagged in the profile
+	if (module.getNamedMetadata("cheerp.instrprof.ir"))
+		stream << "# IR level Instrumentation Flag\\n:ir\\n";
+	stream << "\";" << NewLine;
+	for (const MDNode* record: profileData->operands())
+	{
+		const GlobalVariable* GV = mdconst::dyn_extract_or_null<GlobalVariable>(record->getOperand(0));
+		if (!GV || !globalDeps.isReachable(GV))
+			continue;
+		StringRef name = cast<MDString>(record->getOperand(1))->getString();
+		uint64_t hash = mdconst::extract<ConstantInt>(record->getOperand(2))->getZExtValue();
+		uint32_t numCounters = GV->getValueType()->getArrayNumElements();
+		// The hash does not fit in a JS number, print it from here
+		SmallString<64> escapedName;
+		raw_svector_ostream(escapedName).write_escaped(name, /*UseHexEscapes*/true);
+		stream << "s+=\"" << escapedName.str() << "\\n" << hash << "\\n" << numCounters << "\\n\";" << NewLine;
+		stream << "for(var i=0;i<" << numCounters << ";i++)s+=(";
+		if (GV->getSection() == StringRef("asmjs"))
+			stream << getHeapName(HEAP32) << "[(" << linearHelper.getGlobalVariableAddress(GV) << ">>2)+i]";
+		else
+		{
+			stream << getName(GV);
+			POINTER_KIND k = PA.getPointerKindAssert(GV);
+			if (k == REGULAR || k == BYTE_LAYOUT)
+				stream << ".d";
+			if (k == REGULAR || k == SPLIT_REGULAR)
+				stream << "[0]";
+			stream << "[i]";
+		}
+		stream << ">>>0)+\"\\n\";" << NewLine;
+		stream << "s+=\"\\n\";" << NewLine;
+	}
+	stream << "return s;" << NewLine;
+	stream << "}" << NewLine;
+	// Inside a closure or a module the function must be made reachable explicitly
+	if (makeModule != MODULE_TYPE::NONE)
+	{
+		stream << "if(typeof self===\"object\")self.__cheerp_profile_dump=__cheerp_profile_dump;" << NewLine;
+		stream << "else if(typeof global===\"object\")global.__cheerp_profile_dump=__cheerp_profile_dump;" << NewLine;
+	}
+}
+
 void CheerpWriter::compileFileBegin(const OptionsSet& options)
 {
 	if (options[Options::NEED_SOURCE_MAPS])
@@ -6614,6 +6961,7 @@ void CheerpWriter::makeJS()
 
 	compileHelpers();
 	compileGenericJS();
+	compileProfileDump();
 
 	compileNamespaces();
 
@@ -6641,6 +6989,8 @@ void CheerpWriter::makeJS()
 	}
 
 	compileDefineExports();
+	if (useWasmWorkers())
+		compileWasmWorkerStart();
 	compileConstructors();
 	if (makeModule == MODULE_TYPE::COMMONJS)
 		compileCommonJSExports();
@@ -6800,6 +7150,23 @@ void CheerpWriter::JSBytesWriter::addByte(uint8_t byte)
 	first = false;
 }
 
+void CheerpWriter::JSBytesWriter::addBytes(llvm::ArrayRef<uint8_t> bytes)
+{
+	if(bytes.empty())
+		return;
+	// Format the whole span locally and hand it over to the proxy in one go
+	SmallString<1024> buf;
+	raw_svector_ostream os(buf);
+	for(uint8_t b: bytes)
+	{
+		if(!first)
+			os << ',';
+		os << (int)b;
+		first = false;
+	}
+	stream << buf.str();
+}
+
 void CheerpWriter::AsmJSGepWriter::addValue(const llvm::Value* v, uint32_t size)
 {
 	offset = true;
@@ -484,7 +484,7 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 		tableIt.second.name = nameHelper.makeGlobalName();
 	}
 	// Generate the rest of the builtins
-	for(int i=IMUL;i<=FETCHBUFFER;i++)
+	for(int i=IMUL;i<=FETCHWASM;i++)
 		builtins[i] = nameHelper.makeGlobalName();
 
 	if (shortestLocalName.size() == 0)
@@ -643,8 +643,11 @@ void NameGenerator::generateReadableNames(const Module& M, const GlobalDepsAnaly
 	builtins[ASSIGN_HEAPS] = "assignHeaps";
 	builtins[DUMMY] = "__dummy";
 	builtins[MEMORY] = "memory";
+	builtins[INIT_MEMORY] = "initMemory";
+	builtins[STACK_TOP] = "stackTop";
 	builtins[HANDLE_VAARG] = "handleVAArg";
 	builtins[FETCHBUFFER] = "fetchBuffer";
+	builtins[FETCHWASM] = "fetchWasm";
 	builtins[LABEL] = "label";
 	builtins[STACKPTR] = "__stackPtr";
 	builtins[HEAP8] = "HEAP8";
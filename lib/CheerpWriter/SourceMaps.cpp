@@ -23,11 +23,57 @@ namespace cheerp
 {
 
 SourceMapGenerator::SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, bool standAlone, std::error_code& ErrorCode):
-	sourceMap(sourceMapName.c_str(), ErrorCode, sys::fs::F_None), sourceMapName(sourceMapName), sourceMapPrefix(sourceMapPrefix),
+	SourceMapGenerator(sourceMapName, sourceMapPrefix, standAlone)
+{
+	sourceMap.reset(new ToolOutputFile(sourceMapName.c_str(), ErrorCode, sys::fs::F_None));
+}
+
+SourceMapGenerator::SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, bool standAlone):
+	sourceMapName(sourceMapName), sourceMapPrefix(sourceMapPrefix),
 	lastFile(0), lastLine(0), lastColumn(0), lastOffset(0), lineOffset(0), lastName(0), currentDebugLoc(nullptr), standAlone(standAlone), lineBegin(true)
 {
 }
 
+std::unique_ptr<SourceMapGenerator> SourceMapGenerator::createRecorder() const
+{
+	return std::unique_ptr<SourceMapGenerator>(new SourceMapGenerator(sourceMapName, sourceMapPrefix, standAlone));
+}
+
+SourceMapGenerator::Recording SourceMapGenerator::takeRecording()
+{
+	assert(isRecorder());
+	Recording ret = std::move(recording);
+	ret.lineOffset = lineOffset;
+	recording = Recording();
+	lineOffset = 0;
+	currentDebugLoc = nullptr;
+	return ret;
+}
+
+void SourceMapGenerator::replay(const Recording& r)
+{
+	assert(!isRecorder());
+	uint32_t lineStart = lineOffset;
+	for(const RecordedMapping& m: r.mappings)
+	{
+		lineOffset = lineStart + m.lineOffset;
+		switch(m.kind)
+		{
+			case RecordedMapping::FUNCTION_NAME:
+				setFunctionName(m.method);
+				break;
+			case RecordedMapping::DEBUG_LOC:
+				setDebugLoc(m.debugLoc);
+				break;
+			case RecordedMapping::END_OF_LINE:
+				finishLine();
+				lineStart = 0;
+				break;
+		}
+	}
+	lineOffset = lineStart + r.lineOffset;
+}
+
 static char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 void SourceMapGenerator::writeBase64VLQInt(int i)
@@ -44,12 +90,17 @@ void SourceMapGenerator::writeBase64VLQInt(int i)
 		i >>= 5;
 		if(i)
 			base64Char |= 0x20;
-		sourceMap.os() << base64Chars[base64Char];
+		sourceMap->os() << base64Chars[base64Char];
 	}
 	while(i);
 }
 
 void SourceMapGenerator::setFunctionName(const llvm::DISubprogram *method) {
+	if (isRecorder())
+	{
+		recordMapping(RecordedMapping::FUNCTION_NAME, method, nullptr);
+		return;
+	}
 	StringRef fileName = method->getFilename();
 	unsigned lineNumber = method->getLine();
 	StringRef functionName = method->getLinkageName();
@@ -74,7 +125,7 @@ void SourceMapGenerator::setFunctionName(const llvm::DISubprogram *method) {
 	uint32_t currentColumn = 0;
 
 	if(!lineBegin)
-		sourceMap.os() << ',';
+		sourceMap->os() << ',';
 	lineBegin = false;
 
 	// Starting column in the generated code
@@ -99,6 +150,11 @@ void SourceMapGenerator::setFunctionName(const llvm::DISubprogram *method) {
 void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc* debugLoc)
 {
 	currentDebugLoc = debugLoc;
+	if(isRecorder())
+	{
+		recordMapping(RecordedMapping::DEBUG_LOC, nullptr, debugLoc);
+		return;
+	}
 	if(debugLoc == nullptr)
 		return;
 	MDNode* file = debugLoc->getScope();
@@ -113,7 +169,7 @@ void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc* debugLoc)
 	uint32_t currentLine = debugLoc->getLine() - 1;
 	uint32_t currentColumn = debugLoc->getCol() - 1;
 	if(!lineBegin)
-		sourceMap.os() << ',';
+		sourceMap->os() << ',';
 	lineBegin = false;
 	// Starting column in the generated code
 	writeBase64VLQInt(lineOffset - lastOffset);
@@ -134,14 +190,21 @@ void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc* debugLoc)
 void SourceMapGenerator::beginFile()
 {
 	// Output the prologue of the file
-	sourceMap.os() << "{\n";
-	sourceMap.os() << "\"version\": 3,\n";
-	sourceMap.os() << "\"mappings\": \"";
+	sourceMap->os() << "{\n";
+	sourceMap->os() << "\"version\": 3,\n";
+	sourceMap->os() << "\"mappings\": \"";
 }
 
 void SourceMapGenerator::finishLine()
 {
-	sourceMap.os() << ";";
+	if(isRecorder())
+	{
+		// The last known debugLoc is repeated when replaying
+		recordMapping(RecordedMapping::END_OF_LINE, nullptr, nullptr);
+		lineOffset = 0;
+		return;
+	}
+	sourceMap->os() << ";";
 	lastOffset = 0;
 	lineOffset = 0;
 	lineBegin = true;
@@ -153,16 +216,16 @@ void SourceMapGenerator::finishLine()
 void SourceMapGenerator::endFile()
 {
 	// Output the prologue of the file
-	sourceMap.os() << "\",\n";
+	sourceMap->os() << "\",\n";
 	// Output file names
 	SmallVector<StringRef, 10> files(fileMap.size());
 	for(auto mapItem: fileMap)
 		files[mapItem.second] = mapItem.first;
-	sourceMap.os() << "\"sources\": [";
+	sourceMap->os() << "\"sources\": [";
 	for(uint32_t i=0;i<files.size();i++)
 	{
 		if(i!=0)
-			sourceMap.os() << ',';
+			sourceMap->os() << ',';
 		// Fix slashes in the file path
 		std::string tmp;
 		StringRef string = files[i];
@@ -177,49 +240,49 @@ void SourceMapGenerator::endFile()
 				c='/';
 			tmp.push_back(c);
 		}
-		sourceMap.os() << '"' << tmp << '"';
+		sourceMap->os() << '"' << tmp << '"';
 	}
-	sourceMap.os() << "],\n";
+	sourceMap->os() << "],\n";
 	// Output the contents of source files, if required
-	sourceMap.os() << "\"sourcesContent\": [";
+	sourceMap->os() << "\"sourcesContent\": [";
 	for(uint32_t i=0;i<files.size();i++)
 	{
 		if(i!=0)
-			sourceMap.os() << ',';
+			sourceMap->os() << ',';
 		if(files[i][0] != '/' && !standAlone)
 		{
-			sourceMap.os() << "null";
+			sourceMap->os() << "null";
 			continue;
 		}
 		llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> Buf = llvm::MemoryBuffer::getFile(files[i], -1, false);
 		std::error_code EC = Buf.getError();
 		if (EC)
 		{
-			sourceMap.os() << "null";
+			sourceMap->os() << "null";
 			llvm::errs() << "warning: Could not open source file " << files[i] << "\n";
 			continue;
 		}
-		sourceMap.os() << '"';
-		CheerpWriter::compileEscapedString(sourceMap.os(), Buf.get()->getBuffer(), /*forJSON*/true);
-		sourceMap.os() << '"';
+		sourceMap->os() << '"';
+		CheerpWriter::compileEscapedString(sourceMap->os(), Buf.get()->getBuffer(), /*forJSON*/true);
+		sourceMap->os() << '"';
 	}
-	sourceMap.os() << "],\n";
+	sourceMap->os() << "],\n";
 	// Output the symbol names
 	SmallVector<StringRef, 10> functions(functionNameMap.size());
 	for(auto mapItem: functionNameMap)
 		functions[mapItem.second] = mapItem.first;
-	sourceMap.os() << "\"names\": [";
+	sourceMap->os() << "\"names\": [";
 	for(uint32_t i=0; i < functions.size(); i++)
 	{
 		if (i != 0)
-			sourceMap.os() << ',';
+			sourceMap->os() << ',';
 		// Add an underscore to the function name to match the generated symbol
 		// names in the JavaScript file.
-		sourceMap.os() << '"' << functions[i] << '"';
+		sourceMap->os() << '"' << functions[i] << '"';
 	}
-	sourceMap.os() << "]\n";
-	sourceMap.os() << "}\n";
-	sourceMap.keep();
+	sourceMap->os() << "]\n";
+	sourceMap->os() << "}\n";
+	sourceMap->keep();
 }
 
 std::string SourceMapGenerator::getSourceMapName() const
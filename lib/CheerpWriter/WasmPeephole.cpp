@@ -0,0 +1,370 @@
+//===-- WasmPeephole.cpp - Cheerp rendering helper --------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpWasmPeephole"
+#include "WasmPeephole.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace llvm;
+using namespace cheerp;
+
+STATISTIC(NumBytesSaved, "Number of bytes saved by the wasm peephole optimizations");
+STATISTIC(NumFunctionsChanged, "Number of wasm functions changed by the peephole optimizations");
+
+static const uint8_t LOCAL_GET = 0x20;
+static const uint8_t LOCAL_SET = 0x21;
+static const uint8_t LOCAL_TEE = 0x22;
+static const uint8_t DROP = 0x1a;
+static const uint8_t END = 0x0b;
+
+uint32_t WasmPeephole::optimize(SmallVectorImpl<char>& body, uint32_t numParams, StringRef name)
+{
+	WasmPeephole peephole(StringRef(body.data(), body.size()), numParams);
+	if (!peephole.decode())
+	{
+		LLVM_DEBUG(dbgs() << name << ": unsupported opcode, skipped\n");
+		return 0;
+	}
+	// Removing a store may turn the instructions before it into dead code,
+	// and combining instructions may remove the last read of a local
+	while (true)
+	{
+		bool changed = peephole.removeDeadStores();
+		changed |= peephole.combineInstructions();
+		if (!changed)
+			break;
+	}
+	peephole.renumberLocals();
+
+	SmallVector<char, 128> out;
+	peephole.encode(out);
+	if (out.size() >= body.size())
+		return 0;
+	uint32_t saved = body.size() - out.size();
+	body.assign(out.begin(), out.end());
+	NumBytesSaved += saved;
+	NumFunctionsChanged++;
+	LLVM_DEBUG(dbgs() << name << ": " << saved << " bytes saved\n");
+	return saved;
+}
+
+bool WasmPeephole::readULEB(uint32_t& pos, uint64_t& value) const
+{
+	value = 0;
+	uint32_t shift = 0;
+	while (true)
+	{
+		if (pos >= body.size() || shift >= 64)
+			return false;
+		uint8_t byte = body[pos++];
+		value |= uint64_t(byte & 0x7f) << shift;
+		shift += 7;
+		if (!(byte & 0x80))
+			return true;
+	}
+}
+
+bool WasmPeephole::skipLEB(uint32_t& pos, uint32_t count) const
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		while (true)
+		{
+			if (pos >= body.size())
+				return false;
+			if (!(body[pos++] & 0x80))
+				break;
+		}
+	}
+	return true;
+}
+
+bool WasmPeephole::decodeInst(uint32_t& pos, Inst& inst) const
+{
+	inst.begin = pos;
+	inst.opcode = body[pos++];
+	inst.local = 0;
+	uint64_t value = 0;
+	bool ok = true;
+	switch (inst.opcode)
+	{
+		case 0x00: // unreachable
+		case 0x01: // nop
+		case 0x05: // else
+		case 0x0b: // end
+		case 0x0f: // return
+		case 0x1a: // drop
+		case 0x1b: // select
+		case 0xd1: // ref.is_null
+			break;
+		case 0x02: // block
+		case 0x03: // loop
+		case 0x04: // if
+		case 0x0c: // br
+		case 0x0d: // br_if
+		case 0x10: // call
+		case 0x12: // return_call
+		case 0x23: // global.get
+		case 0x24: // global.set
+		case 0x25: // table.get
+		case 0x26: // table.set
+		case 0x3f: // memory.size
+		case 0x40: // memory.grow
+		case 0xd2: // ref.func
+			ok = skipLEB(pos);
+			break;
+		case 0x0e: // br_table
+			ok = readULEB(pos, value) && skipLEB(pos, value + 1);
+			break;
+		case 0x11: // call_indirect
+		case 0x13: // return_call_indirect
+			ok = skipLEB(pos, 2);
+			break;
+		case LOCAL_GET:
+		case LOCAL_SET:
+		case LOCAL_TEE:
+			ok = readULEB(pos, value) && value < numParams + localTypes.size();
+			inst.local = value;
+			break;
+		case 0x41: // i32.const
+		case 0x42: // i64.const
+			ok = skipLEB(pos);
+			break;
+		case 0x43: // f32.const
+			pos += 4;
+			break;
+		case 0x44: // f64.const
+			pos += 8;
+			break;
+		case 0xd0: // ref.null
+			pos += 1;
+			break;
+		case 0xfc:
+			if (!readULEB(pos, value))
+				return false;
+			if (value <= 0x07) // trunc_sat
+				break;
+			else if (value == 0x08 || value == 0x0a || value == 0x0c || value == 0x0e)
+				ok = skipLEB(pos, 2);
+			else if (value <= 0x11)
+				ok = skipLEB(pos);
+			else
+				return false;
+			break;
+		case 0xfd:
+			if (!readULEB(pos, value))
+				return false;
+			if (value <= 0x0b) // loads and stores
+				ok = skipLEB(pos, 2);
+			else if (value <= 0x0d) // v128.const and i8x16.shuffle
+				pos += 16;
+			else if (value >= 0x15 && value <= 0x22) // lane accesses
+				pos += 1;
+			else if (value >= 0x54 && value <= 0x5d) // lane loads and stores
+				return false;
+			break;
+		case 0xfe:
+			if (!readULEB(pos, value))
+				return false;
+			if (value == 0x03) // atomic.fence
+				pos += 1;
+			else
+				ok = skipLEB(pos, 2);
+			break;
+		default:
+			if (inst.opcode >= 0x28 && inst.opcode <= 0x3e) // loads and stores
+				ok = skipLEB(pos, 2);
+			else if (inst.opcode < 0x45 || inst.opcode > 0xc4) // numeric instructions
+				return false;
+			break;
+	}
+	inst.end = pos;
+	return ok && pos <= body.size();
+}
+
+bool WasmPeephole::decode()
+{
+	uint32_t pos = 0;
+	uint64_t numGroups;
+	if (!readULEB(pos, numGroups))
+		return false;
+	for (uint64_t i = 0; i < numGroups; i++)
+	{
+		uint64_t count;
+		if (!readULEB(pos, count) || pos >= body.size() || count > (1 << 20))
+			return false;
+		uint8_t type = body[pos++];
+		localTypes.insert(localTypes.end(), count, localGroups.size());
+		localGroups.push_back({uint32_t(count), type});
+	}
+	while (pos < body.size())
+	{
+		Inst inst;
+		if (!decodeInst(pos, inst))
+			return false;
+		insts.push_back(inst);
+	}
+	return !insts.empty() && insts.back().opcode == END;
+}
+
+bool WasmPeephole::sameBytes(const Inst& a, const Inst& b) const
+{
+	return a.opcode == b.opcode &&
+		body.slice(a.begin, a.end) == body.slice(b.begin, b.end);
+}
+
+bool WasmPeephole::combineInstructions()
+{
+	// The instructions are pushed one at a time, and the rules are applied
+	// on the tail until none matches, so that the rewrites cascade
+	std::vector<Inst> out;
+	out.reserve(insts.size());
+	bool changed = false;
+	for (const Inst& inst: insts)
+	{
+		out.push_back(inst);
+		while (out.size() >= 2)
+		{
+			Inst& last = out[out.size() - 1];
+			Inst& prev = out[out.size() - 2];
+			if (prev.opcode == LOCAL_SET && last.opcode == LOCAL_GET && prev.local == last.local)
+			{
+				// local.set X, local.get X -> local.tee X
+				prev.opcode = LOCAL_TEE;
+				out.pop_back();
+			}
+			else if (prev.opcode == LOCAL_TEE && last.opcode == DROP)
+			{
+				// local.tee X, drop -> local.set X
+				prev.opcode = LOCAL_SET;
+				out.pop_back();
+			}
+			else if ((isConstant(prev) || prev.opcode == LOCAL_GET) && last.opcode == DROP)
+			{
+				// A value without side effects which is immediately dropped
+				out.pop_back();
+				out.pop_back();
+			}
+			else if (out.size() >= 3 && isConstant(last) && prev.opcode == LOCAL_SET &&
+				sameBytes(out[out.size() - 3], last))
+			{
+				// C, local.set X, C -> C, local.tee X
+				prev.opcode = LOCAL_TEE;
+				out.pop_back();
+			}
+			else
+				break;
+			changed = true;
+		}
+	}
+	insts = std::move(out);
+	return changed;
+}
+
+bool WasmPeephole::removeDeadStores()
+{
+	std::vector<uint32_t> gets(numParams + localTypes.size(), 0);
+	for (const Inst& inst: insts)
+	{
+		if (inst.opcode == LOCAL_GET)
+			gets[inst.local]++;
+	}
+	std::vector<Inst> out;
+	out.reserve(insts.size());
+	bool changed = false;
+	for (Inst inst: insts)
+	{
+		if (isLocalAccess(inst) && gets[inst.local] == 0)
+		{
+			changed = true;
+			// The value of a tee is still needed, a set becomes a drop
+			if (inst.opcode == LOCAL_TEE)
+				continue;
+			if (inst.opcode == LOCAL_SET)
+				inst.opcode = DROP;
+		}
+		out.push_back(inst);
+	}
+	insts = std::move(out);
+	return changed;
+}
+
+void WasmPeephole::renumberLocals()
+{
+	std::vector<uint32_t> uses(numParams + localTypes.size(), 0);
+	for (const Inst& inst: insts)
+	{
+		if (isLocalAccess(inst))
+			uses[inst.local]++;
+	}
+	localMap.resize(uses.size());
+	for (uint32_t i = 0; i < numParams; i++)
+		localMap[i] = i;
+
+	// The order of the groups is kept, the unused locals are removed and the
+	// remaining ones are sorted by number of uses
+	std::vector<LocalGroup> newGroups;
+	uint32_t first = numParams;
+	uint32_t next = numParams;
+	for (const LocalGroup& group: localGroups)
+	{
+		std::vector<uint32_t> used;
+		for (uint32_t i = first; i < first + group.count; i++)
+		{
+			if (uses[i])
+				used.push_back(i);
+		}
+		first += group.count;
+		if (used.empty())
+			continue;
+		std::stable_sort(used.begin(), used.end(), [&uses](uint32_t a, uint32_t b)
+		{
+			return uses[a] > uses[b];
+		});
+		for (uint32_t local: used)
+			localMap[local] = next++;
+		if (!newGroups.empty() && newGroups.back().type == group.type)
+			newGroups.back().count += used.size();
+		else
+			newGroups.push_back({uint32_t(used.size()), group.type});
+	}
+	localGroups = std::move(newGroups);
+}
+
+void WasmPeephole::encode(SmallVectorImpl<char>& out) const
+{
+	raw_svector_ostream stream(out);
+	encodeULEB128(localGroups.size(), stream);
+	for (const LocalGroup& group: localGroups)
+	{
+		encodeULEB128(group.count, stream);
+		stream << char(group.type);
+	}
+	for (const Inst& inst: insts)
+	{
+		if (isLocalAccess(inst))
+		{
+			stream << char(inst.opcode);
+			encodeULEB128(localMap[inst.local], stream);
+		}
+		else if (inst.opcode == DROP)
+		{
+			// Rewritten local.set instructions have the original bytes of the set
+			stream << char(DROP);
+		}
+		else
+			stream << body.slice(inst.begin, inst.end);
+	}
+}
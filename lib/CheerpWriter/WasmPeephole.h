@@ -0,0 +1,89 @@
+//===-- Cheerp/WasmPeephole.h - Cheerp rendering helper ---------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_WASM_PEEPHOLE_H
+#define _CHEERP_WASM_PEEPHOLE_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include <vector>
+
+namespace cheerp
+{
+
+/**
+ * Peephole optimizations on the encoded body of a wasm function. The body is
+ * decoded into a list of instructions, which is rewritten and encoded again:
+ * - local.set X, local.get X becomes local.tee X
+ * - local.tee X, drop becomes local.set X
+ * - a constant or local.get followed by drop is removed
+ * - C, local.set X, C becomes C, local.tee X for the same constant C
+ * - locals which are never read are not written, and locals which are never
+ *   used are removed
+ * - the locals of each type are renumbered by number of uses, so that the
+ *   most used ones get the shortest indexes
+ * Functions using opcodes which the decoder does not know are left untouched.
+ */
+class WasmPeephole
+{
+public:
+	// Optimize the body (locals declaration and code) in place, and return the
+	// number of bytes saved. The name is only used for debug output
+	static uint32_t optimize(llvm::SmallVectorImpl<char>& body, uint32_t numParams, llvm::StringRef name);
+private:
+	struct Inst
+	{
+		// Bytes of the encoded instruction in the original body
+		uint32_t begin;
+		uint32_t end;
+		uint8_t opcode;
+		// The local index for local.get/set/tee
+		uint32_t local;
+	};
+	struct LocalGroup
+	{
+		uint32_t count;
+		uint8_t type;
+	};
+	WasmPeephole(llvm::StringRef body, uint32_t numParams): body(body), numParams(numParams)
+	{
+	}
+	bool decode();
+	bool decodeInst(uint32_t& pos, Inst& inst) const;
+	bool readULEB(uint32_t& pos, uint64_t& value) const;
+	bool skipLEB(uint32_t& pos, uint32_t count = 1) const;
+	bool isLocalAccess(const Inst& inst) const
+	{
+		return inst.opcode >= 0x20 && inst.opcode <= 0x22;
+	}
+	bool isConstant(const Inst& inst) const
+	{
+		return inst.opcode >= 0x41 && inst.opcode <= 0x44;
+	}
+	bool sameBytes(const Inst& a, const Inst& b) const;
+	bool combineInstructions();
+	bool removeDeadStores();
+	void renumberLocals();
+	void encode(llvm::SmallVectorImpl<char>& out) const;
+
+	llvm::StringRef body;
+	uint32_t numParams;
+	std::vector<LocalGroup> localGroups;
+	// Group of each declared local, the parameters are not included
+	std::vector<uint32_t> localTypes;
+	std::vector<Inst> insts;
+	// New index of each local, in the order of declaration
+	std::vector<uint32_t> localMap;
+};
+
+}
+
+#endif
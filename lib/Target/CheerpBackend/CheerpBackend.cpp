@@ -10,6 +10,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "CheerpTargetMachine.h"
+#include "CheerpTargetTransformInfo.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/FileSystem.h"
@@ -30,6 +31,8 @@
 #include "llvm/Cheerp/FixIrreducibleControlFlow.h"
 #include "llvm/Cheerp/IdenticalCodeFolding.h"
 #include "llvm/Cheerp/ByValLowering.h"
+#include "llvm/Cheerp/AtomicLowering.h"
+#include "llvm/Cheerp/MultiValueReturns.h"
 #include "llvm/Cheerp/PointerPasses.h"
 #include "llvm/Cheerp/GEPOptimizer.h"
 #include "llvm/Cheerp/CFGPasses.h"
@@ -38,6 +41,7 @@
 #include "llvm/Cheerp/StructMemFuncLowering.h"
 #include "llvm/Cheerp/ConstantExprLowering.h"
 #include "llvm/Cheerp/StoreMerging.h"
+#include "llvm/Cheerp/InstrProfLowering.h"
 #include "llvm/Cheerp/CommandLine.h"
 #include "llvm/Transforms/Scalar.h"
 
@@ -86,9 +90,12 @@ bool CheerpWritePass::runOnModule(Module& M)
   }
   PA.fullResolve();
   PA.computeConstantOffsets(M);
+  PA.freeze();
   // Destroy the stores here, we need them to properly compute the pointer kinds, but we want to optimize them away before registerize
   allocaStoresExtractor.destroyStores();
-  registerize.assignRegisters(M, PA);
+  // Registerize and the writers may query the pointer kinds from multiple threads
+  PA.setConcurrentAccess(CheerpCodegenThreads != 1);
+  registerize.assignRegisters(M, PA, CheerpCodegenThreads);
 #ifdef REGISTERIZE_STATS
   cheerp::reportRegisterizeStatistics();
 #endif
@@ -136,7 +143,8 @@ bool CheerpWritePass::runOnModule(Module& M)
     cheerp::CheerpWriter writer(M, *this, Out, PA, registerize, GDA, linearHelper, namegen, allocaStoresExtractor, memOut, asmjsMemFile,
             sourceMapGenerator.get(), PrettyCode, MakeModule, !NoNativeJavaScriptMath,
             !NoJavaScriptMathImul, !NoJavaScriptMathFround, !NoCredits, MeasureTimeToMain, CheerpHeapSize,
-            BoundsCheck, CfgLegacy, SymbolicGlobalsAsmJS, wasmFile, ForceTypedArrays);
+            BoundsCheck, CfgLegacy, SymbolicGlobalsAsmJS, wasmFile, ForceTypedArrays,
+            CheerpCodegenThreads);
     writer.makeJS();
   }
 
@@ -145,7 +153,7 @@ bool CheerpWritePass::runOnModule(Module& M)
     cheerp::CheerpWasmWriter wasmWriter(M, *this, *secondaryOut, PA, registerize, GDA, linearHelper, namegen,
                                     M.getContext(), CheerpHeapSize, !WasmOnly,
                                     PrettyCode, CfgLegacy, WasmSharedMemory,
-                                    WasmExportedTable);
+                                    WasmExportedTable, CheerpCodegenThreads);
     wasmWriter.makeWasm();
   }
   if (!SecondaryOutputFile.empty() && ErrorCode)
@@ -201,8 +209,12 @@ bool CheerpTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
                  !WasmSharedMemory;
 
 
+  PM.add(createInstrProfLoweringPass());
   if (FixWrongFuncCasts)
     PM.add(createFixFunctionCastsPass());
+  PM.add(createAtomicLoweringPass(WasmSharedMemory && LinearOutput == Wasm));
+  if (WasmMultiValue && LinearOutput == Wasm)
+    PM.add(createMultiValueReturnsPass());
   PM.add(createCheerpLowerSwitchPass(/*onlyLowerI64*/false));
   PM.add(createLowerAndOrBranchesPass());
   PM.add(createStructMemFuncLowering());
@@ -245,3 +257,12 @@ const CheerpSubtarget* CheerpTargetMachine::getSubtargetImpl(const Function &F)
 {
   return &subTargetInfo;
 }
+
+TargetTransformInfo CheerpTargetMachine::getTargetTransformInfo(const Function &F)
+{
+  // Vector code can only be encoded in wasm functions, keep the default costs
+  // for everything else
+  if (!WasmSIMD || LinearOutput != Wasm || F.getSection() != StringRef("asmjs"))
+    return TargetTransformInfo(F.getParent()->getDataLayout());
+  return TargetTransformInfo(CheerpTTIImpl(this, F));
+}
@@ -57,6 +57,7 @@ public:
                                    bool DisableVerify,
                                    MachineModuleInfo *MMI = nullptr) override;
   virtual const CheerpSubtarget* getSubtargetImpl(const Function &F) const override;
+  virtual TargetTransformInfo getTargetTransformInfo(const Function &F) override;
 };
 
 extern Target TheCheerpBackendTarget;
@@ -0,0 +1,289 @@
+//===-- CheerpTargetTransformInfo.cpp - Cheerp specific TTI ---------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "CheerpTargetTransformInfo.h"
+#include "llvm/IR/InstrTypes.h"
+
+using namespace llvm;
+
+// The cost of an operation which cannot be encoded, it must always be higher
+// than the scalar code it would replace
+static const unsigned UnsupportedCost = 1000;
+
+static bool isMaskType(Type *Ty) {
+  return Ty->getScalarType()->isIntegerTy(1);
+}
+
+CheerpTTIImpl::CheerpTTIImpl(const CheerpTargetMachine *TM, const Function &F)
+    : BaseT(TM, F.getParent()->getDataLayout()), ST(TM->getSubtargetImpl(F)),
+      TLI(ST->getTargetLowering()) {}
+
+// Same as the v128 shapes of the wasm writer, except for vectors of pointers:
+// the writer has no vector GEPs, so the vectorizers must not widen addresses
+bool CheerpTTIImpl::isSIMDType(Type *Ty) const {
+  if (!Ty->isVectorTy())
+    return false;
+  Type *ElemTy = Ty->getVectorElementType();
+  unsigned NumElts = Ty->getVectorNumElements();
+  if (ElemTy->isIntegerTy(1))
+    return NumElts == 2 || NumElts == 4 || NumElts == 8 || NumElts == 16;
+  if (ElemTy->isIntegerTy()) {
+    unsigned Bits = ElemTy->getIntegerBitWidth();
+    return Bits >= 8 && Bits <= 64 && isPowerOf2_32(Bits) && Bits * NumElts == 128;
+  }
+  if (ElemTy->isFloatTy())
+    return NumElts == 4;
+  if (ElemTy->isDoubleTy())
+    return NumElts == 2;
+  return false;
+}
+
+unsigned CheerpTTIImpl::getUnsupportedCost(Type *Ty) const {
+  return UnsupportedCost * (Ty->isVectorTy() ? Ty->getVectorNumElements() : 1);
+}
+
+unsigned CheerpTTIImpl::getNumberOfRegisters(bool Vector) {
+  if (Vector)
+    return 16;
+  return BaseT::getNumberOfRegisters(Vector);
+}
+
+unsigned CheerpTTIImpl::getRegisterBitWidth(bool Vector) const {
+  if (Vector)
+    return 128;
+  return 32;
+}
+
+unsigned CheerpTTIImpl::getNumberOfParts(Type *Tp) {
+  if (!Tp->isVectorTy())
+    return BaseT::getNumberOfParts(Tp);
+  return isSIMDType(Tp) ? 1 : Tp->getVectorNumElements();
+}
+
+unsigned CheerpTTIImpl::getArithmeticInstrCost(
+    unsigned Opcode, Type *Ty, TTI::OperandValueKind Opd1Info,
+    TTI::OperandValueKind Opd2Info, TTI::OperandValueProperties Opd1PropInfo,
+    TTI::OperandValueProperties Opd2PropInfo, ArrayRef<const Value *> Args) {
+  if (!Ty->isVectorTy())
+    return BaseT::getArithmeticInstrCost(Opcode, Ty, Opd1Info, Opd2Info,
+                                         Opd1PropInfo, Opd2PropInfo, Args);
+  if (!isSIMDType(Ty))
+    return getUnsupportedCost(Ty);
+  Type *ElemTy = Ty->getScalarType();
+  bool isInt = ElemTy->isIntegerTy() && !isMaskType(Ty);
+  bool supported = false;
+  switch (Opcode) {
+  case Instruction::Add:
+  case Instruction::Sub:
+    supported = isInt;
+    break;
+  case Instruction::Mul:
+    // There is no i8x16.mul
+    supported = isInt && !ElemTy->isIntegerTy(8);
+    break;
+  case Instruction::And:
+  case Instruction::Or:
+  case Instruction::Xor:
+    supported = ElemTy->isIntegerTy();
+    break;
+  case Instruction::FAdd:
+  case Instruction::FSub:
+  case Instruction::FMul:
+  case Instruction::FDiv:
+  case Instruction::FNeg:
+    supported = ElemTy->isFloatingPointTy();
+    break;
+  case Instruction::Shl:
+  case Instruction::LShr:
+  case Instruction::AShr:
+    // The shift amount is a scalar
+    supported = isInt && (Opd2Info == TTI::OK_UniformValue ||
+                          Opd2Info == TTI::OK_UniformConstantValue);
+    break;
+  default:
+    break;
+  }
+  return supported ? TTI::TCC_Basic : getUnsupportedCost(Ty);
+}
+
+unsigned CheerpTTIImpl::getShuffleCost(TTI::ShuffleKind Kind, Type *Tp,
+                                       int Index, Type *SubTp) {
+  // Shuffles changing the length are not supported, all the others are a
+  // splat or an i8x16.shuffle
+  if (!isSIMDType(Tp) || Kind == TTI::SK_ExtractSubvector ||
+      Kind == TTI::SK_InsertSubvector)
+    return getUnsupportedCost(Tp);
+  return TTI::TCC_Basic;
+}
+
+unsigned CheerpTTIImpl::getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
+                                         const Instruction *I) {
+  if (!Dst->isVectorTy() && !Src->isVectorTy())
+    return BaseT::getCastInstrCost(Opcode, Dst, Src, I);
+  if (!isSIMDType(Dst) || !isSIMDType(Src))
+    return getUnsupportedCost(Dst);
+  Type *DstElemTy = Dst->getScalarType();
+  Type *SrcElemTy = Src->getScalarType();
+  switch (Opcode) {
+  case Instruction::SExt:
+    // Masks already have all the bits of the lane set
+    if (isMaskType(Src) && !isMaskType(Dst))
+      return TTI::TCC_Free;
+    break;
+  case Instruction::ZExt:
+    if (isMaskType(Src) && !isMaskType(Dst))
+      return TTI::TCC_Basic;
+    break;
+  case Instruction::SIToFP:
+  case Instruction::UIToFP:
+    if (SrcElemTy->isIntegerTy(32) && DstElemTy->isFloatTy())
+      return TTI::TCC_Basic;
+    break;
+  case Instruction::FPToSI:
+  case Instruction::FPToUI:
+    if (SrcElemTy->isFloatTy() && DstElemTy->isIntegerTy(32))
+      return TTI::TCC_Basic;
+    break;
+  case Instruction::BitCast:
+    if (!isMaskType(Src) && !isMaskType(Dst))
+      return TTI::TCC_Free;
+    break;
+  default:
+    break;
+  }
+  return getUnsupportedCost(Dst);
+}
+
+unsigned CheerpTTIImpl::getCmpSelInstrCost(unsigned Opcode, Type *ValTy,
+                                           Type *CondTy,
+                                           const Instruction *I) {
+  if (!ValTy->isVectorTy())
+    return BaseT::getCmpSelInstrCost(Opcode, ValTy, CondTy, I);
+  if (!isSIMDType(ValTy))
+    return getUnsupportedCost(ValTy);
+  Type *ElemTy = ValTy->getScalarType();
+  const CmpInst *CI = dyn_cast_or_null<CmpInst>(I);
+  switch (Opcode) {
+  case Instruction::ICmp:
+    if (isMaskType(ValTy) || ElemTy->isFloatingPointTy())
+      break;
+    // There are no unsigned i64x2 comparisons
+    if (ElemTy->isIntegerTy(64) && (!CI || CI->isUnsigned()))
+      break;
+    return TTI::TCC_Basic;
+  case Instruction::FCmp:
+    if (!ElemTy->isFloatingPointTy())
+      break;
+    if (CI) {
+      switch (CI->getPredicate()) {
+      case CmpInst::FCMP_OEQ:
+      case CmpInst::FCMP_UNE:
+      case CmpInst::FCMP_OLT:
+      case CmpInst::FCMP_OGT:
+      case CmpInst::FCMP_OLE:
+      case CmpInst::FCMP_OGE:
+        return TTI::TCC_Basic;
+      default:
+        return getUnsupportedCost(ValTy);
+      }
+    }
+    return TTI::TCC_Basic;
+  case Instruction::Select:
+    if (CondTy && CondTy->isVectorTy() && !isSIMDType(CondTy))
+      break;
+    return TTI::TCC_Basic;
+  default:
+    break;
+  }
+  return getUnsupportedCost(ValTy);
+}
+
+unsigned CheerpTTIImpl::getVectorInstrCost(unsigned Opcode, Type *Val,
+                                           unsigned Index) {
+  // Lanes are only accessed with constant indexes, and not in masks
+  if (!isSIMDType(Val) || isMaskType(Val) || Index == -1u)
+    return getUnsupportedCost(Val);
+  return TTI::TCC_Basic;
+}
+
+unsigned CheerpTTIImpl::getMemoryOpCost(unsigned Opcode, Type *Src,
+                                        unsigned Alignment,
+                                        unsigned AddressSpace,
+                                        const Instruction *I) {
+  if (!Src->isVectorTy())
+    return BaseT::getMemoryOpCost(Opcode, Src, Alignment, AddressSpace, I);
+  if (!isSIMDType(Src) || isMaskType(Src))
+    return getUnsupportedCost(Src);
+  return TTI::TCC_Basic;
+}
+
+unsigned CheerpTTIImpl::getIntrinsicInstrCost(Intrinsic::ID IID, Type *RetTy,
+                                              ArrayRef<Value *> Args,
+                                              FastMathFlags FMF, unsigned VF) {
+  // Vector intrinsics are never lowered
+  if (RetTy->isVectorTy())
+    return getUnsupportedCost(RetTy);
+  if (VF > 1)
+    return UnsupportedCost * VF;
+  for (const Value *Arg : Args)
+    if (Arg->getType()->isVectorTy())
+      return getUnsupportedCost(Arg->getType());
+  return BaseT::getIntrinsicInstrCost(IID, RetTy, Args, FMF, VF);
+}
+
+unsigned CheerpTTIImpl::getIntrinsicInstrCost(Intrinsic::ID IID, Type *RetTy,
+                                              ArrayRef<Type *> Tys,
+                                              FastMathFlags FMF,
+                                              unsigned ScalarizationCostPassed) {
+  if (RetTy->isVectorTy())
+    return getUnsupportedCost(RetTy);
+  for (Type *Ty : Tys)
+    if (Ty->isVectorTy())
+      return getUnsupportedCost(Ty);
+  return BaseT::getIntrinsicInstrCost(IID, RetTy, Tys, FMF,
+                                      ScalarizationCostPassed);
+}
+
+unsigned CheerpTTIImpl::getCallInstrCost(Function *F, Type *RetTy,
+                                         ArrayRef<Type *> Tys) {
+  if (RetTy->isVectorTy())
+    return getUnsupportedCost(RetTy);
+  for (Type *Ty : Tys)
+    if (Ty->isVectorTy())
+      return getUnsupportedCost(Ty);
+  return BaseT::getCallInstrCost(F, RetTy, Tys);
+}
+
+// Reductions are lowered as a sequence of shuffles and operations on the
+// halves of the vector, followed by an extract of the first lane
+unsigned CheerpTTIImpl::getArithmeticReductionCost(unsigned Opcode, Type *Ty,
+                                                   bool IsPairwise) {
+  unsigned Steps = Log2_32(Ty->getVectorNumElements());
+  unsigned StepCost = getShuffleCost(TTI::SK_PermuteSingleSrc, Ty, 0, nullptr) +
+                      getArithmeticInstrCost(Opcode, Ty);
+  return Steps * StepCost +
+         getVectorInstrCost(Instruction::ExtractElement, Ty, 0);
+}
+
+unsigned CheerpTTIImpl::getMinMaxReductionCost(Type *Ty, Type *CondTy,
+                                               bool IsPairwise,
+                                               bool IsUnsigned) {
+  unsigned Steps = Log2_32(Ty->getVectorNumElements());
+  unsigned CmpOpcode = Ty->isFPOrFPVectorTy() ? Instruction::FCmp : Instruction::ICmp;
+  unsigned StepCost = getShuffleCost(TTI::SK_PermuteSingleSrc, Ty, 0, nullptr) +
+                      getCmpSelInstrCost(CmpOpcode, Ty, CondTy) +
+                      getCmpSelInstrCost(Instruction::Select, Ty, CondTy);
+  // There are no unsigned i64x2 comparisons
+  if (IsUnsigned && Ty->getScalarType()->isIntegerTy(64))
+    return getUnsupportedCost(Ty);
+  return Steps * StepCost +
+         getVectorInstrCost(Instruction::ExtractElement, Ty, 0);
+}
@@ -0,0 +1,77 @@
+//===-- CheerpTargetTransformInfo.h - Cheerp specific TTI -----------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2020 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_TARGETTRANSFORMINFO_H
+#define _CHEERP_TARGETTRANSFORMINFO_H
+
+#include "CheerpTargetMachine.h"
+#include "llvm/CodeGen/BasicTTIImpl.h"
+
+namespace llvm {
+
+// Only used for wasm functions compiled with -cheerp-wasm-simd. Scalar queries
+// are answered by the basic implementation, and the vector costs only allow the
+// types and operations that the wasm writer can encode with SIMD128, everything
+// else is too expensive to be vectorized.
+class CheerpTTIImpl final : public BasicTTIImplBase<CheerpTTIImpl> {
+  typedef BasicTTIImplBase<CheerpTTIImpl> BaseT;
+  typedef TargetTransformInfo TTI;
+  friend BaseT;
+
+  const CheerpSubtarget *ST;
+  const CheerpTargetLowering *TLI;
+
+  const CheerpSubtarget *getST() const { return ST; }
+  const CheerpTargetLowering *getTLI() const { return TLI; }
+
+  bool isSIMDType(Type *Ty) const;
+  unsigned getUnsupportedCost(Type *Ty) const;
+
+public:
+  CheerpTTIImpl(const CheerpTargetMachine *TM, const Function &F);
+
+  unsigned getNumberOfRegisters(bool Vector);
+  unsigned getRegisterBitWidth(bool Vector) const;
+  unsigned getNumberOfParts(Type *Tp);
+
+  unsigned getArithmeticInstrCost(
+      unsigned Opcode, Type *Ty,
+      TTI::OperandValueKind Opd1Info = TTI::OK_AnyValue,
+      TTI::OperandValueKind Opd2Info = TTI::OK_AnyValue,
+      TTI::OperandValueProperties Opd1PropInfo = TTI::OP_None,
+      TTI::OperandValueProperties Opd2PropInfo = TTI::OP_None,
+      ArrayRef<const Value *> Args = ArrayRef<const Value *>());
+  unsigned getShuffleCost(TTI::ShuffleKind Kind, Type *Tp, int Index,
+                          Type *SubTp);
+  unsigned getCastInstrCost(unsigned Opcode, Type *Dst, Type *Src,
+                            const Instruction *I = nullptr);
+  unsigned getCmpSelInstrCost(unsigned Opcode, Type *ValTy, Type *CondTy,
+                              const Instruction *I = nullptr);
+  unsigned getVectorInstrCost(unsigned Opcode, Type *Val, unsigned Index);
+  unsigned getMemoryOpCost(unsigned Opcode, Type *Src, unsigned Alignment,
+                           unsigned AddressSpace,
+                           const Instruction *I = nullptr);
+  unsigned getIntrinsicInstrCost(Intrinsic::ID IID, Type *RetTy,
+                                 ArrayRef<Value *> Args, FastMathFlags FMF,
+                                 unsigned VF = 1);
+  unsigned getIntrinsicInstrCost(
+      Intrinsic::ID IID, Type *RetTy, ArrayRef<Type *> Tys, FastMathFlags FMF,
+      unsigned ScalarizationCostPassed = std::numeric_limits<unsigned>::max());
+  unsigned getCallInstrCost(Function *F, Type *RetTy, ArrayRef<Type *> Tys);
+  unsigned getArithmeticReductionCost(unsigned Opcode, Type *Ty,
+                                      bool IsPairwise);
+  unsigned getMinMaxReductionCost(Type *Ty, Type *CondTy, bool IsPairwise,
+                                  bool IsUnsigned);
+};
+
+} // End llvm namespace
+
+#endif
@@ -23,7 +23,9 @@
 #include "llvm/Analysis/ScopedNoAliasAA.h"
 #include "llvm/Analysis/TargetLibraryInfo.h"
 #include "llvm/Analysis/TypeBasedAliasAnalysis.h"
+#include "llvm/Cheerp/CommandLine.h"
 #include "llvm/Cheerp/StructMemFuncLowering.h"
+#include "llvm/Cheerp/VTableDevirtualization.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Verifier.h"
@@ -540,6 +542,11 @@ void PassManagerBuilder::populateModulePassManager(
   addExtensionsToPM(EP_Peephole, MPM);
   MPM.add(createCFGSimplificationPass()); // Clean up after IPCP & DAE
 
+  // Cheerp LTO sees the whole program, resolve the virtual calls with a
+  // single possible target before inlining
+  if (CheerpLTO)
+    MPM.add(createVTableDevirtualizationPass());
+
   // For SamplePGO in ThinLTO compile phase, we do not want to do indirect
   // call promotion as it will change the CFG too much to make the 2nd
   // profile annotation in backend more difficult.
@@ -678,7 +685,10 @@ void PassManagerBuilder::populateModulePassManager(
   // llvm.loop.distribute=true or when -enable-loop-distribute is specified.
   MPM.add(createLoopDistributePass());
 
-  MPM.add(createLoopVectorizePass(!LoopsInterleaved, !LoopVectorize));
+  // Cheerp: with wasm SIMD the whole program is vectorized during LTO, the
+  // cost model of the target only allows what can be encoded with SIMD128
+  bool CheerpVectorize = CheerpLTO && WasmSIMD && OptLevel > 1 && SizeLevel < 2;
+  MPM.add(createLoopVectorizePass(!LoopsInterleaved, !LoopVectorize && !CheerpVectorize));
 
   // Eliminate loads by forwarding stores from the previous iteration to loads
   // of the current iteration.
@@ -713,7 +723,7 @@ void PassManagerBuilder::populateModulePassManager(
   // before SLP vectorization.
   MPM.add(createCFGSimplificationPass(1, true, true, false, true));
 
-  if (SLPVectorize) {
+  if (SLPVectorize || CheerpVectorize) {
     MPM.add(createSLPVectorizerPass()); // Vectorize parallel scalar chains.
     if (OptLevel > 1 && ExtraVectorizerPasses) {
       MPM.add(createEarlyCSEPass());
@@ -493,6 +493,11 @@ bool InstrProfiling::run(Module &M, const TargetLibraryInfo &TLI) {
                               MemOPSizeRangeLast);
   TT = Triple(M.getTargetTriple());
 
+  // There is no profile runtime for Cheerp, the backend lowers the
+  // intrinsics itself and generates the code to dump the counters.
+  if (TT.getArch() == Triple::cheerp)
+    return false;
+
   // Emit the runtime hook even if no counters are present.
   bool MadeChange = emitRuntimeHook();
 
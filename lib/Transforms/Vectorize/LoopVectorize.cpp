@@ -7621,10 +7621,10 @@ bool LoopVectorizePass::runImpl(
   if (!TTI->getNumberOfRegisters(true) && TTI->getMaxInterleaveFactor(1) < 2)
     return false;
 
-  //Cheerp: currently JS does not support vector instructions,
-  //they might be supported in the future though.
+  //Cheerp: JS does not support vector instructions, only wasm functions
+  //can be vectorized, and the target only has vector registers with SIMD
   const DataLayout &DL = F.getParent()->getDataLayout();
-  if (!DL.isByteAddressable()) {
+  if (!DL.isByteAddressable() && F.getSection() != StringRef("asmjs")) {
     LLVM_DEBUG(dbgs() << "LV: Not vectorizing on NBA target");
     return false;
   }
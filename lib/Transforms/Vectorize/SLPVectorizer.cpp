@@ -5055,7 +5055,8 @@ bool SLPVectorizerPass::runImpl(Function &F, ScalarEvolution *SE_,
   if (!TTI->getNumberOfRegisters(true))
     return false;
 
-  if (!DL->isByteAddressable())
+  // Cheerp: only wasm functions can be vectorized
+  if (!DL->isByteAddressable() && F.getSection() != StringRef("asmjs"))
     return false;
 
   // Don't vectorize when the attribute NoImplicitFloat is used.
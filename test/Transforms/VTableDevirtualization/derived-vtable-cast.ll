@@ -0,0 +1,58 @@
+; RUN: opt < %s -VTableDevirtualization -S | FileCheck %s
+
+; The vtable of B is only seen as a vtable of A through a cast, so the slot
+; of %vtA may also contain B_f
+
+%A = type { %vtA* }
+%C = type { %vtC* }
+%vtA = type { void (%A*)* }
+%vtB = type { void (%A*)*, void (%A*)* }
+%vtC = type { void (%C*)* }
+
+@_ZTV1A = constant %vtA { void (%A*)* @A_f }
+@_ZTV1B = constant %vtB { void (%A*)* @B_f, void (%A*)* @B_g }
+@_ZTV1C = constant %vtC { void (%C*)* @C_f }
+
+define void @A_f(%A* %this) {
+  ret void
+}
+
+define void @B_f(%A* %this) {
+  ret void
+}
+
+define void @B_g(%A* %this) {
+  ret void
+}
+
+define void @C_f(%C* %this) {
+  ret void
+}
+
+define void @makeB(%A* %o) {
+  %vptr = getelementptr %A, %A* %o, i32 0, i32 0
+  store %vtA* bitcast (%vtB* @_ZTV1B to %vtA*), %vtA** %vptr
+  ret void
+}
+
+; CHECK-LABEL: @callA(
+; CHECK: call void %f(
+define void @callA(%A* %o) {
+  %vptr = getelementptr %A, %A* %o, i32 0, i32 0
+  %vt = load %vtA*, %vtA** %vptr
+  %slot = getelementptr %vtA, %vtA* %vt, i32 0, i32 0
+  %f = load void (%A*)*, void (%A*)** %slot
+  call void %f(%A* %o)
+  ret void
+}
+
+; CHECK-LABEL: @callC(
+; CHECK: call void @C_f(
+define void @callC(%C* %o) {
+  %vptr = getelementptr %C, %C* %o, i32 0, i32 0
+  %vt = load %vtC*, %vtC** %vptr
+  %slot = getelementptr %vtC, %vtC* %vt, i32 0, i32 0
+  %f = load void (%C*)*, void (%C*)** %slot
+  call void %f(%C* %o)
+  ret void
+}
@@ -0,0 +1,56 @@
+; RUN: opt < %s -VTableDevirtualization -S | FileCheck %s
+
+; A struct of function pointers with the same type as a vtable is allocated
+; on the heap, so its slot may contain any function
+
+%A = type { %vtA* }
+%C = type { %vtC* }
+%vtA = type { void (%A*)* }
+%vtC = type { void (%C*)* }
+
+@_ZTV1A = constant %vtA { void (%A*)* @A_f }
+@_ZTV1C = constant %vtC { void (%C*)* @C_f }
+
+declare i8* @malloc(i32)
+
+define void @A_f(%A* %this) {
+  ret void
+}
+
+define void @other(%A* %this) {
+  ret void
+}
+
+define void @C_f(%C* %this) {
+  ret void
+}
+
+define %vtA* @makeLookalike() {
+  %mem = call i8* @malloc(i32 4)
+  %vt = bitcast i8* %mem to %vtA*
+  %slot = getelementptr %vtA, %vtA* %vt, i32 0, i32 0
+  store void (%A*)* @other, void (%A*)** %slot
+  ret %vtA* %vt
+}
+
+; CHECK-LABEL: @callA(
+; CHECK: call void %f(
+define void @callA(%A* %o) {
+  %vptr = getelementptr %A, %A* %o, i32 0, i32 0
+  %vt = load %vtA*, %vtA** %vptr
+  %slot = getelementptr %vtA, %vtA* %vt, i32 0, i32 0
+  %f = load void (%A*)*, void (%A*)** %slot
+  call void %f(%A* %o)
+  ret void
+}
+
+; CHECK-LABEL: @callC(
+; CHECK: call void @C_f(
+define void @callC(%C* %o) {
+  %vptr = getelementptr %C, %C* %o, i32 0, i32 0
+  %vt = load %vtC*, %vtC** %vptr
+  %slot = getelementptr %vtC, %vtC* %vt, i32 0, i32 0
+  %f = load void (%C*)*, void (%C*)** %slot
+  call void %f(%C* %o)
+  ret void
+}